@@ -1,12 +1,20 @@
 #ifndef COLLISION_POINT_H
 #define COLLISION_POINT_H
 
+#include <stdint.h>
+#include "vector.h"
+
+// CollisionPoint::object of hits that aren't on a packed sphere
+#define OBJECT_NONE 0xffffffffu
+
 // All information associated with a given ray collision
 class CollisionPoint {
 public:
 	Vector3 pos;
 	Vector3 normal;
 	double t_collision; // t value associated with ray to create collision
+	uint32_t material_id; // Material of the object that was hit, an index into the scene's MaterialTable
+	uint32_t object; // Slot of the sphere hit in its group's SphereSet (OBJECT_NONE outside one)
 };
 
 #endif
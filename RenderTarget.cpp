@@ -1,3 +1,6 @@
+#include <string.h>
+#include <vector>
+
 #include "RenderTarget.h"
 
 RenderTarget::RenderTarget() {
@@ -5,18 +8,54 @@ RenderTarget::RenderTarget() {
 	h = 0;
 	gtkbuf = NULL;
 	dbuf = NULL;
+	counts = NULL;
+	lum_sq = NULL;
+	albedo = NULL;
+	normal = NULL;
+	distance = NULL;
 }
 
-RenderTarget::RenderTarget(uint w_in, uint h_in) : w(w_in), h(h_in) {
+RenderTarget::RenderTarget(uint w_in, uint h_in, bool with_aovs) : w(w_in), h(h_in) {
 	ssize_t img_mem_size = BYTES_PER_PIXEL * (this->w * this->h);
 	gtkbuf = NULL;
 	dbuf = NULL;
+	counts = NULL;
+	lum_sq = NULL;
+	albedo = NULL;
+	normal = NULL;
+	distance = NULL;
 	if (img_mem_size <= MAX_IMAGE_SIZE) {
 		gtkbuf = (typeof(gtkbuf)) malloc(img_mem_size * sizeof(*gtkbuf));
 		if (NULL == gtkbuf) { fprintf(stderr, MEM_ERR_MSG); }
 
-		dbuf = (typeof(dbuf)) malloc(img_mem_size * sizeof(*dbuf));
-		if (NULL == dbuf) { fprintf(stderr, MEM_ERR_MSG); if (NULL != gtkbuf) { free(gtkbuf); }}
+		// Zeroed, every pixel starts with no samples
+		dbuf = (typeof(dbuf)) calloc(img_mem_size, sizeof(*dbuf));
+		counts = (typeof(counts)) calloc(this->w * this->h, sizeof(*counts));
+		lum_sq = (typeof(lum_sq)) calloc(this->w * this->h, sizeof(*lum_sq));
+		bool aovs_ok = true;
+		if (with_aovs) {
+			albedo = (typeof(albedo)) calloc(img_mem_size, sizeof(*albedo));
+			normal = (typeof(normal)) calloc(img_mem_size, sizeof(*normal));
+			distance = (typeof(distance)) calloc(this->w * this->h, sizeof(*distance));
+			aovs_ok = (NULL != albedo && NULL != normal && NULL != distance);
+		}
+		if (NULL == dbuf || NULL == counts || NULL == lum_sq || !aovs_ok) {
+			fprintf(stderr, MEM_ERR_MSG);
+			free(gtkbuf);
+			free(dbuf);
+			free(counts);
+			free(lum_sq);
+			free(albedo);
+			free(normal);
+			free(distance);
+			gtkbuf = NULL;
+			dbuf = NULL;
+			counts = NULL;
+			lum_sq = NULL;
+			albedo = NULL;
+			normal = NULL;
+			distance = NULL;
+		}
 	}
 	else {
 		fprintf(stderr, MEM_ERR_MSG);
@@ -26,6 +65,11 @@ RenderTarget::RenderTarget(uint w_in, uint h_in) : w(w_in), h(h_in) {
 RenderTarget::~RenderTarget () {
 	free(dbuf);
 	free(gtkbuf);
+	free(counts);
+	free(lum_sq);
+	free(albedo);
+	free(normal);
+	free(distance);
 }
 
 // Returns whether a coordinate is in bounds for this image
@@ -33,13 +77,15 @@ bool RenderTarget::in_bounds (uint x, uint y) {
 	return (x < this->w && y < this->h);
 }
 
-// Set a pixel to a color
+// Set a pixel to a color (replaces any samples it had)
 // Returns true on success, false on failure
 bool RenderTarget::setpix(uint x, uint y, color_t *c) {
 	if (NULL != this->dbuf && this->in_bounds(x,y)) {
 		this->dbuf[((BYTES_PER_PIXEL * (x + this->w * y)) + 0)] = c->r;
 		this->dbuf[((BYTES_PER_PIXEL * (x + this->w * y)) + 1)] = c->g;
 		this->dbuf[((BYTES_PER_PIXEL * (x + this->w * y)) + 2)] = c->b;
+		this->counts[x + this->w * y] = 1;
+		this->lum_sq[x + this->w * y] = pow(luminance(Vector3(c->r, c->g, c->b)), 2);
 		return true;
 	}
 	return false;
@@ -52,64 +98,160 @@ bool RenderTarget::setpix(uint x, uint y, const Vector3& v) {
 		this->dbuf[((BYTES_PER_PIXEL * (x + this->w * y)) + 0)] = v.x;
 		this->dbuf[((BYTES_PER_PIXEL * (x + this->w * y)) + 1)] = v.y;
 		this->dbuf[((BYTES_PER_PIXEL * (x + this->w * y)) + 2)] = v.z;
+		this->counts[x + this->w * y] = 1;
+		this->lum_sq[x + this->w * y] = pow(luminance(v), 2);
 		return true;
 	}
 	return false;
 }
 
-// Get a pixel (returns false if pixel doesn't exist)
+// Get a pixel, the average of its samples (returns false if pixel doesn't exist)
+// Pixels without any samples yet are black
 // Modifies c
 bool RenderTarget::getpix (uint x, uint y, color_t *c) {
 	if (NULL != this->dbuf && NULL != c && this->in_bounds(x,y)) {
-		c->r = this->dbuf[((BYTES_PER_PIXEL * (x + this->w * y)) + 0)];
-		c->g = this->dbuf[((BYTES_PER_PIXEL * (x + this->w * y)) + 1)];
-		c->b = this->dbuf[((BYTES_PER_PIXEL * (x + this->w * y)) + 2)];
+		uint32_t n = this->counts[x + this->w * y];
+		double scale = (0 == n) ? 0.0 : 1.0 / n;
+		c->r = this->dbuf[((BYTES_PER_PIXEL * (x + this->w * y)) + 0)] * scale;
+		c->g = this->dbuf[((BYTES_PER_PIXEL * (x + this->w * y)) + 1)] * scale;
+		c->b = this->dbuf[((BYTES_PER_PIXEL * (x + this->w * y)) + 2)] * scale;
 		return true;
 	}
 	return false;
 }
 
-// Maps buf -> dbuf so this RenderTarget can be displayed in a GTKWidget
-bool RenderTarget::RenderGTK(void) {
-	uint x, y;
-	color_t c;
-	uint8_t r, g, b;
-
-	if (NULL != this->gtkbuf && NULL != this->dbuf) {
-		for (x = 0; x < this->w; x++) {
-			for (y = 0; y < this->h; y++) {
-				getpix(x,y,&c);
-				r = (uint8_t)(255 * c.r);
-				g = (uint8_t)(255 * c.g);
-				b = (uint8_t)(255 * c.b);
-				setgtkpix(x,y,r,g,b);
+// Add a tile's worth of samples
+// Returns true on success, false on failure
+bool RenderTarget::accumulate(const tile_samples_t& tile) {
+	if (NULL == this->dbuf || tile.x1 > this->w || tile.y1 > this->h) return false;
+
+	std::lock_guard<std::mutex> guard(this->lock);
+	for (uint y = tile.y0; y < tile.y1; y++) {
+		for (uint x = tile.x0; x < tile.x1; x++) {
+			uint i = (y - tile.y0) * (tile.x1 - tile.x0) + (x - tile.x0);
+			this->dbuf[((BYTES_PER_PIXEL * (x + this->w * y)) + 0)] += tile.sums[i].x;
+			this->dbuf[((BYTES_PER_PIXEL * (x + this->w * y)) + 1)] += tile.sums[i].y;
+			this->dbuf[((BYTES_PER_PIXEL * (x + this->w * y)) + 2)] += tile.sums[i].z;
+			this->counts[x + this->w * y] += tile.counts[i];
+			this->lum_sq[x + this->w * y] += tile.lum_sq_sums[i];
+			if (NULL != this->albedo && NULL != tile.albedo_sums) {
+				for (uint c = 0; c < BYTES_PER_PIXEL; c++) {
+					this->albedo[(BYTES_PER_PIXEL * (x + this->w * y)) + c] += tile.albedo_sums[i][c];
+					this->normal[(BYTES_PER_PIXEL * (x + this->w * y)) + c] += tile.normal_sums[i][c];
+				}
+				this->distance[x + this->w * y] += tile.distance_sums[i];
 			}
 		}
-		return true;
 	}
-	return false;
+	return true;
 }
 
-// Set a GTK pixel to a color
+// Read back a tile's worth of samples
 // Returns true on success, false on failure
-bool RenderTarget::setgtkpix(uint x, uint y, uint8_t r, uint8_t g, uint8_t b) {
-	if (NULL != this->gtkbuf && this->in_bounds(x,y)) {
-		this->gtkbuf[sizeof(*this->gtkbuf) * ((BYTES_PER_PIXEL * (x + this->w * y)) + 0)] = r;
-		this->gtkbuf[sizeof(*this->gtkbuf) * ((BYTES_PER_PIXEL * (x + this->w * y)) + 1)] = g;
-		this->gtkbuf[sizeof(*this->gtkbuf) * ((BYTES_PER_PIXEL * (x + this->w * y)) + 2)] = b;
-		return true;
+bool RenderTarget::get_samples(uint x0, uint y0, uint x1, uint y1, Vector3 *sums, double *lum_sq_sums, uint32_t *counts_out) {
+	if (NULL == this->dbuf || x1 > this->w || y1 > this->h) return false;
+
+	std::lock_guard<std::mutex> guard(this->lock);
+	for (uint y = y0; y < y1; y++) {
+		for (uint x = x0; x < x1; x++) {
+			uint i = (y - y0) * (x1 - x0) + (x - x0);
+			sums[i] = Vector3(this->dbuf[((BYTES_PER_PIXEL * (x + this->w * y)) + 0)],
+			                  this->dbuf[((BYTES_PER_PIXEL * (x + this->w * y)) + 1)],
+			                  this->dbuf[((BYTES_PER_PIXEL * (x + this->w * y)) + 2)]);
+			lum_sq_sums[i] = this->lum_sq[x + this->w * y];
+			counts_out[i] = this->counts[x + this->w * y];
+		}
 	}
-	return false;
+	return true;
 }
 
-// Get a GTK pixel (returns false if pixel doesn't exist)
-// Modifies c
-bool RenderTarget::getgtkpix (uint x, uint y, uint8_t *r, uint8_t *g, uint8_t *b) {
-	if (NULL != this->gtkbuf && this->in_bounds(x,y)) {
-		*r = this->gtkbuf[sizeof(*this->gtkbuf) * ((BYTES_PER_PIXEL * (x + this->w * y)) + 0)];
-		*g = this->gtkbuf[sizeof(*this->gtkbuf) * ((BYTES_PER_PIXEL * (x + this->w * y)) + 1)];
-		*b = this->gtkbuf[sizeof(*this->gtkbuf) * ((BYTES_PER_PIXEL * (x + this->w * y)) + 2)];
-		return true;
+// Back to no samples at all
+void RenderTarget::clear(void) {
+	if (NULL == this->dbuf) return;
+
+	std::lock_guard<std::mutex> guard(this->lock);
+	memset(this->dbuf, 0, BYTES_PER_PIXEL * this->w * this->h * sizeof(*this->dbuf));
+	memset(this->counts, 0, this->w * this->h * sizeof(*this->counts));
+	memset(this->lum_sq, 0, this->w * this->h * sizeof(*this->lum_sq));
+	if (NULL != this->albedo) {
+		memset(this->albedo, 0, BYTES_PER_PIXEL * this->w * this->h * sizeof(*this->albedo));
+		memset(this->normal, 0, BYTES_PER_PIXEL * this->w * this->h * sizeof(*this->normal));
+		memset(this->distance, 0, this->w * this->h * sizeof(*this->distance));
 	}
-	return false;
+}
+
+// Denoise the averages, then put them back as sums over the same counts
+// Returns true on success, false on failure
+bool RenderTarget::denoise(ThreadPool& pool, const DenoiseSettings& settings) {
+	if (NULL == this->dbuf || NULL == this->albedo) return false;
+
+	size_t num_pixels = (size_t)this->w * this->h;
+	std::vector<Vector3> color(num_pixels), albedo_avg(num_pixels), normal_avg(num_pixels), denoised(num_pixels);
+	std::vector<double> distance_avg(num_pixels);
+
+	std::lock_guard<std::mutex> guard(this->lock);
+	for (size_t p = 0; p < num_pixels; p++) {
+		double scale = (0 == this->counts[p]) ? 0.0 : 1.0 / this->counts[p];
+		color[p] = scale * Vector3(this->dbuf[BYTES_PER_PIXEL * p + 0], this->dbuf[BYTES_PER_PIXEL * p + 1], this->dbuf[BYTES_PER_PIXEL * p + 2]);
+		albedo_avg[p] = scale * Vector3(this->albedo[BYTES_PER_PIXEL * p + 0], this->albedo[BYTES_PER_PIXEL * p + 1], this->albedo[BYTES_PER_PIXEL * p + 2]);
+		normal_avg[p] = scale * Vector3(this->normal[BYTES_PER_PIXEL * p + 0], this->normal[BYTES_PER_PIXEL * p + 1], this->normal[BYTES_PER_PIXEL * p + 2]);
+		distance_avg[p] = scale * this->distance[p];
+	}
+
+	DenoiseInput in = { this->w, this->h, color.data(), albedo_avg.data(), normal_avg.data(), distance_avg.data() };
+	denoise_image(in, settings, pool, denoised.data());
+
+	for (size_t p = 0; p < num_pixels; p++) {
+		for (uint c = 0; c < BYTES_PER_PIXEL; c++) this->dbuf[BYTES_PER_PIXEL * p + c] = denoised[p][c] * this->counts[p];
+	}
+	return true;
+}
+
+// One resolved pixel into either kind of output
+static inline void resolve_into(const ResolveKernel& kernel, const double *sum, double scale, uint8_t *out) {
+	kernel.to_8bit(sum[0], sum[1], sum[2], scale, out);
+}
+
+static inline void resolve_into(const ResolveKernel& kernel, const double *sum, double scale, float *out) {
+	kernel.to_float(sum[0], sum[1], sum[2], scale, out);
+}
+
+template <typename T>
+bool RenderTarget::resolve_rows(T *out, size_t row_stride, const ResolveSettings& settings, ThreadPool *pool) {
+	if (NULL == this->dbuf || NULL == out) return false;
+
+	// Copied into locals, the byte stores could alias anything else
+	const ResolveKernel shared_kernel(settings);
+	const uint w = this->w;
+	const double *dbuf = this->dbuf;
+	const uint32_t *counts = this->counts;
+	auto resolve_row = [=](size_t y, uint thread_id) {
+		const ResolveKernel kernel = shared_kernel;
+		const double *sums = dbuf + BYTES_PER_PIXEL * w * y;
+		const uint32_t *row_counts = counts + w * y;
+		T *row = out + row_stride * y;
+		for (uint x = 0; x < w; x++) {
+			double scale = (0 == row_counts[x]) ? 0.0 : 1.0 / row_counts[x];
+			resolve_into(kernel, sums + 3 * x, scale, row + 3 * x);
+		}
+	};
+
+	std::lock_guard<std::mutex> guard(this->lock);
+	if (NULL != pool) pool->parallel_for(this->h, resolve_row);
+	else for (uint y = 0; y < this->h; y++) resolve_row(y, 0);
+	return true;
+}
+
+bool RenderTarget::resolve(uint8_t *out, size_t row_stride, const ResolveSettings& settings, ThreadPool *pool) {
+	return resolve_rows(out, row_stride, settings, pool);
+}
+
+bool RenderTarget::resolve(float *out, size_t row_stride, const ResolveSettings& settings, ThreadPool *pool) {
+	return resolve_rows(out, row_stride, settings, pool);
+}
+
+// Maps dbuf -> gtkbuf so this RenderTarget can be displayed in a GTKWidget
+bool RenderTarget::RenderGTK(const ResolveSettings& settings, ThreadPool *pool) {
+	if (NULL == this->gtkbuf) return false;
+	return resolve(this->gtkbuf, BYTES_PER_PIXEL * this->w, settings, pool);
 }
@@ -5,8 +5,13 @@
 #include <stdlib.h>
 #include <limits>
 #include <cstdlib>
+#include <stdint.h>
+#include <mutex>
 
 #include "vector.h"
+#include "threadpool.h"
+#include "denoise.h"
+#include "resolve.h"
 
 // Largest image memory allocated allowed
 #define BYTES_PER_PIXEL 3 // RGB, no A
@@ -21,11 +26,32 @@ typedef struct __attribute__((__packed__)) color_struct_t {
 	double b;
 } color_t;
 
+// A tile's worth of per-pixel sample statistics, as render_samples hands them out
+// Pixels [x0, x1) x [y0, y1), every array row-major and (x1 - x0) wide
+typedef struct tile_samples_t {
+	uint x0, y0, x1, y1;
+
+	// Sum of the samples of each pixel
+	const Vector3 *sums;
+
+	// Sum of the squared luminance of each sample (for variance estimates)
+	const double *lum_sq_sums;
+
+	// How many samples each pixel has
+	const uint32_t *counts;
+
+	// Sums of the first-hit AOVs of each sample (see Wavefront::albedo),
+	// all NULL unless the render records them
+	const Vector3 *albedo_sums;
+	const Vector3 *normal_sums;
+	const double *distance_sums;
+} tile_samples_t;
+
 // Handle to a CPU allocated image buffer:
 class RenderTarget {
 public:
 	RenderTarget();
-	RenderTarget(uint w_in, uint h_in);
+	RenderTarget(uint w_in, uint h_in, bool with_aovs = false);
 	~RenderTarget();
 
 	// Set a pixel to a color
@@ -34,17 +60,43 @@ public:
 	// Set a pixel to a color, using vector XYZ as RGB channels
 	bool setpix(uint x, uint y, const Vector3 &v);
 
-	// Get a pixel (returns false if pixel doesn't exist)
+	// Get a pixel, the average of every sample it has so far
+	// (returns false if pixel doesn't exist)
 	// Modifies c
 	bool getpix(uint x, uint y, color_t *c);
 
+	// Adds a tile of samples to what its pixels already have
+	// Safe to call from several threads at once (and during RenderGTK)
+	bool accumulate(const tile_samples_t& tile);
+
+	// Copies out the accumulated statistics of pixels [x0, x1) x [y0, y1)
+	// (row-major, (x1 - x0) wide), safe while samples are coming in
+	bool get_samples(uint x0, uint y0, uint x1, uint y1, Vector3 *sums, double *lum_sq_sums, uint32_t *counts);
+
+	// Drops every sample, back to a black image
+	void clear(void);
+
+	// Replaces every pixel with its denoised color (see denoise_image)
+	// Needs the AOV buffers and tiles that filled them
+	// Returns true on success, false on failure
+	bool denoise(ThreadPool& pool, const DenoiseSettings& settings);
+
 	// Test whether x and y are in bounds for this image:
 	bool in_bounds(uint x, uint y);
 
-	// Converts dbuf into buf:
+	// Resolves the average of every pixel's samples into out (see ResolveSettings),
+	// reading dbuf in order: rows are row_stride elements apart, each
+	// 3 * w packed RGB values. Takes a consistent snapshot, even while
+	// samples are still coming in
+	// Rows are split across pool if there is one (it can't be busy with anything else)
+	// Returns true on success, false on failure
+	bool resolve(uint8_t *out, size_t row_stride, const ResolveSettings& settings, ThreadPool *pool = NULL);
+	bool resolve(float *out, size_t row_stride, const ResolveSettings& settings, ThreadPool *pool = NULL);
+
+	// Converts dbuf into gtkbuf:
 	// Gets the format of this RenderTarget ready for GTK
 	// Returns true on success, false on failure
-	bool RenderGTK(void);
+	bool RenderGTK(const ResolveSettings& settings = ResolveSettings(), ThreadPool *pool = NULL);
 
 	// Width and height:
 	uint w, h;
@@ -59,14 +111,33 @@ public:
 	uint8_t *gtkbuf;
 
 	// RGB double data (laid out same way as buf, but this uses doubles instead)
+	// Holds the running sum of every sample of a pixel, divide by
+	// counts to get its color (getpix does that)
 	// Internal calculations use this before mapping down to 8bit RGB for GTK rendering
 	// Can use this for higher-depth PNG output in the future
 	double *dbuf;
 
+	// Number of samples summed into each pixel of dbuf
+	uint32_t *counts;
+
+	// Sum of the squared luminance of every sample of each pixel
+	// With dbuf and counts this gives each pixel's noise level
+	double *lum_sq;
+
+	// Sums of the first-hit AOVs of every sample, laid out like dbuf
+	// (distance has one double per pixel)
+	// Only allocated when asked for, NULL otherwise
+	double *albedo;
+	double *normal;
+	double *distance;
+
 private:
-	// Setter & getter methods for the GTK buffer (gtkbuf)
-	bool setgtkpix(uint x, uint y, uint8_t r, uint8_t g, uint8_t b);
-	bool getgtkpix(uint x, uint y, uint8_t *r, uint8_t *g, uint8_t *b);
+	// Both resolves, T is the output element type
+	template <typename T>
+	bool resolve_rows(T *out, size_t row_stride, const ResolveSettings& settings, ThreadPool *pool);
+
+	// Guards dbuf, counts, lum_sq and the AOVs between render threads and RenderGTK
+	std::mutex lock;
 };
 
 #endif
@@ -0,0 +1,66 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include <limits>
+#include <algorithm>
+
+#include "vector.h"
+
+// Axis-aligned bounding box
+// Default constructed boxes are empty (min > max), so growing one
+// by anything gives back exactly that thing's bounds
+class AABB {
+public:
+	AABB() : min(Vector3( std::numeric_limits<double>::infinity(),  std::numeric_limits<double>::infinity(),  std::numeric_limits<double>::infinity())),
+	         max(Vector3(-std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity())) {}
+	AABB(const Vector3& min_in, const Vector3& max_in) : min(min_in), max(max_in) {}
+
+	// Expand to fit another box
+	void grow(const AABB& other) {
+		min.x = std::min(min.x, other.min.x);
+		min.y = std::min(min.y, other.min.y);
+		min.z = std::min(min.z, other.min.z);
+		max.x = std::max(max.x, other.max.x);
+		max.y = std::max(max.y, other.max.y);
+		max.z = std::max(max.z, other.max.z);
+	}
+
+	// Expand to fit a point
+	void grow(const Vector3& p) { grow(AABB(p, p)); }
+
+	Vector3 centroid() const { return Vector3(0.5 * (min.x + max.x), 0.5 * (min.y + max.y), 0.5 * (min.z + max.z)); }
+
+	// Surface area (zero for empty boxes)
+	double area() const {
+		if (min.x > max.x) return 0.0;
+		double dx = max.x - min.x, dy = max.y - min.y, dz = max.z - min.z;
+		return 2.0 * (dx * dy + dy * dz + dz * dx);
+	}
+
+	/**************************************
+	 * hit
+	 *
+	 * Slab test: intersect the [t_min, t_max] interval of the ray with
+	 * the interval it spends between each pair of parallel planes.
+	 *
+	 * inv_dir is 1/ray.dir per component, computed once per ray
+	 * Writes the entry distance into t_enter and returns true if the
+	 * ray passes through the box anywhere inside [t_min, t_max]
+	 **************************************/
+	bool hit(const Vector3& origin, const Vector3& inv_dir, double t_min, double t_max, double& t_enter) const {
+		double tx0 = (min.x - origin.x) * inv_dir.x, tx1 = (max.x - origin.x) * inv_dir.x;
+		double ty0 = (min.y - origin.y) * inv_dir.y, ty1 = (max.y - origin.y) * inv_dir.y;
+		double tz0 = (min.z - origin.z) * inv_dir.z, tz1 = (max.z - origin.z) * inv_dir.z;
+
+		t_min = std::max(t_min, std::max(std::min(tx0, tx1), std::max(std::min(ty0, ty1), std::min(tz0, tz1))));
+		t_max = std::min(t_max, std::min(std::max(tx0, tx1), std::min(std::max(ty0, ty1), std::max(tz0, tz1))));
+		t_enter = t_min;
+		return t_min <= t_max;
+	}
+
+	// Packed, so a BVH node stays one cache line
+	PackedVector3 min;
+	PackedVector3 max;
+};
+
+#endif
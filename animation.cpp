@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "animation.h"
+
+bool Animation::load(const char *path) {
+	FILE *file = fopen(path, "r");
+	char line[1024];
+	uint line_num = 0;
+
+	if (NULL == file) {
+		fprintf(stderr, "[Error] Couldn't open animation %s\n", path);
+		return false;
+	}
+
+	keys.clear();
+	spin_degrees = 0.0;
+	while (NULL != fgets(line, sizeof(line), file)) {
+		char keyword[32];
+		int used = 0;
+		line_num++;
+
+		// Comments and blank lines
+		char *hash = strchr(line, '#');
+		if (NULL != hash) *hash = '\0';
+		if (1 != sscanf(line, "%31s", keyword)) continue;
+
+		if (0 == strcmp(keyword, "key")) {
+			Key key;
+			double x, y, z;
+			int got = sscanf(line, "%*s %u %u %lf %lf %lf %n%lf %n", &key.frame, &key.sphere, &x, &y, &z, &used, &key.radius, &used);
+			if (got < 5 || '\0' != line[used]) {
+				fprintf(stderr, "[Error] %s:%u: expected key <frame> <sphere> <x> <y> <z> [radius]\n", path, line_num);
+				fclose(file);
+				return false;
+			}
+
+			// No radius: the sphere keeps its own (filled in by start())
+			if (5 == got) key.radius = -1.0;
+			else if (!(key.radius > 0)) {
+				fprintf(stderr, "[Error] %s:%u: sphere radius must be positive\n", path, line_num);
+				fclose(file);
+				return false;
+			}
+			key.center = Vector3(x, y, z);
+			keys.push_back(key);
+		}
+		else if (0 == strcmp(keyword, "turntable")) {
+			if (3 != sscanf(line, "%*s %lf %lf %lf %n", &spin_x, &spin_z, &spin_degrees, &used) || '\0' != line[used]) {
+				fprintf(stderr, "[Error] %s:%u: expected turntable <x> <z> <degrees>\n", path, line_num);
+				fclose(file);
+				return false;
+			}
+		}
+		else {
+			fprintf(stderr, "[Error] %s:%u: unknown keyword %s\n", path, line_num, keyword);
+			fclose(file);
+			return false;
+		}
+	}
+	fclose(file);
+
+	std::stable_sort(keys.begin(), keys.end(), [](const Key& a, const Key& b) {
+		return a.sphere < b.sphere || (a.sphere == b.sphere && a.frame < b.frame);
+	});
+	for (size_t i = 1; i < keys.size(); i++) {
+		if (keys[i].sphere == keys[i - 1].sphere && keys[i].frame == keys[i - 1].frame) {
+			fprintf(stderr, "[Error] %s: sphere %u has two keys on frame %u\n", path, keys[i].sphere, keys[i].frame);
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Animation::start(const WorldGroup& world) {
+	const SphereSet& spheres = world.sphere_set();
+	size_t n = spheres.size();
+
+	base_center.resize(n);
+	base_radius.resize(n);
+	for (size_t i = 0; i < n; i++) {
+		size_t slot = world.sphere_slot(i);
+		base_center[i] = Vector3(spheres.cx[slot], spheres.cy[slot], spheres.cz[slot]);
+		base_radius[i] = spheres.radius[slot];
+	}
+
+	for (Key& key : keys) {
+		if (key.sphere >= n) {
+			fprintf(stderr, "[Error] Animation moves sphere %u, but the scene only has %zu\n", key.sphere, n);
+			return false;
+		}
+		if (key.radius < 0) key.radius = base_radius[key.sphere];
+	}
+
+	built_cost = world.sah_cost();
+	return true;
+}
+
+bool Animation::set_frame(WorldGroup& world, uint frame, uint num_frames) {
+	double angle = (0 == num_frames) ? 0.0 : (spin_degrees * M_PI / 180.0) * frame / num_frames;
+	double cos_a = cos(angle), sin_a = sin(angle);
+	bool spin = (0.0 != spin_degrees);
+
+	// Nothing moves, the BVH is as it was built
+	if (empty()) return false;
+
+	// Keys of the sphere being moved are [first, last)
+	size_t first = 0;
+	for (size_t i = 0; i < base_center.size(); i++) {
+		// Without a turntable only keyed spheres move, skip to the next one
+		if (!spin) {
+			if (first == keys.size()) break;
+			i = keys[first].sphere;
+		}
+
+		Vector3 center = base_center[i];
+		double radius = base_radius[i];
+		bool keyed = (first < keys.size() && keys[first].sphere == i);
+
+		if (keyed) {
+			size_t last = first;
+			while (last < keys.size() && keys[last].sphere == i) last++;
+
+			// First key after frame, then blend with the one before
+			size_t next = first;
+			while (next < last && keys[next].frame <= frame) next++;
+			if (next == first) {
+				center = keys[first].center;
+				radius = keys[first].radius;
+			}
+			else if (next == last) {
+				center = keys[last - 1].center;
+				radius = keys[last - 1].radius;
+			}
+			else {
+				const Key& a = keys[next - 1];
+				const Key& b = keys[next];
+				double t = (double)(frame - a.frame) / (b.frame - a.frame);
+				center = a.center + (b.center - a.center) * t;
+				radius = a.radius + (b.radius - a.radius) * t;
+			}
+			first = last;
+		}
+
+		if (spin) {
+			double dx = center.x - spin_x, dz = center.z - spin_z;
+			center = Vector3(spin_x + dx * cos_a + dz * sin_a, center.y, spin_z - dx * sin_a + dz * cos_a);
+		}
+		world.move_sphere(i, center, radius);
+	}
+
+	if (world.refit() <= REFIT_REBUILD_COST * built_cost) return false;
+
+	world.rebuild();
+	built_cost = world.sah_cost();
+	return true;
+}
@@ -0,0 +1,88 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <vector>
+
+#include "vector.h"
+#include "worldObject.h"
+
+using std::vector;
+
+/**************************************
+ * Animation
+ *
+ * Moves the spheres of a scene from frame to frame, read from a small
+ * text format:
+ *
+ *   # comment
+ *   key <frame> <sphere> <x> <y> <z> [radius]
+ *   turntable <x> <z> <degrees>
+ *
+ * A key puts sphere number <sphere> (in the order the scene file lists
+ * them, or the generated scene made them) at that spot on that frame.
+ * In between keys it moves in a straight line, before the first and
+ * after the last it stays put. A turntable then spins the whole scene
+ * about the vertical axis through (x, z), by <degrees> over the
+ * sequence. Spheres with no keys stay where the scene put them.
+ *
+ * Frames are set up by moving spheres in place and refitting the BVH
+ * (see WorldGroup::refit), only rebuilding it once refitting has made
+ * it REFIT_REBUILD_COST times as slow to trace as it was when built.
+ **************************************/
+
+// How much worse (by WorldGroup::sah_cost) a refit BVH may get before it's rebuilt
+#define REFIT_REBUILD_COST 1.5
+
+class Animation {
+public:
+	Animation() : spin_x(0.0), spin_z(0.0), spin_degrees(0.0), built_cost(0.0) {}
+
+	// Reads an animation file
+	// Returns true on success, false on failure (and prints why)
+	bool load(const char *path);
+
+	// Notes where every sphere of world starts out, before the first
+	// frame is set up; keys have to name spheres world has
+	// Returns true on success, false on failure (and prints why)
+	bool start(const WorldGroup& world);
+
+	/***************
+	 * set_frame
+	 *
+	 * Moves world's spheres to where they are on frame (of num_frames),
+	 * then refits (or, if it has to, rebuilds) its BVH
+	 * Inputs: world - the group start() was given
+	 *         frame, num_frames - which frame, of how many
+	 * Outputs: true if the BVH was rebuilt, false if it was refit
+	 ***************/
+	bool set_frame(WorldGroup& world, uint frame, uint num_frames);
+
+	// Is anything animated at all?
+	bool empty() const { return keys.empty() && 0.0 == spin_degrees; }
+
+private:
+	struct Key {
+		uint frame;
+		uint32_t sphere;
+		Vector3 center;
+		double radius;
+	};
+
+	// Sorted by sphere, then frame
+	vector<Key> keys;
+
+	// The turntable
+	double spin_x, spin_z;
+	double spin_degrees;
+
+	// Every sphere as the scene had it (numbered as for WorldGroup::sphere_slot)
+	vector<Vector3> base_center;
+	vector<double> base_radius;
+
+	// sah_cost() of the BVH right after it was last built
+	double built_cost;
+};
+
+#endif
@@ -0,0 +1,364 @@
+// Benchmarks for the hot kernels and whole renders
+// Prints a summary and writes every number as JSON, so runs from two
+// versions can be compared (see `make bench`)
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "raytrace.h"
+#include "scene.h"
+#include "sphere.h"
+#include "RenderTarget.h"
+#include "utils.h"
+
+// Each timing run is grown until it takes at least this long
+#define BENCH_MIN_SECONDS 0.2
+
+// Timing runs per benchmark, the fastest one counts
+#define BENCH_REPEATS 3
+
+// Rays kept around for the kernel benchmarks (a power of two)
+#define BENCH_RAYS 4096
+
+// Everything a benchmark computes goes in here, so none of it gets optimized away
+static volatile double bench_sink = 0.0;
+
+typedef struct kernel_result_t {
+	const char *name;
+	double ns_per_op;
+} KernelResult;
+
+typedef struct scene_result_t {
+	std::string name;
+	size_t spheres;
+	uint width, height, samples;
+	double wall_s;
+	uint64_t rays;
+	uint64_t shadow_rays;
+	uint64_t image_hash;
+} SceneResult;
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Times body(iterations), doubling iterations until a run is long enough
+// to measure, then keeps the fastest of BENCH_REPEATS runs
+// Returns nanoseconds per iteration
+template <typename F>
+static double time_kernel(F body) {
+	uint64_t iterations = 1;
+	while (true) {
+		auto start = std::chrono::steady_clock::now();
+		body(iterations);
+		if (seconds_since(start) >= BENCH_MIN_SECONDS) break;
+		iterations *= 2;
+	}
+
+	double best = std::numeric_limits<double>::infinity();
+	for (uint r = 0; r < BENCH_REPEATS; r++) {
+		auto start = std::chrono::steady_clock::now();
+		body(iterations);
+		best = std::min(best, seconds_since(start));
+	}
+	return 1e9 * best / iterations;
+}
+
+// Rays from around the camera towards the middle of the scene,
+// about half of them hitting a unit sphere at (0,0,-1)
+static std::vector<Ray> bench_rays() {
+	std::vector<Ray> rays;
+	Rng rng(1);
+
+	for (uint i = 0; i < BENCH_RAYS; i++) {
+		Vector3 origin = Vector3(rng.range(-0.1, 0.1), rng.range(-0.1, 0.1), 0.0);
+		Vector3 dir = Vector3(rng.range(-0.6, 0.6), rng.range(-0.6, 0.6), -1.0);
+		rays.push_back(Ray(origin, dir));
+	}
+	return rays;
+}
+
+static double bench_sphere_hit() {
+	Sphere sphere(Vector3(0,0,-1), 0.5, 0);
+	std::vector<Ray> rays = bench_rays();
+
+	return time_kernel([&](uint64_t iterations) {
+		CollisionPoint point;
+		double sum = 0.0;
+		for (uint64_t i = 0; i < iterations; i++) {
+			if (sphere.hit(rays[i & (BENCH_RAYS - 1)], RAY_T_MIN, 1e30, point)) sum += point.t_collision;
+		}
+		bench_sink = bench_sink + sum;
+	});
+}
+
+// One full BVH leaf of spheres through the packed SIMD kernel
+static double bench_sphere_set_hit() {
+	SphereSet spheres;
+	std::vector<Ray> rays = bench_rays();
+
+	for (uint i = 0; i < BVH_MAX_LEAF; i++) {
+		spheres.add(Vector3(-0.7 + 0.2 * i, 0.1 * (i % 3), -1.0 - 0.1 * i), 0.12, 0);
+	}
+
+	return time_kernel([&](uint64_t iterations) {
+		double sum = 0.0;
+		for (uint64_t i = 0; i < iterations; i++) {
+			double t_max = 1e30;
+			sum += spheres.hit(rays[i & (BENCH_RAYS - 1)], 0, BVH_MAX_LEAF, RAY_T_MIN, t_max);
+		}
+		bench_sink = bench_sink + sum;
+	});
+}
+
+static double bench_diffuse_scatter() {
+	Material mat = make_material(MATERIAL_DIFFUSE, Vector3(0.5, 0.5, 0.5));
+	std::vector<Ray> rays = bench_rays();
+	std::vector<CollisionPoint> points(BENCH_RAYS);
+
+	for (uint i = 0; i < BENCH_RAYS; i++) {
+		points[i].pos = rays[i].at(1.0);
+		points[i].normal = unit(Vector3(0,0,1) - rays[i].dir);
+		points[i].t_collision = 1.0;
+		points[i].material_id = 0;
+	}
+	thread_rng().seed(1);
+
+	return time_kernel([&](uint64_t iterations) {
+		Ray out;
+		Vector3 attenuation;
+		double sum = 0.0;
+		for (uint64_t i = 0; i < iterations; i++) {
+			uint idx = i & (BENCH_RAYS - 1);
+			double u = rand_double(), v = rand_double();
+			scatter_diffuse(mat, rays[idx], points[idx], u, v, out, attenuation);
+			sum += out.dir.x;
+		}
+		bench_sink = bench_sink + sum;
+	});
+}
+
+// One 2D point of one sample dimension, walking pixels and bounces like a render does
+static double bench_sampler(SamplerType type) {
+	Sampler sampler(type, 1, 64);
+
+	return time_kernel([&](uint64_t iterations) {
+		double sum = 0.0;
+		for (uint64_t i = 0; i < iterations; i++) {
+			SampleId id = { (uint32_t)(i & 63), (uint32_t)((i >> 6) & 63), (uint32_t)(i >> 12) };
+			double u, v;
+			sampler.get_2d(id, (uint32_t)(i % 7), u, v);
+			sum += u + v;
+		}
+		bench_sink = bench_sink + sum;
+	});
+}
+
+// Whole camera paths through the default scene, one at a time
+static double bench_raytrace(const WorldObject& world) {
+	std::vector<Ray> rays;
+
+	for (uint y = 0; y < 64; y++) {
+		for (uint x = 0; x < 64; x++) {
+			rays.push_back(Ray(Vector3(0,0,0), Vector3(ASPECT_X * (x / 32.0 - 1.0), ASPECT_Y * (1.0 - y / 32.0), -1.0)));
+		}
+	}
+
+	return time_kernel([&](uint64_t iterations) {
+		double sum = 0.0;
+		for (uint64_t i = 0; i < iterations; i++) {
+			uint idx = i & (BENCH_RAYS - 1);
+			seed_sample_rng(1, idx, i);
+			sum += raytrace(rays[idx], world, 0, RAY_BOUNCE_DEPTH).x;
+		}
+		bench_sink = bench_sink + sum;
+	});
+}
+
+// Resolving a half-converged 640x480 frame for the window
+// Returns nanoseconds per pixel
+static double bench_render_gtk() {
+	RenderTarget img(640, 480);
+	Rng rng(1);
+
+	for (uint y = 0; y < img.h; y++) {
+		for (uint x = 0; x < img.w; x++) img.setpix(x, y, Vector3(rng.next_double(), rng.next_double(), rng.next_double()));
+	}
+
+	return time_kernel([&](uint64_t iterations) {
+		for (uint64_t i = 0; i < iterations; i++) img.RenderGTK();
+		bench_sink = bench_sink + img.gtkbuf[0];
+	}) / (img.w * img.h);
+}
+
+// Passes everything on to a world, counting the rays it gets
+// (shadow rays on their own)
+class CountingWorld : public WorldObject {
+public:
+	CountingWorld(const WorldObject& world_in) : world(world_in), rays(0), shadow_rays(0) {
+		materials = world_in.materials;
+		lights = world_in.lights;
+	}
+
+	bool hit(const Ray& ray, double t_min, double t_max, CollisionPoint& point) const {
+		rays.fetch_add(1, std::memory_order_relaxed);
+		return world.hit(ray, t_min, t_max, point);
+	}
+
+	void hit_packet(RayPacket& packet, double t_min) const {
+		rays.fetch_add(packet.size, std::memory_order_relaxed);
+		world.hit_packet(packet, t_min);
+	}
+
+	bool occluded(const Ray& ray, double t_min, double t_max) const {
+		shadow_rays.fetch_add(1, std::memory_order_relaxed);
+		return world.occluded(ray, t_min, t_max);
+	}
+
+	AABB bounding_box() const { return world.bounding_box(); }
+
+	const WorldObject& world;
+	mutable std::atomic<uint64_t> rays;
+	mutable std::atomic<uint64_t> shadow_rays;
+};
+
+// FNV-1a over the image's components (not the padding lanes),
+// to tell whether a change also changed the output
+static uint64_t hash_image(const std::vector<Vector3>& image) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (const Vector3& pixel : image) {
+		double components[3] = { pixel.x, pixel.y, pixel.z };
+		const uint8_t *bytes = (const uint8_t*)components;
+		for (size_t i = 0; i < sizeof(components); i++) hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+// Renders a generated scene with every pixel getting every sample
+// Timed on the bare scene, then rendered again through a CountingWorld for
+// the ray count (renders are deterministic, so it's the same rays)
+static SceneResult bench_scene(ThreadPool& pool, const char *name, size_t spheres, uint width, uint height, uint samples) {
+	Scene scene;
+	RenderSettings settings;
+	SceneResult result;
+	std::vector<Vector3> image((size_t)width * height);
+
+	scene.generate(1, pool, spheres);
+	settings.width = width;
+	settings.height = height;
+	settings.samples = samples;
+	settings.noise_threshold = 0;
+
+	TileSink sink = [&](uint x0, uint y0, uint x1, uint y1, const Vector3 *pixels) {
+		for (uint y = y0; y < y1; y++) {
+			for (uint x = x0; x < x1; x++) image[(size_t)y * width + x] = pixels[(y - y0) * (x1 - x0) + (x - x0)];
+		}
+	};
+
+	auto start = std::chrono::steady_clock::now();
+	render(scene.world, settings, pool, sink);
+	result.wall_s = seconds_since(start);
+	result.image_hash = hash_image(image);
+
+	CountingWorld counting(scene.world);
+	render(counting, settings, pool, sink);
+	if (hash_image(image) != result.image_hash) fprintf(stderr, "[Warning] %s: the counted render came out different, its ray counts are off\n", name);
+
+	result.name = name;
+	result.spheres = scene.world.sphere_set().size();
+	result.width = width;
+	result.height = height;
+	result.samples = samples;
+	result.rays = counting.rays;
+	result.shadow_rays = counting.shadow_rays;
+	return result;
+}
+
+static bool write_json(const char *path, uint threads, const std::vector<KernelResult>& kernels, const std::vector<SceneResult>& scenes) {
+	FILE *file = fopen(path, "w");
+
+	if (NULL == file) {
+		fprintf(stderr, "[Error] Couldn't open %s for writing\n", path);
+		return false;
+	}
+
+	fprintf(file, "{\n  \"threads\": %u,\n  \"kernels\": [\n", threads);
+	for (size_t i = 0; i < kernels.size(); i++) {
+		fprintf(file, "    {\"name\": \"%s\", \"ns_per_op\": %.3f, \"ops_per_s\": %.0f}%s\n",
+		        kernels[i].name, kernels[i].ns_per_op, 1e9 / kernels[i].ns_per_op, (i + 1 < kernels.size()) ? "," : "");
+	}
+	fprintf(file, "  ],\n  \"scenes\": [\n");
+	for (size_t i = 0; i < scenes.size(); i++) {
+		const SceneResult& s = scenes[i];
+		double total_samples = (double)s.width * s.height * s.samples;
+		fprintf(file, "    {\"name\": \"%s\", \"spheres\": %zu, \"width\": %u, \"height\": %u, \"samples_per_pixel\": %u, "
+		        "\"wall_s\": %.4f, \"samples\": %.0f, \"samples_per_s\": %.0f, \"rays\": %llu, \"rays_per_s\": %.0f, "
+		        "\"shadow_rays\": %llu, \"shadow_rays_per_s\": %.0f, \"image_hash\": \"%016llx\"}%s\n",
+		        s.name.c_str(), s.spheres, s.width, s.height, s.samples, s.wall_s, total_samples, total_samples / s.wall_s,
+		        (unsigned long long)s.rays, s.rays / s.wall_s, (unsigned long long)s.shadow_rays, s.shadow_rays / s.wall_s,
+		        (unsigned long long)s.image_hash, (i + 1 < scenes.size()) ? "," : "");
+	}
+	fprintf(file, "  ]\n}\n");
+
+	return 0 == fclose(file);
+}
+
+static void print_usage(const char *name) {
+	printf("Usage: %s [options]\n", name);
+	printf("  -o, --output FILE    Write the results as JSON to FILE (default bench.json)\n");
+	printf("  -t, --threads N      Render threads for the scene benchmarks (default: one per core)\n");
+}
+
+int main(int argc, char **argv) {
+	const char *output_path = "bench.json";
+	uint num_threads = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if ((0 == strcmp(argv[i], "-o") || 0 == strcmp(argv[i], "--output")) && i + 1 < argc) output_path = argv[++i];
+		else if ((0 == strcmp(argv[i], "-t") || 0 == strcmp(argv[i], "--threads")) && i + 1 < argc) num_threads = atoi(argv[++i]);
+		else {
+			print_usage(argv[0]);
+			return 0 == strcmp(argv[i], "-h") || 0 == strcmp(argv[i], "--help") ? 0 : 1;
+		}
+	}
+
+	ThreadPool pool(num_threads);
+	std::vector<KernelResult> kernels;
+	std::vector<SceneResult> scenes;
+
+	{
+		Scene scene;
+		scene.generate(1, pool);
+
+		kernels.push_back({"Sphere::hit", bench_sphere_hit()});
+		kernels.push_back({"SphereSet::hit (8 spheres)", bench_sphere_set_hit()});
+		kernels.push_back({"scatter_diffuse", bench_diffuse_scatter()});
+		kernels.push_back({"Sampler::get_2d (random)", bench_sampler(SAMPLER_RANDOM)});
+		kernels.push_back({"Sampler::get_2d (stratified)", bench_sampler(SAMPLER_STRATIFIED)});
+		kernels.push_back({"Sampler::get_2d (sobol)", bench_sampler(SAMPLER_SOBOL)});
+		kernels.push_back({"Sampler::get_2d (bluenoise)", bench_sampler(SAMPLER_BLUE_NOISE)});
+		kernels.push_back({"raytrace (default scene path)", bench_raytrace(scene.world)});
+		kernels.push_back({"RenderTarget::RenderGTK (per pixel)", bench_render_gtk()});
+	}
+
+	scenes.push_back(bench_scene(pool, "default", SCENE_SPHERES, 640, 360, 32));
+	scenes.push_back(bench_scene(pool, "scatter_100k", 100000, 640, 360, 16));
+
+	printf("\n%-40s %12s\n", "kernel", "ns/op");
+	for (const KernelResult& k : kernels) printf("%-40s %12.2f\n", k.name, k.ns_per_op);
+	printf("\n%-16s %10s %14s %14s %14s\n", "scene", "wall s", "samples/s", "rays/s", "shadow rays/s");
+	for (const SceneResult& s : scenes) {
+		double total_samples = (double)s.width * s.height * s.samples;
+		printf("%-16s %10.3f %14.0f %14.0f %14.0f\n", s.name.c_str(), s.wall_s, total_samples / s.wall_s, s.rays / s.wall_s, s.shadow_rays / s.wall_s);
+	}
+
+	if (!write_json(output_path, pool.size(), kernels, scenes)) return 1;
+	printf("Wrote %s\n", output_path);
+	return 0;
+}
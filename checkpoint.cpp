@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+
+#include "checkpoint.h"
+#include "utils.h"
+
+uint64_t checkpoint_settings_hash(const RenderSettings& settings) {
+	uint32_t policy = settings.roulette.policy;
+	uint32_t sampler = settings.sampler;
+	uint64_t hash = hash_bytes(&settings.width, sizeof(settings.width));
+	hash = hash_bytes(&settings.height, sizeof(settings.height), hash);
+	hash = hash_bytes(&settings.seed, sizeof(settings.seed), hash);
+	hash = hash_bytes(&settings.min_samples, sizeof(settings.min_samples), hash);
+	hash = hash_bytes(&settings.noise_threshold, sizeof(settings.noise_threshold), hash);
+	hash = hash_bytes(&settings.max_depth, sizeof(settings.max_depth), hash);
+	hash = hash_bytes(&policy, sizeof(policy), hash);
+	hash = hash_bytes(&settings.roulette.min_depth, sizeof(settings.roulette.min_depth), hash);
+	hash = hash_bytes(&settings.roulette.survival, sizeof(settings.roulette.survival), hash);
+	hash = hash_bytes(&settings.sample_lights, sizeof(settings.sample_lights), hash);
+	hash = hash_bytes(&sampler, sizeof(sampler), hash);
+	return hash;
+}
+
+// fwrite/fread of count elements, true if all of them went through
+static bool write_all(FILE *file, const void *data, size_t size, size_t count) {
+	return fwrite(data, size, count, file) == count;
+}
+
+static bool read_all(FILE *file, void *data, size_t size, size_t count) {
+	return fread(data, size, count, file) == count;
+}
+
+bool Checkpoint::save(RenderTarget& img, const RenderSettings& settings, uint samples_done) {
+	std::string tmp_path = std::string(path) + ".tmp";
+	size_t pixels = (size_t)img.w * img.h;
+	bool aovs = (NULL != img.albedo);
+	CheckpointHeader header;
+
+	if (NULL == img.dbuf) return false;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+	header.version = CHECKPOINT_VERSION;
+	header.width = img.w;
+	header.height = img.h;
+	header.samples_done = samples_done;
+	header.scene = scene_fingerprint;
+	header.settings = checkpoint_settings_hash(settings);
+	header.has_aovs = aovs;
+	header.samples = settings.samples;
+
+	FILE *file = fopen(tmp_path.c_str(), "wb");
+	if (NULL == file) {
+		fprintf(stderr, "[Error] Couldn't open %s for writing\n", tmp_path.c_str());
+		return false;
+	}
+
+	bool ok = write_all(file, &header, sizeof(header), 1) &&
+	          write_all(file, img.dbuf, sizeof(double), BYTES_PER_PIXEL * pixels) &&
+	          write_all(file, img.lum_sq, sizeof(double), pixels) &&
+	          write_all(file, img.counts, sizeof(uint32_t), pixels);
+	if (ok && aovs) {
+		ok = write_all(file, img.albedo, sizeof(double), BYTES_PER_PIXEL * pixels) &&
+		     write_all(file, img.normal, sizeof(double), BYTES_PER_PIXEL * pixels) &&
+		     write_all(file, img.distance, sizeof(double), pixels);
+	}
+
+	// On disk before it replaces the last good checkpoint
+	ok = ok && 0 == fflush(file) && 0 == fsync(fileno(file));
+	ok = (0 == fclose(file)) && ok;
+	ok = ok && 0 == rename(tmp_path.c_str(), path);
+	if (!ok) {
+		fprintf(stderr, "[Error] Failed writing checkpoint %s\n", path);
+		unlink(tmp_path.c_str());
+	}
+	return ok;
+}
+
+bool Checkpoint::load(RenderTarget& img, const RenderSettings& settings, uint *samples_done) {
+	size_t pixels = (size_t)img.w * img.h;
+	CheckpointHeader header;
+
+	if (NULL == img.dbuf) return false;
+
+	FILE *file = fopen(path, "rb");
+	if (NULL == file) {
+		fprintf(stderr, "[Error] Couldn't open checkpoint %s\n", path);
+		return false;
+	}
+
+	bool ok = false;
+	if (!read_all(file, &header, sizeof(header), 1) || 0 != memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC))) {
+		fprintf(stderr, "[Error] %s is not a checkpoint\n", path);
+	}
+	else if (CHECKPOINT_VERSION != header.version) {
+		fprintf(stderr, "[Error] %s is checkpoint version %u, expected %u\n", path, header.version, CHECKPOINT_VERSION);
+	}
+	else if (header.width != img.w || header.height != img.h) {
+		fprintf(stderr, "[Error] %s is a %ux%u render, not %ux%u\n", path, header.width, header.height, img.w, img.h);
+	}
+	else if (header.scene != scene_fingerprint) {
+		fprintf(stderr, "[Error] %s was rendered from a different scene\n", path);
+	}
+	else if (header.settings != checkpoint_settings_hash(settings)) {
+		fprintf(stderr, "[Error] %s was rendered with different settings (seed, depth, noise, roulette, light sampling or sampler)\n", path);
+	}
+	else if (SAMPLER_STRATIFIED == settings.sampler && header.samples != settings.samples) {
+		fprintf(stderr, "[Error] %s is a stratified render of %u samples, it can only be resumed with -n %u\n", path, header.samples, header.samples);
+	}
+	else if (NULL != img.albedo && !header.has_aovs) {
+		fprintf(stderr, "[Error] %s was rendered without --denoise, so it can't be denoised\n", path);
+	}
+	else {
+		ok = read_all(file, img.dbuf, sizeof(double), BYTES_PER_PIXEL * pixels) &&
+		     read_all(file, img.lum_sq, sizeof(double), pixels) &&
+		     read_all(file, img.counts, sizeof(uint32_t), pixels);
+		if (ok && NULL != img.albedo) {
+			ok = read_all(file, img.albedo, sizeof(double), BYTES_PER_PIXEL * pixels) &&
+			     read_all(file, img.normal, sizeof(double), BYTES_PER_PIXEL * pixels) &&
+			     read_all(file, img.distance, sizeof(double), pixels);
+		}
+		if (!ok) {
+			fprintf(stderr, "[Error] %s is cut short\n", path);
+			img.clear();
+		}
+		else *samples_done = header.samples_done;
+	}
+
+	fclose(file);
+	return ok;
+}
+
+bool render_checkpointed(RenderTarget& img, const WorldObject& world, const RenderSettings& settings, ThreadPool& pool, Checkpoint& checkpoint, uint first_sample, const std::atomic<bool>& stop, RenderStats *stats) {
+	typedef std::chrono::steady_clock Clock;
+	std::atomic<uint64_t> pixels_done(0);
+	uint64_t img_pixels = (uint64_t)settings.width * settings.height;
+	uint sample = first_sample;
+	Clock::time_point last_save = Clock::now();
+	bool ok = true;
+
+	if (img.w != settings.width || img.h != settings.height) return false;
+
+	stats_reset();
+	printf("Raytracing on %u threads, from sample %u!\n", pool.size(), first_sample);
+
+	while (ok && sample < settings.samples && !stop) {
+		uint num_samples = std::min((uint)CHECKPOINT_PASS_SAMPLES, settings.samples - sample);
+
+		// Progress through every sample, not just this pass
+		pixels_done = 0;
+		ok = render_samples(world, settings, pool, sample, num_samples, [&](const tile_samples_t& tile) {
+			img.accumulate(tile);
+			pixels_done += (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+		}, &img, [&]() {
+			print_progress(100.0 * (sample + (double)num_samples * pixels_done / img_pixels) / settings.samples);
+		});
+		sample += num_samples;
+
+		// Always after the last pass, so a finished render can be given more samples later
+		bool due = std::chrono::duration<double>(Clock::now() - last_save).count() >= checkpoint.interval;
+		if (ok && (stop || due || sample >= settings.samples)) {
+			ok = checkpoint.save(img, settings, sample);
+			last_save = Clock::now();
+		}
+	}
+
+	// Stopped before the first pass was done, still leave a checkpoint to resume from
+	if (ok && stop && sample == first_sample) ok = checkpoint.save(img, settings, sample);
+	if (ok && sample >= settings.samples) printf("\nDone!\n");
+
+	if (NULL != stats) {
+		*stats = stats_collect();
+		stats->pixels = img_pixels;
+	}
+	return ok && sample >= settings.samples;
+}
@@ -0,0 +1,116 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <atomic>
+
+#include "raytrace.h"
+#include "RenderTarget.h"
+#include "stats.h"
+#include "threadpool.h"
+#include "worldObject.h"
+
+/**************************************
+ * Checkpoints
+ *
+ * Long renders are taken in passes of CHECKPOINT_PASS_SAMPLES samples
+ * per pixel, and every so often the accumulated samples are written out
+ * between two passes. Samples only depend on the seed and their index,
+ * so the next sample index is all the random state there is, and a
+ * resumed render picks up exactly where the checkpoint left off:
+ *
+ *   CheckpointHeader
+ *   double dbuf[3 * width * height]
+ *   double lum_sq[width * height]
+ *   uint32_t counts[width * height]
+ *   double albedo[3 * width * height], normal[...], distance[width * height]   (if has_aovs)
+ *
+ * Files are native-endian, like compiled scenes. They're written to a
+ * temporary file first and renamed over the old one, so a crash while
+ * saving leaves the last checkpoint as it was.
+ **************************************/
+
+#define CHECKPOINT_MAGIC "RTCKPT"
+#define CHECKPOINT_VERSION 1
+
+// Samples per pixel in each pass (convergence is checked on the same boundaries)
+#define CHECKPOINT_PASS_SAMPLES ADAPTIVE_STEP
+
+// Default seconds between checkpoints
+#define CHECKPOINT_SECONDS 300
+
+typedef struct checkpoint_header_t {
+	// CHECKPOINT_MAGIC, NUL padded
+	char magic[8];
+	uint32_t version;
+
+	uint32_t width, height;
+
+	// Samples [0, samples_done) of every pixel are in the file
+	// (fewer for pixels that had converged)
+	uint32_t samples_done;
+
+	// Scene::fingerprint() of the scene, and checkpoint_settings_hash()
+	// of the settings, that the samples were rendered with
+	uint64_t scene;
+	uint64_t settings;
+
+	// Whether the first-hit AOV arrays follow
+	uint32_t has_aovs;
+
+	// Samples per pixel (-n) the render was started with: the stratified
+	// grid is sized for it, so stratified renders have to resume with it
+	uint32_t samples;
+} CheckpointHeader;
+
+// Hash of every setting that changes what a sample comes out as
+// (not the sample count, so a resumed render can be given more)
+uint64_t checkpoint_settings_hash(const RenderSettings& settings);
+
+class Checkpoint {
+public:
+	Checkpoint() : path(NULL), interval(CHECKPOINT_SECONDS), scene_fingerprint(0) {}
+
+	// Writes img, with samples [0, samples_done) taken, to path
+	// Returns true on success, false on failure (and prints why)
+	bool save(RenderTarget& img, const RenderSettings& settings, uint samples_done);
+
+	// Replaces whatever img has with the samples saved at path, and sets
+	// samples_done to how many were taken
+	// Fails if they were rendered from a different scene or settings
+	// Returns true on success, false on failure (and prints why)
+	bool load(RenderTarget& img, const RenderSettings& settings, uint *samples_done);
+
+	// Where checkpoints go (NULL turns them off)
+	const char *path;
+
+	// Seconds between checkpoints
+	double interval;
+
+	// Scene::fingerprint() of the scene being rendered
+	uint64_t scene_fingerprint;
+};
+
+/***************
+ * render_checkpointed
+ *
+ * Renders into img in passes, from sample first_sample on, saving a
+ * checkpoint every checkpoint.interval seconds and once more at the end
+ * Stops early, after the pass in flight and a last checkpoint, once
+ * stop is set
+ * Inputs: img - the frame so far (samples [0, first_sample) of each pixel)
+ *         world - the root object of the scene
+ *         settings - frame size, sample count, bounce depth and seed
+ *         pool - the worker threads to split tiles across
+ *         checkpoint - where and how often to save
+ *         first_sample - the first sample not in img yet
+ *         stop - set (say, from a signal handler) to stop early
+ *         stats - gets the render statistics of this run, if not NULL
+ * Outputs: true if every sample was taken, false if stopped early or
+ *          on failure
+ * Side Effects: Resets the per-thread stats counters
+ ***************/
+bool render_checkpointed(RenderTarget& img, const WorldObject& world, const RenderSettings& settings, ThreadPool& pool, Checkpoint& checkpoint, uint first_sample, const std::atomic<bool>& stop, RenderStats *stats = NULL);
+
+#endif
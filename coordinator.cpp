@@ -0,0 +1,486 @@
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <chrono>
+#include <string>
+#include <type_traits>
+
+#include "coordinator.h"
+
+/**************************************
+ * Wire format
+ *
+ * Both ends are the same binary, so everything goes over as is
+ * (little-endian, packed structs, RenderSettings byte for byte)
+ *
+ *   worker -> coordinator: WireHello
+ *   coordinator -> worker: RenderSettings
+ *   then, until the frame is done:
+ *   coordinator -> worker: WireJob
+ *   worker -> coordinator: a WireTile, then its arrays, for each tile of the job
+ **************************************/
+
+#define WIRE_MAGIC 0x46425452 // "RTBF"
+#define WIRE_VERSION 1
+
+static_assert(std::is_trivially_copyable<RenderSettings>::value, "RenderSettings is sent to workers byte for byte");
+
+typedef struct __attribute__((__packed__)) wire_hello_t {
+	uint32_t magic, version;
+	uint32_t settings_size;
+	uint64_t scene;
+} WireHello;
+
+// num_tiles of 0 means the frame is done
+typedef struct __attribute__((__packed__)) wire_job_t {
+	uint32_t job, first_tile, num_tiles;
+} WireJob;
+
+// Followed by, for every pixel of the tile in turn: sums (3 doubles),
+// then lum_sq_sums (doubles), then counts (uint32), and if aovs is set
+// albedo_sums and normal_sums (3 doubles each) and distance_sums
+typedef struct __attribute__((__packed__)) wire_tile_t {
+	uint32_t job;
+	uint32_t x0, y0, x1, y1;
+	uint32_t aovs;
+} WireTile;
+
+/**************************************
+ * Sockets
+ **************************************/
+
+// Splits "[host:]port" into its parts
+static void split_address(const char *address, std::string& host, std::string& port) {
+	const char *colon = strrchr(address, ':');
+	host = (NULL == colon) ? "" : std::string(address, colon - address);
+	port = (NULL == colon) ? address : colon + 1;
+}
+
+static bool is_unix_address(const char *address) {
+	return NULL != strchr(address, '/');
+}
+
+static bool fill_unix_address(const char *path, sockaddr_un& addr) {
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) return false;
+	strcpy(addr.sun_path, path);
+	return true;
+}
+
+// Returns a listening socket, or -1
+static int open_listener(const char *address) {
+	if (is_unix_address(address)) {
+		sockaddr_un addr;
+		if (!fill_unix_address(address, addr)) return -1;
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0) return -1;
+		unlink(address);
+		if (0 != bind(fd, (sockaddr*)&addr, sizeof(addr)) || 0 != ::listen(fd, 64)) {
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	std::string host, port;
+	split_address(address, host, port);
+	addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if (0 != getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints, &res)) return -1;
+
+	int fd = -1;
+	for (addrinfo *ai = res; NULL != ai && fd < 0; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0) continue;
+		int yes = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+		if (0 != bind(fd, ai->ai_addr, ai->ai_addrlen) || 0 != ::listen(fd, 64)) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+
+// Returns a socket connected to address, or -1
+static int connect_to(const char *address) {
+	if (is_unix_address(address)) {
+		sockaddr_un addr;
+		if (!fill_unix_address(address, addr)) return -1;
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd >= 0 && 0 != connect(fd, (sockaddr*)&addr, sizeof(addr))) {
+			close(fd);
+			fd = -1;
+		}
+		return fd;
+	}
+
+	std::string host, port;
+	split_address(address, host, port);
+	addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (0 != getaddrinfo(host.empty() ? "localhost" : host.c_str(), port.c_str(), &hints, &res)) return -1;
+
+	int fd = -1;
+	for (addrinfo *ai = res; NULL != ai && fd < 0; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd >= 0 && 0 != connect(fd, ai->ai_addr, ai->ai_addrlen)) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(res);
+
+	// Tiles are sent as they finish, don't hold them back
+	if (fd >= 0 && !is_unix_address(address)) {
+		int yes = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+	}
+	return fd;
+}
+
+// Returns false if the other end has gone away
+static bool send_all(int fd, const void *data, size_t len) {
+	const uint8_t *bytes = (const uint8_t*)data;
+	while (len > 0) {
+		ssize_t sent = send(fd, bytes, len, MSG_NOSIGNAL);
+		if (sent < 0 && EINTR == errno) continue;
+		if (sent <= 0) return false;
+		bytes += sent;
+		len -= sent;
+	}
+	return true;
+}
+
+static bool recv_all(int fd, void *data, size_t len) {
+	uint8_t *bytes = (uint8_t*)data;
+	while (len > 0) {
+		ssize_t got = recv(fd, bytes, len, 0);
+		if (got < 0 && EINTR == errno) continue;
+		if (got <= 0) return false;
+		bytes += got;
+		len -= got;
+	}
+	return true;
+}
+
+static void append(std::vector<uint8_t>& out, const void *data, size_t len) {
+	out.insert(out.end(), (const uint8_t*)data, (const uint8_t*)data + len);
+}
+
+static void append_vectors(std::vector<uint8_t>& out, const Vector3 *v, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		double xyz[3] = { v[i].x, v[i].y, v[i].z };
+		append(out, xyz, sizeof(xyz));
+	}
+}
+
+static bool recv_vectors(int fd, std::vector<Vector3>& v) {
+	std::vector<double> xyz(3 * v.size());
+	if (!recv_all(fd, xyz.data(), xyz.size() * sizeof(double))) return false;
+	for (size_t i = 0; i < v.size(); i++) v[i] = Vector3(xyz[3*i + 0], xyz[3*i + 1], xyz[3*i + 2]);
+	return true;
+}
+
+/**************************************
+ * Coordinator
+ **************************************/
+Coordinator::~Coordinator() {
+	if (listener >= 0) {
+		close(listener);
+		if (is_unix_address(address)) unlink(address);
+	}
+}
+
+bool Coordinator::listen(const char *address_in, uint64_t scene_fingerprint_in) {
+	snprintf(address, sizeof(address), "%s", address_in);
+	scene_fingerprint = scene_fingerprint_in;
+	listener = open_listener(address);
+	if (listener < 0) {
+		fprintf(stderr, "[Error] Couldn't listen for workers on %s: %s\n", address, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+bool Coordinator::render(const RenderSettings& settings, const SampleSink& sink, const ThreadPool::Idle& idle) {
+	if (listener < 0) return false;
+
+	uint num_tiles = frame_tiles(settings);
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		finished = false;
+		tiles_done = 0;
+		next_issue = 0;
+		tile_claimed.assign(num_tiles, false);
+		jobs.clear();
+		for (uint first = 0; first < num_tiles; first += COORDINATOR_JOB_TILES) {
+			Job job = { first, std::min((uint)COORDINATOR_JOB_TILES, num_tiles - first), 0, 0, 0 };
+			jobs.push_back(job);
+		}
+	}
+
+	printf("Waiting for workers on %s (%u jobs)\n", address, (uint)jobs.size());
+	std::thread acceptor(&Coordinator::accept_workers, this, std::cref(settings), std::cref(sink));
+
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		while (tiles_done < num_tiles) {
+			changed.wait_for(guard, std::chrono::milliseconds(100));
+			if (idle) {
+				guard.unlock();
+				idle();
+				guard.lock();
+			}
+		}
+
+		// Idle workers are told the frame is done, busy ones (working on
+		// copies nobody needs any more) are cut off
+		finished = true;
+		changed.notify_all();
+		for (Connection *conn : connections) {
+			if (!conn->idle) shutdown(conn->fd, SHUT_RDWR);
+		}
+	}
+
+	acceptor.join();
+	for (Connection *conn : connections) {
+		conn->thread.join();
+		close(conn->fd);
+		delete conn;
+	}
+	connections.clear();
+	return true;
+}
+
+void Coordinator::accept_workers(const RenderSettings& settings, const SampleSink& sink) {
+	pollfd pfd = { listener, POLLIN, 0 };
+
+	while (true) {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (finished) return;
+		}
+		if (poll(&pfd, 1, 100) <= 0) continue;
+
+		int fd = accept(listener, NULL, NULL);
+		if (fd < 0) continue;
+
+		std::lock_guard<std::mutex> guard(lock);
+		if (finished) {
+			close(fd);
+			return;
+		}
+		Connection *conn = new Connection();
+		conn->fd = fd;
+		conn->idle = false;
+		connections.push_back(conn);
+		conn->thread = std::thread([this, conn, &settings, &sink]() {
+			// Hung up on either way, so the worker isn't left waiting
+			serve(conn, settings, sink);
+			shutdown(conn->fd, SHUT_RDWR);
+		});
+	}
+}
+
+void Coordinator::serve(Connection *conn, const RenderSettings& settings, const SampleSink& sink) {
+	WireHello hello;
+	if (!recv_all(conn->fd, &hello, sizeof(hello))) return;
+	if (WIRE_MAGIC != hello.magic || WIRE_VERSION != hello.version || sizeof(RenderSettings) != hello.settings_size) {
+		fprintf(stderr, "[Error] A worker from a different build connected, dropped it\n");
+		return;
+	}
+	if (scene_fingerprint != hello.scene) {
+		fprintf(stderr, "[Error] A worker with a different scene connected, dropped it\n");
+		return;
+	}
+	if (!send_all(conn->fd, &settings, sizeof(settings))) return;
+
+	uint img_w = settings.width, img_h = settings.height;
+	uint tiles_x = (img_w + TILE_SIZE - 1) / TILE_SIZE;
+
+	int job;
+	while ((job = next_job(conn)) >= 0) {
+		WireJob wire_job = { (uint32_t)job, jobs[job].first_tile, jobs[job].num_tiles };
+		bool ok = send_all(conn->fd, &wire_job, sizeof(wire_job));
+
+		// Every tile of the job comes back, in whatever order it finished
+		for (uint k = 0; ok && k < wire_job.num_tiles; k++) {
+			WireTile head;
+			ok = recv_all(conn->fd, &head, sizeof(head));
+			if (!ok) break;
+
+			// Inside the frame first: a corner past the last tile column would
+			// otherwise wrap onto the next row and pass every other check
+			uint tile = 0;
+			ok = (head.job == (uint32_t)job) && head.x0 < img_w && head.y0 < img_h &&
+			     0 == head.x0 % TILE_SIZE && 0 == head.y0 % TILE_SIZE &&
+			     head.x1 == std::min(head.x0 + TILE_SIZE, img_w) && head.y1 == std::min(head.y0 + TILE_SIZE, img_h);
+			if (ok) {
+				tile = (head.y0 / TILE_SIZE) * tiles_x + head.x0 / TILE_SIZE;
+				ok = tile >= wire_job.first_tile && tile < wire_job.first_tile + wire_job.num_tiles &&
+				     head.aovs == (uint32_t)settings.wants_aovs();
+			}
+			if (!ok) {
+				fprintf(stderr, "[Error] A worker sent a tile it wasn't asked for, dropped it\n");
+				break;
+			}
+
+			size_t n = (size_t)(head.x1 - head.x0) * (head.y1 - head.y0);
+			std::vector<Vector3> sums(n), albedo(head.aovs ? n : 0), normal(head.aovs ? n : 0);
+			std::vector<double> lum_sq(n), distance(head.aovs ? n : 0);
+			std::vector<uint32_t> counts(n);
+			ok = recv_vectors(conn->fd, sums) && recv_all(conn->fd, lum_sq.data(), n * sizeof(double)) &&
+			     recv_all(conn->fd, counts.data(), n * sizeof(uint32_t));
+			if (ok && head.aovs) {
+				ok = recv_vectors(conn->fd, albedo) && recv_vectors(conn->fd, normal) &&
+				     recv_all(conn->fd, distance.data(), n * sizeof(double));
+			}
+			if (!ok) break;
+
+			tile_samples_t samples = { head.x0, head.y0, head.x1, head.y1, sums.data(), lum_sq.data(), counts.data(),
+			                           head.aovs ? albedo.data() : NULL, head.aovs ? normal.data() : NULL, head.aovs ? distance.data() : NULL };
+			add_tile(job, tile, samples, sink);
+		}
+
+		// A job left unfinished goes back to the queue
+		release_job(conn, job);
+		if (!ok) return;
+	}
+
+	WireJob done = { 0, 0, 0 };
+	send_all(conn->fd, &done, sizeof(done));
+}
+
+int Coordinator::next_job(Connection *conn) {
+	std::unique_lock<std::mutex> guard(lock);
+	conn->idle = true;
+
+	while (!finished) {
+		// First any job nobody has, then a copy of the one that has been
+		// out the longest with the fewest workers on it
+		int best = -1;
+		for (size_t j = 0; j < jobs.size(); j++) {
+			const Job& job = jobs[j];
+			if (job.tiles_done == job.num_tiles || job.holders >= COORDINATOR_MAX_COPIES) continue;
+			if (0 == job.holders) {
+				best = j;
+				break;
+			}
+			if (best < 0 || job.holders < jobs[best].holders ||
+			    (job.holders == jobs[best].holders && job.issued < jobs[best].issued)) best = j;
+		}
+
+		if (best >= 0) {
+			jobs[best].holders++;
+			jobs[best].issued = next_issue++;
+			conn->idle = false;
+			return best;
+		}
+		changed.wait(guard);
+	}
+	return -1;
+}
+
+void Coordinator::add_tile(uint job, uint tile, const tile_samples_t& samples, const SampleSink& sink) {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (tile_claimed[tile]) return;
+		tile_claimed[tile] = true;
+	}
+
+	sink(samples);
+
+	std::lock_guard<std::mutex> guard(lock);
+	jobs[job].tiles_done++;
+	tiles_done++;
+	changed.notify_all();
+}
+
+void Coordinator::release_job(Connection *conn, uint job) {
+	std::lock_guard<std::mutex> guard(lock);
+	jobs[job].holders--;
+	changed.notify_all();
+}
+
+/**************************************
+ * Worker
+ **************************************/
+bool render_worker(const char *address, const WorldObject& world, uint64_t scene_fingerprint, ThreadPool& pool) {
+	int fd = -1;
+
+	// The coordinator may not be up yet
+	for (uint tries = 0; fd < 0 && tries < 10 * WORKER_CONNECT_SECONDS; tries++) {
+		fd = connect_to(address);
+		if (fd < 0) usleep(100000);
+	}
+	if (fd < 0) {
+		fprintf(stderr, "[Error] Couldn't reach a coordinator at %s\n", address);
+		return false;
+	}
+
+	WireHello hello = { WIRE_MAGIC, WIRE_VERSION, sizeof(RenderSettings), scene_fingerprint };
+	RenderSettings settings;
+	if (!send_all(fd, &hello, sizeof(hello)) || !recv_all(fd, &settings, sizeof(settings))) {
+		fprintf(stderr, "[Error] The coordinator at %s turned us away (different scene or build?)\n", address);
+		close(fd);
+		return false;
+	}
+	printf("Rendering %ux%u for %s on %u threads\n", settings.width, settings.height, address, pool.size());
+
+	uint jobs_done = 0;
+	WireJob job;
+	while (recv_all(fd, &job, sizeof(job)) && job.num_tiles > 0) {
+		std::mutex send_lock;
+		bool connected = true;
+
+		bool rendered = render_tile_range(world, settings, pool, job.first_tile, job.num_tiles, 0, settings.samples, [&](const tile_samples_t& tile) {
+			size_t n = (size_t)(tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+			bool aovs = (NULL != tile.albedo_sums);
+			WireTile head = { job.job, tile.x0, tile.y0, tile.x1, tile.y1, aovs };
+			std::vector<uint8_t> msg;
+
+			append(msg, &head, sizeof(head));
+			append_vectors(msg, tile.sums, n);
+			append(msg, tile.lum_sq_sums, n * sizeof(double));
+			append(msg, tile.counts, n * sizeof(uint32_t));
+			if (aovs) {
+				append_vectors(msg, tile.albedo_sums, n);
+				append_vectors(msg, tile.normal_sums, n);
+				append(msg, tile.distance_sums, n * sizeof(double));
+			}
+
+			std::lock_guard<std::mutex> guard(send_lock);
+			if (connected) connected = send_all(fd, msg.data(), msg.size());
+		});
+
+		// Hanging up hands the job back
+		if (!rendered) {
+			fprintf(stderr, "[Error] Got a job for tiles the frame doesn't have\n");
+			close(fd);
+			return false;
+		}
+
+		// Cut off: someone else's copy of this job won
+		if (!connected) break;
+		jobs_done++;
+	}
+
+	printf("Done, rendered %u jobs\n", jobs_done);
+	close(fd);
+	return true;
+}
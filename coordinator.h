@@ -0,0 +1,121 @@
+#ifndef COORDINATOR_H
+#define COORDINATOR_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "raytrace.h"
+#include "threadpool.h"
+#include "worldObject.h"
+
+/**************************************
+ * Distributed rendering
+ *
+ * A coordinator splits a frame into jobs of a few tiles each and hands
+ * them over TCP or a Unix socket to worker processes (this same binary
+ * with --worker), which send back every tile's samples. Those go to the
+ * frame's SampleSink exactly as local tiles would, so the image comes
+ * out bit for bit the same as a single-process render.
+ *
+ * A job held by a worker that disconnects goes back in the queue. Once
+ * the queue is empty, idle workers get copies of the jobs still out,
+ * so one slow (or hung) worker can't hold up the frame. Whichever copy
+ * of a tile arrives first is kept and the rest are dropped.
+ *
+ * Addresses are "[host:]port" for TCP, or a path (anything with a '/')
+ * for a Unix socket.
+ **************************************/
+
+// Tiles per job
+#define COORDINATOR_JOB_TILES 32
+
+// Most workers given the same job at once
+#define COORDINATOR_MAX_COPIES 2
+
+// How long a worker keeps trying to reach the coordinator
+#define WORKER_CONNECT_SECONDS 10
+
+class Coordinator {
+public:
+	Coordinator() : listener(-1), scene_fingerprint(0), finished(false), tiles_done(0), next_issue(0) {}
+	~Coordinator();
+
+	// Starts listening for workers on address, which have to have
+	// loaded the scene with this fingerprint (see Scene::fingerprint)
+	// Returns true on success, false on failure (and prints why)
+	bool listen(const char *address, uint64_t scene_fingerprint_in);
+
+	// Renders a frame on whatever workers connect, handing every tile's
+	// samples to sink (from connection threads, several at once)
+	// Blocks until every tile is back, calling idle every so often
+	// Returns true on success, false on failure
+	bool render(const RenderSettings& settings, const SampleSink& sink, const ThreadPool::Idle& idle);
+
+private:
+	struct Job {
+		uint first_tile, num_tiles;
+		uint tiles_done;
+
+		// Workers working on it right now
+		uint holders;
+
+		// When it was last handed out (bigger is later)
+		uint64_t issued;
+	};
+
+	struct Connection {
+		int fd;
+		std::thread thread;
+
+		// Waiting for a job, rather than in the middle of one
+		bool idle;
+	};
+
+	// Serves one worker until the frame is done or the worker goes away
+	void serve(Connection *conn, const RenderSettings& settings, const SampleSink& sink);
+
+	// Accepts workers until the frame is done
+	void accept_workers(const RenderSettings& settings, const SampleSink& sink);
+
+	// Blocks until there's a job for a worker, returns -1 once the frame is done
+	int next_job(Connection *conn);
+
+	// Passes a tile to sink unless another worker's copy got there first
+	void add_tile(uint job, uint tile, const tile_samples_t& samples, const SampleSink& sink);
+
+	// A worker is done with (or has dropped) job
+	void release_job(Connection *conn, uint job);
+
+	int listener;
+	char address[256];
+	uint64_t scene_fingerprint;
+
+	// Everything below is guarded by lock
+	std::mutex lock;
+	std::condition_variable changed;
+	bool finished;
+	std::vector<Job> jobs;
+	std::vector<bool> tile_claimed;
+	uint64_t tiles_done;
+	uint64_t next_issue;
+	std::vector<Connection*> connections;
+};
+
+/***************
+ * render_worker
+ *
+ * Connects to a coordinator at address and renders the jobs it hands
+ * out on pool, until the coordinator says the frame is done or hangs up
+ * Inputs: address - where the coordinator is listening
+ *         world - the scene, the same one the coordinator has
+ *         scene_fingerprint - Scene::fingerprint() of it
+ *         pool - the threads to render on
+ * Outputs: true if successful, false otherwise (and prints why)
+ ***************/
+bool render_worker(const char *address, const WorldObject& world, uint64_t scene_fingerprint, ThreadPool& pool);
+
+#endif
@@ -0,0 +1,71 @@
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include "denoise.h"
+
+// B3 spline, the a-trous kernel along each axis
+static const double b3_kernel[5] = { 1.0/16, 1.0/4, 3.0/8, 1.0/4, 1.0/16 };
+
+// The albedo lighting gets divided by, every channel at least DENOISE_ALBEDO_FLOOR
+static inline Vector3 albedo_floor(const Vector3& albedo) {
+	return Vector3(std::max(albedo.x, DENOISE_ALBEDO_FLOOR), std::max(albedo.y, DENOISE_ALBEDO_FLOOR), std::max(albedo.z, DENOISE_ALBEDO_FLOOR));
+}
+
+void denoise_image(const DenoiseInput& in, const DenoiseSettings& settings, ThreadPool& pool, Vector3 *out) {
+	int w = in.w, h = in.h;
+	size_t num_pixels = (size_t)w * h;
+	std::vector<Vector3> cur(num_pixels), next(num_pixels);
+
+	// Lighting only, the surface colors go back on at the end
+	for (size_t p = 0; p < num_pixels; p++) {
+		Vector3 albedo = albedo_floor(in.albedo[p]);
+		cur[p] = Vector3(in.color[p].x / albedo.x, in.color[p].y / albedo.y, in.color[p].z / albedo.z);
+	}
+
+	double inv_albedo = 1.0 / (settings.sigma_albedo * settings.sigma_albedo);
+	double inv_normal = 1.0 / (settings.sigma_normal * settings.sigma_normal);
+
+	for (uint pass = 0; pass < settings.passes; pass++) {
+		int step = 1 << pass;
+		double sigma_color = ldexp(settings.sigma_color, -(int)pass);
+		double inv_color = 1.0 / (sigma_color * sigma_color);
+
+		pool.parallel_for(h, [&](size_t row, uint thread_id) {
+			int y = row;
+			for (int x = 0; x < w; x++) {
+				size_t p = (size_t)y * w + x;
+				Vector3 sum = Vector3(0,0,0);
+				double weight_sum = 0.0;
+
+				for (int j = -2; j <= 2; j++) {
+					int qy = y + j * step;
+					if (qy < 0 || qy >= h) continue;
+
+					for (int i = -2; i <= 2; i++) {
+						int qx = x + i * step;
+						if (qx < 0 || qx >= w) continue;
+
+						// The center tap always has weight, so weight_sum can't end up 0
+						size_t q = (size_t)qy * w + qx;
+						Vector3 d_color = cur[q] - cur[p];
+						Vector3 d_albedo = in.albedo[q] - in.albedo[p];
+						Vector3 d_normal = in.normal[q] - in.normal[p];
+						double far = std::max(in.distance[p], in.distance[q]);
+						double d_distance = (far > 0.0) ? fabs(in.distance[q] - in.distance[p]) / (settings.sigma_distance * far) : 0.0;
+
+						double edge = dot(d_color, d_color) * inv_color + dot(d_albedo, d_albedo) * inv_albedo +
+						              dot(d_normal, d_normal) * inv_normal + d_distance * d_distance;
+						double weight = b3_kernel[i + 2] * b3_kernel[j + 2] * exp(-edge);
+						sum += weight * cur[q];
+						weight_sum += weight;
+					}
+				}
+				next[p] = sum / weight_sum;
+			}
+		});
+		cur.swap(next);
+	}
+
+	for (size_t p = 0; p < num_pixels; p++) out[p] = cur[p] * albedo_floor(in.albedo[p]);
+}
@@ -0,0 +1,67 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#include "vector.h"
+#include "threadpool.h"
+
+/**************************************
+ * Denoiser
+ *
+ * Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010), guided
+ * by the first-hit AOVs the render records: albedo, normal and hit
+ * distance. Each pass blurs with a 5x5 B3 spline kernel whose taps are
+ * spread 2^pass pixels apart, so a few passes reach far without many
+ * taps. A tap counts for less the more its AOVs or its color differ
+ * from the pixel's, so the blur stops at edges and doesn't smear one
+ * surface into the next.
+ *
+ * The albedo is divided out before filtering and multiplied back
+ * afterwards, so only lighting is blurred and surface colors stay sharp.
+ **************************************/
+
+// Passes --denoise runs, enough to reach about 30 pixels out
+// (the color limit halves every pass, so more hardly change anything)
+#define DENOISE_PASSES 4
+
+// Channels of the albedo are never taken as darker than this when
+// dividing it out, so black surfaces don't blow up
+#define DENOISE_ALBEDO_FLOOR 0.01
+
+// How strongly the filter stops at edges
+// Each is the difference at which a tap's weight has fallen to 1/e
+class DenoiseSettings {
+public:
+	DenoiseSettings() : passes(0), sigma_color(0.6), sigma_albedo(0.3), sigma_normal(0.3), sigma_distance(0.05) {}
+
+	// A-trous passes (0 turns the denoiser off)
+	uint passes;
+
+	// Lighting difference, halved every pass as the noise goes down
+	double sigma_color;
+
+	// Albedo difference
+	double sigma_albedo;
+
+	// Normal difference
+	double sigma_normal;
+
+	// Hit distance difference, relative to the farther of the two
+	double sigma_distance;
+};
+
+// A frame to denoise: per pixel averages, all row-major and w wide
+typedef struct denoise_input_t {
+	uint w, h;
+	const Vector3 *color;
+	const Vector3 *albedo;
+	const Vector3 *normal;
+	const double *distance;
+} DenoiseInput;
+
+// Filters in.color into out (w * h colors), rows split across pool
+void denoise_image(const DenoiseInput& in, const DenoiseSettings& settings, ThreadPool& pool, Vector3 *out);
+
+#endif
@@ -0,0 +1,370 @@
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "imageWriter.h"
+
+ImageWriter::~ImageWriter() {
+	if (NULL != file) fclose(file);
+}
+
+bool ImageWriter::open(const char *path, uint w_in, uint h_in) {
+	w = w_in;
+	h = h_in;
+	rows_written = 0;
+
+	file = fopen(path, "wb");
+	if (NULL == file) {
+		fprintf(stderr, "[Error] Couldn't open %s for writing\n", path);
+		return false;
+	}
+	return write_header();
+}
+
+bool ImageWriter::close() {
+	bool ok = (NULL != file) && (rows_written == h);
+	if (NULL != file) {
+		if (0 != fclose(file)) ok = false;
+		file = NULL;
+	}
+	return ok;
+}
+
+ImageWriter *new_image_writer(const char *path) {
+	const char *ext = strrchr(path, '.');
+	if (NULL == ext) return NULL;
+	if (0 == strcasecmp(ext, ".ppm")) return new PPMWriter();
+	if (0 == strcasecmp(ext, ".png")) return new PNGWriter();
+	if (0 == strcasecmp(ext, ".pfm")) return new PFMWriter();
+	return NULL;
+}
+
+/**************************************
+ * PPM
+ **************************************/
+bool PPMWriter::write_header() {
+	return fprintf(file, "P6\n%u %u\n255\n", w, h) > 0;
+}
+
+bool PPMWriter::write_rows(const Vector3 *rows, uint count) {
+	std::vector<uint8_t> bytes(3 * w * count);
+
+	resolve_pixels(rows, (size_t)w * count, resolve, bytes.data());
+	rows_written += count;
+	return fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+}
+
+/**************************************
+ * PNG
+ **************************************/
+
+// Largest stored deflate block
+#define DEFLATE_STORED_MAX 65535
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len) {
+	static uint32_t table[256];
+	static bool table_ready = false;
+
+	if (!table_ready) {
+		for (uint32_t n = 0; n < 256; n++) {
+			uint32_t c = n;
+			for (int k = 0; k < 8; k++) c = (c & 1) ? (0xedb88320U ^ (c >> 1)) : (c >> 1);
+			table[n] = c;
+		}
+		table_ready = true;
+	}
+
+	for (size_t i = 0; i < len; i++) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+static void put_be32(std::vector<uint8_t>& out, uint32_t v) {
+	out.push_back(v >> 24);
+	out.push_back(v >> 16);
+	out.push_back(v >> 8);
+	out.push_back(v);
+}
+
+bool PNGWriter::write_chunk(const char *type, const uint8_t *data, size_t len) {
+	std::vector<uint8_t> head;
+	put_be32(head, len);
+	head.insert(head.end(), type, type + 4);
+
+	uint32_t crc = crc32_update(0xffffffffU, head.data() + 4, 4);
+	crc = crc32_update(crc, data, len) ^ 0xffffffffU;
+
+	std::vector<uint8_t> tail;
+	put_be32(tail, crc);
+
+	return fwrite(head.data(), 1, head.size(), file) == head.size() &&
+		   (0 == len || fwrite(data, 1, len, file) == len) &&
+		   fwrite(tail.data(), 1, tail.size(), file) == tail.size();
+}
+
+bool PNGWriter::write_header() {
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	std::vector<uint8_t> ihdr;
+
+	put_be32(ihdr, w);
+	put_be32(ihdr, h);
+	ihdr.push_back(8); // Bit depth
+	ihdr.push_back(2); // RGB
+	ihdr.push_back(0); // Deflate
+	ihdr.push_back(0); // Adaptive filtering
+	ihdr.push_back(0); // No interlace
+
+	return fwrite(signature, 1, sizeof(signature), file) == sizeof(signature) &&
+		   write_chunk("IHDR", ihdr.data(), ihdr.size());
+}
+
+bool PNGWriter::write_rows(const Vector3 *rows, uint count) {
+	std::vector<uint8_t> raw, idat;
+	bool first_batch = (0 == rows_written);
+	bool last_batch = (rows_written + count == h);
+
+	// Scanlines: filter type 0 (none), then RGB
+	size_t line_size = 3 * (size_t)w + 1;
+	raw.resize(line_size * count);
+	for (uint y = 0; y < count; y++) {
+		raw[line_size * y] = 0;
+		resolve_pixels(rows + (size_t)y * w, w, resolve, &raw[line_size * y + 1]);
+	}
+
+	for (uint8_t byte : raw) {
+		adler_a = (adler_a + byte) % 65521;
+		adler_b = (adler_b + adler_a) % 65521;
+	}
+
+	// zlib header: deflate, 32K window, no preset dictionary
+	if (first_batch) {
+		idat.push_back(0x78);
+		idat.push_back(0x01);
+	}
+
+	// Stored blocks, the very last one of the image gets BFINAL
+	for (size_t pos = 0; pos < raw.size(); pos += DEFLATE_STORED_MAX) {
+		uint16_t len = std::min((size_t)DEFLATE_STORED_MAX, raw.size() - pos);
+		bool final_block = last_batch && (pos + len == raw.size());
+		idat.push_back(final_block ? 1 : 0);
+		idat.push_back(len & 0xff);
+		idat.push_back(len >> 8);
+		idat.push_back(~len & 0xff);
+		idat.push_back((~len >> 8) & 0xff);
+		idat.insert(idat.end(), raw.begin() + pos, raw.begin() + pos + len);
+	}
+
+	if (last_batch) put_be32(idat, (adler_b << 16) | adler_a);
+
+	rows_written += count;
+	return write_chunk("IDAT", idat.data(), idat.size());
+}
+
+bool PNGWriter::close() {
+	if (NULL != file) write_chunk("IEND", NULL, 0);
+	return ImageWriter::close();
+}
+
+/**************************************
+ * PFM
+ **************************************/
+bool PFMWriter::write_header() {
+	// Negative scale means little-endian floats
+	if (fprintf(file, "PF\n%u %u\n-1.0\n", w, h) <= 0) return false;
+	data_offset = ftell(file);
+	return data_offset > 0;
+}
+
+bool PFMWriter::write_rows(const Vector3 *rows, uint count) {
+	std::vector<float> line(3 * w);
+
+	for (uint y = 0; y < count; y++) {
+		resolve_pixels(rows + (size_t)y * w, w, resolve, line.data());
+
+		// Row 0 of the image is the last row in the file
+		long row_in_file = h - 1 - (rows_written + y);
+		if (0 != fseek(file, data_offset + row_in_file * (long)(line.size() * sizeof(float)), SEEK_SET)) return false;
+		if (fwrite(line.data(), sizeof(float), line.size(), file) != line.size()) return false;
+	}
+	rows_written += count;
+	return true;
+}
+
+/**************************************
+ * Tiled TIFF
+ **************************************/
+
+// Field types
+#define TIFF_SHORT 3
+#define TIFF_LONG 4
+#define TIFF_LONG8 16
+
+// Tags, IFD entries have to be sorted by them
+#define TIFF_IMAGE_WIDTH 256
+#define TIFF_IMAGE_LENGTH 257
+#define TIFF_BITS_PER_SAMPLE 258
+#define TIFF_COMPRESSION 259
+#define TIFF_PHOTOMETRIC 262
+#define TIFF_SAMPLES_PER_PIXEL 277
+#define TIFF_PLANAR_CONFIG 284
+#define TIFF_TILE_WIDTH 322
+#define TIFF_TILE_LENGTH 323
+#define TIFF_TILE_OFFSETS 324
+#define TIFF_TILE_BYTE_COUNTS 325
+
+// One IFD entry: count values of type, value(i) gives the i-th
+// (tile tables are generated as they're written, never held in memory)
+typedef struct tiff_field_t {
+	uint16_t tag, type;
+	uint64_t count;
+	std::function<uint64_t(uint64_t)> value;
+} TIFFField;
+
+static uint tiff_type_size(uint16_t type) {
+	return (TIFF_SHORT == type) ? 2 : (TIFF_LONG == type) ? 4 : 8;
+}
+
+static void put_le(std::vector<uint8_t>& out, uint64_t v, uint bytes) {
+	for (uint i = 0; i < bytes; i++) out.push_back(v >> (8 * i));
+}
+
+bool is_tiff_path(const char *path) {
+	const char *ext = strrchr(path, '.');
+	return NULL != ext && (0 == strcasecmp(ext, ".tif") || 0 == strcasecmp(ext, ".tiff"));
+}
+
+TiledTIFFWriter::~TiledTIFFWriter() {
+	if (NULL != file) fclose(file);
+}
+
+bool TiledTIFFWriter::open(const char *path, uint w_in, uint h_in, uint tile_size_in) {
+	w = w_in;
+	h = h_in;
+	tile_size = tile_size_in;
+	if (0 == tile_size || 0 != tile_size % 16) return false;
+
+	tiles_x = (w + tile_size - 1) / tile_size;
+	tiles_y = (h + tile_size - 1) / tile_size;
+	uint64_t num_tiles = (uint64_t)tiles_x * tiles_y;
+	tile_bytes = 3 * (uint64_t)tile_size * tile_size;
+	tiles_written = 0;
+	failed = false;
+	done.assign(num_tiles, false);
+
+	// The header and tables take far less than 16 bytes per tile
+	big = (num_tiles * (tile_bytes + 16) + 4096 > 0xffffffffULL);
+
+	std::vector<TIFFField> fields = {
+		{ TIFF_IMAGE_WIDTH, TIFF_LONG, 1, [&](uint64_t) { return w; } },
+		{ TIFF_IMAGE_LENGTH, TIFF_LONG, 1, [&](uint64_t) { return h; } },
+		{ TIFF_BITS_PER_SAMPLE, TIFF_SHORT, 3, [](uint64_t) { return 8; } },
+		{ TIFF_COMPRESSION, TIFF_SHORT, 1, [](uint64_t) { return 1; } },       // None
+		{ TIFF_PHOTOMETRIC, TIFF_SHORT, 1, [](uint64_t) { return 2; } },       // RGB
+		{ TIFF_SAMPLES_PER_PIXEL, TIFF_SHORT, 1, [](uint64_t) { return 3; } },
+		{ TIFF_PLANAR_CONFIG, TIFF_SHORT, 1, [](uint64_t) { return 1; } },     // RGBRGB...
+		{ TIFF_TILE_WIDTH, TIFF_LONG, 1, [&](uint64_t) { return tile_size; } },
+		{ TIFF_TILE_LENGTH, TIFF_LONG, 1, [&](uint64_t) { return tile_size; } },
+		{ TIFF_TILE_OFFSETS, (uint16_t)(big ? TIFF_LONG8 : TIFF_LONG), num_tiles, [&](uint64_t i) { return data_offset + i * tile_bytes; } },
+		{ TIFF_TILE_BYTE_COUNTS, TIFF_LONG, num_tiles, [&](uint64_t) { return tile_bytes; } },
+	};
+
+	// Header, then the IFD, then the values too big to go in it,
+	// then the tiles in order
+	uint offset_size = big ? 8 : 4;
+	uint64_t header_size = big ? 16 : 8;
+	uint64_t ifd_size = big ? (8 + 20 * fields.size() + 8) : (2 + 12 * fields.size() + 4);
+	uint64_t end = header_size + ifd_size;
+	std::vector<uint64_t> value_offsets(fields.size(), 0);
+	for (size_t f = 0; f < fields.size(); f++) {
+		uint64_t size = fields[f].count * tiff_type_size(fields[f].type);
+		if (size > offset_size) {
+			value_offsets[f] = end;
+			end += size;
+		}
+	}
+	data_offset = (end + 15) & ~(uint64_t)15;
+
+	file = fopen(path, "wb");
+	if (NULL == file) {
+		fprintf(stderr, "[Error] Couldn't open %s for writing\n", path);
+		return false;
+	}
+
+	// Little-endian, first IFD straight after the header
+	std::vector<uint8_t> bytes = { 'I', 'I' };
+	if (big) {
+		put_le(bytes, 43, 2);
+		put_le(bytes, 8, 2);
+		put_le(bytes, 0, 2);
+		put_le(bytes, header_size, 8);
+		put_le(bytes, fields.size(), 8);
+	}
+	else {
+		put_le(bytes, 42, 2);
+		put_le(bytes, header_size, 4);
+		put_le(bytes, fields.size(), 2);
+	}
+
+	// Values that fit go in the entry itself, padded out
+	for (size_t f = 0; f < fields.size(); f++) {
+		const TIFFField& field = fields[f];
+		uint type_size = tiff_type_size(field.type);
+		put_le(bytes, field.tag, 2);
+		put_le(bytes, field.type, 2);
+		put_le(bytes, field.count, offset_size);
+		if (0 != value_offsets[f]) put_le(bytes, value_offsets[f], offset_size);
+		else {
+			for (uint64_t i = 0; i < field.count; i++) put_le(bytes, field.value(i), type_size);
+			put_le(bytes, 0, offset_size - field.count * type_size);
+		}
+	}
+	put_le(bytes, 0, offset_size); // No next IFD
+
+	for (size_t f = 0; f < fields.size(); f++) {
+		if (0 == value_offsets[f]) continue;
+		for (uint64_t i = 0; i < fields[f].count; i++) {
+			put_le(bytes, fields[f].value(i), tiff_type_size(fields[f].type));
+			if (bytes.size() >= 65536) {
+				if (fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size()) return false;
+				bytes.clear();
+			}
+		}
+	}
+	return fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+}
+
+bool TiledTIFFWriter::write_tile(uint x0, uint y0, uint x1, uint y1, const Vector3 *pixels) {
+	uint tw = x1 - x0;
+	if (NULL == file || 0 != x0 % tile_size || 0 != y0 % tile_size || x1 <= x0 || y1 <= y0 ||
+	    tw > tile_size || y1 - y0 > tile_size || x1 > w || y1 > h) {
+		failed = true;
+		return false;
+	}
+
+	// Resolved outside the lock, the padding stays black
+	std::vector<uint8_t> bytes(tile_bytes, 0);
+	for (uint y = y0; y < y1; y++) {
+		resolve_pixels(pixels + (size_t)(y - y0) * tw, tw, resolve, &bytes[3 * (size_t)tile_size * (y - y0)]);
+	}
+
+	uint64_t tile = (uint64_t)(y0 / tile_size) * tiles_x + x0 / tile_size;
+	std::lock_guard<std::mutex> guard(lock);
+	if (done[tile] || 0 != fseek(file, data_offset + tile * tile_bytes, SEEK_SET) ||
+	    fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size()) {
+		failed = true;
+		return false;
+	}
+	done[tile] = true;
+	tiles_written++;
+	return true;
+}
+
+bool TiledTIFFWriter::close() {
+	bool ok = (NULL != file) && !failed && (tiles_written == done.size());
+	if (NULL != file) {
+		if (0 != fclose(file)) ok = false;
+		file = NULL;
+	}
+	return ok;
+}
@@ -0,0 +1,140 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <mutex>
+#include <vector>
+
+#include "vector.h"
+#include "resolve.h"
+
+// Streams an image to disk a few rows at a time, so the whole
+// frame never has to sit in memory at once
+// Rows must arrive top to bottom, and every row exactly once
+class ImageWriter {
+public:
+	ImageWriter() : file(NULL), w(0), h(0), rows_written(0) {}
+	virtual ~ImageWriter();
+
+	// Creates the file and writes its header
+	// Returns true on success, false on failure
+	bool open(const char *path, uint w_in, uint h_in);
+
+	// Writes the next count rows, w * count colors, row-major
+	// Colors are linear RGB, nominally [0, 1], and go through resolve
+	// on their way into the file
+	virtual bool write_rows(const Vector3 *rows, uint count) = 0;
+
+	// Flushes and closes the file
+	virtual bool close();
+
+	FILE *file;
+	uint w, h;
+	uint rows_written;
+
+	// Exposure, tone mapping and gamma (see resolve.h)
+	ResolveSettings resolve;
+
+protected:
+	// Writes whatever goes in front of the pixel data
+	virtual bool write_header() = 0;
+};
+
+// Binary PPM (P6), 8 bits per channel
+class PPMWriter : public ImageWriter {
+public:
+	bool write_rows(const Vector3 *rows, uint count);
+
+protected:
+	bool write_header();
+};
+
+// PNG, 8 bits per channel
+// Each batch of rows goes out as its own IDAT chunk of stored
+// (uncompressed) deflate blocks, so nothing needs buffering
+class PNGWriter : public ImageWriter {
+public:
+	PNGWriter() : adler_a(1), adler_b(0) {}
+
+	bool write_rows(const Vector3 *rows, uint count);
+	bool close();
+
+protected:
+	bool write_header();
+
+private:
+	bool write_chunk(const char *type, const uint8_t *data, size_t len);
+
+	// Running Adler-32 of the uncompressed scanlines
+	uint32_t adler_a, adler_b;
+};
+
+// PFM, 32-bit float per channel, for HDR output straight from dbuf
+// PFM stores rows bottom to top, so each row is written at its own offset
+class PFMWriter : public ImageWriter {
+public:
+	PFMWriter() : data_offset(0) {}
+
+	bool write_rows(const Vector3 *rows, uint count);
+
+protected:
+	bool write_header();
+
+private:
+	long data_offset;
+};
+
+// Tiled TIFF, 8 bits per channel, written a tile at a time in any order
+// Every tile has a fixed place in the file (edge tiles are padded out
+// to full size), so each one goes straight to disk as it's finished and
+// only a bit per tile stays in memory, whatever the image size
+// Switches to BigTIFF once the file outgrows 32-bit offsets
+class TiledTIFFWriter {
+public:
+	TiledTIFFWriter() : file(NULL), w(0), h(0), tile_size(0), tiles_x(0), tiles_y(0), tiles_written(0), big(false), failed(false), data_offset(0), tile_bytes(0) {}
+	~TiledTIFFWriter();
+
+	// Creates the file and writes the header and tile tables
+	// (tile_size must be a multiple of 16, as TIFF requires)
+	// Returns true on success, false on failure
+	bool open(const char *path, uint w_in, uint h_in, uint tile_size_in);
+
+	// Writes the tile [x0, x1) x [y0, y1), row-major, (x1 - x0) wide
+	// x0 and y0 have to be multiples of tile_size
+	// May be called from several threads at once
+	// Returns true on success, false on failure
+	bool write_tile(uint x0, uint y0, uint x1, uint y1, const Vector3 *pixels);
+
+	// Closes the file, fails unless every tile was written exactly once
+	bool close();
+
+	FILE *file;
+	uint w, h;
+	uint tile_size;
+	uint tiles_x, tiles_y;
+	uint64_t tiles_written;
+
+	// BigTIFF (64-bit offsets) rather than classic TIFF?
+	bool big;
+
+	// Exposure, tone mapping and gamma (see resolve.h)
+	ResolveSettings resolve;
+
+private:
+	bool failed;
+	uint64_t data_offset;
+	uint64_t tile_bytes;
+	std::vector<bool> done;
+	std::mutex lock;
+};
+
+// Is path a tiled TIFF (.tif or .tiff)?
+bool is_tiff_path(const char *path);
+
+// Picks a writer from the file extension (.ppm, .png or .pfm)
+// Returns NULL for anything else
+ImageWriter *new_image_writer(const char *path);
+
+#endif
@@ -0,0 +1,221 @@
+#include <limits>
+
+#include "integrator.h"
+#include "rayPacket.h"
+#include "stats.h"
+
+// Largest value allowed for a double
+static double Infinity = std::numeric_limits<double>::infinity();
+
+// Returns the sky color for a given ray
+Vector3 get_sky_color (const Ray& r) {
+	// Interpolate down the Y component of the ray
+	// If the ray is pointing to (0,1,0) then do blue
+	// If the ray is poitning to (0,-1,0) then do whiteish
+	// By using a unit vector, we get a beautiful falloff near the bottom
+	// As the vector magnitude changes for X, so equivalent Y values follow a nice subtle curve
+	Vector3 ray_unit = unit(r.dir);
+	double y_dist_from_bottom = (0.5 * ray_unit.y) + 0.5;
+	return Lerp(Vector3(1.0,1.0,1.0), Vector3(0.25, (166.0/255), (254.0/255)), y_dist_from_bottom);
+}
+
+Vector3 sample_direct_light(const WorldObject& world, const LightList& lights, const Material& material, const CollisionPoint& point, double pick, double u, double v) {
+	LightSample sample;
+
+	if (!lights.sample(point.pos, pick, u, v, sample)) return Vector3(0,0,0);
+
+	// Lights behind the surface give it nothing
+	double cos_theta = dot(sample.dir, point.normal);
+	if (cos_theta <= 0.0 || sample.t <= 2.0 * RAY_T_MIN) return Vector3(0,0,0);
+
+	// Stops short of the light itself
+	STAT_ADD(shadow_rays, 1);
+	if (world.occluded(Ray(point.pos, sample.dir), RAY_T_MIN, sample.t - RAY_T_MIN)) return Vector3(0,0,0);
+
+	double weight = power_heuristic(sample.pdf, diffuse_pdf(cos_theta));
+	return diffuse_brdf(material.color) * sample.emission * (cos_theta * weight / sample.pdf);
+}
+
+void Wavefront::clear() {
+	rays.clear();
+	throughput.clear();
+	samples.clear();
+	depth.clear();
+	radiance.clear();
+	bounce_from.clear();
+	bounce_pdf.clear();
+	albedo.clear();
+	normal.clear();
+	distance.clear();
+	active.clear();
+	packet_ends.clear();
+}
+
+uint Wavefront::add(const Ray& ray, const SampleId& id) {
+	uint idx = rays.size();
+	STAT_ADD(paths, 1);
+	rays.push_back(ray);
+	throughput.push_back(Vector3(1,1,1));
+	samples.push_back(id);
+	depth.push_back(0);
+	radiance.push_back(Vector3(0,0,0));
+	bounce_from.push_back(ray.pos);
+	bounce_pdf.push_back(0.0);
+	if (record_aovs) {
+		albedo.push_back(Vector3(0,0,0));
+		normal.push_back(Vector3(0,0,0));
+		distance.push_back(0.0);
+	}
+	active.push_back(idx);
+	return idx;
+}
+
+void Wavefront::end_packet() {
+	if (packet_ends.empty() ? !rays.empty() : packet_ends.back() != rays.size()) {
+		packet_ends.push_back(rays.size());
+	}
+}
+
+void Wavefront::run() {
+	points.resize(rays.size());
+	hit.resize(rays.size());
+
+	// Anything added after the last end_packet() is its own packet
+	end_packet();
+
+	while (!active.empty()) {
+		intersect();
+		shade();
+	}
+}
+
+// Closest hit for every live path
+void Wavefront::intersect() {
+	STAT_ADD(rays, active.size());
+
+	// Camera rays: every path is still on its first bounce and
+	// active is still in the order paths were added
+	if (!packet_ends.empty()) {
+		uint32_t start = 0;
+		for (uint32_t end : packet_ends) {
+			// Packets bigger than a RayPacket are split up
+			for (uint32_t first = start; first < end; first += MAX_PACKET_SIZE) {
+				RayPacket packet;
+				uint32_t last = std::min(end, first + MAX_PACKET_SIZE);
+				for (uint32_t i = first; i < last; i++) packet.add(rays[i], Infinity);
+
+				world.hit_packet(packet, RAY_T_MIN);
+
+				for (uint32_t i = first; i < last; i++) {
+					hit[i] = packet.hit[i - first];
+					points[i] = packet.points[i - first];
+				}
+			}
+			start = end;
+		}
+
+		// Later bounces have diverged too much to share traversal
+		packet_ends.clear();
+		return;
+	}
+
+	for (uint32_t i : active) {
+		hit[i] = world.hit(rays[i], RAY_T_MIN, Infinity, points[i]);
+	}
+}
+
+void Wavefront::record_first_hit(uint32_t i) {
+	if (hit[i]) {
+		albedo[i] = materials[points[i].material_id].color;
+		normal[i] = points[i].normal;
+		distance[i] = points[i].t_collision;
+	}
+	else albedo[i] = get_sky_color(rays[i]);
+}
+
+// Misses see the sky, hits scatter by material
+void Wavefront::shade() {
+	for (uint m = 0; m < NUM_MATERIAL_TYPES; m++) bins[m].clear();
+
+	for (uint32_t i : active) {
+		if (record_aovs && 0 == depth[i]) record_first_hit(i);
+		if (hit[i]) bins[materials[points[i].material_id].type].push_back(i);
+		else {
+			radiance[i] += throughput[i] * get_sky_color(rays[i]);
+			STAT_PATH_END(PATH_SKY, depth[i]);
+		}
+	}
+	active.clear();
+
+	// Lights end the path
+	for (uint32_t i : bins[MATERIAL_EMISSIVE]) {
+		double weight = bounce_light_weight(lights, points[i], bounce_from[i], bounce_pdf[i]);
+		radiance[i] += throughput[i] * materials[points[i].material_id].color * weight;
+		STAT_PATH_END(PATH_EMISSIVE, depth[i]);
+	}
+
+	// Everything else bounces on (each bin calls its own scatter function directly)
+	for (uint m = 0; m < NUM_MATERIAL_TYPES; m++) {
+		if (MATERIAL_EMISSIVE == m) continue;
+
+		for (uint32_t i : bins[m]) {
+			Ray next_ray;
+			Vector3 attenuation;
+			bool continue_bouncing = false;
+
+			// Each bounce draws from its own sample dimensions
+			// (the light pick and roulette share one, drawn only if either needs it)
+			const Material& material = materials[points[i].material_id];
+			uint bounce = depth[i];
+			double u = 0.0, v = 0.0, pick = 0.0, survival_u = 0.0;
+			bool picked = false;
+			auto draw_pick = [&]() {
+				if (!picked) sampler.get_2d(samples[i], bounce_dimension(bounce, BOUNCE_DIM_PICK), pick, survival_u);
+				picked = true;
+			};
+			switch (m) {
+				case MATERIAL_DIFFUSE:
+					sampler.get_2d(samples[i], bounce_dimension(depth[i], BOUNCE_DIM_SCATTER), u, v);
+					continue_bouncing = scatter_diffuse(material, rays[i], points[i], u, v, next_ray, attenuation);
+
+					// The light sample is one bounce longer, so it has to fit under max_depth too
+					if (NULL != lights && depth[i] < max_depth) {
+						draw_pick();
+						sampler.get_2d(samples[i], bounce_dimension(depth[i], BOUNCE_DIM_LIGHT), u, v);
+						radiance[i] += throughput[i] * sample_direct_light(world, *lights, material, points[i], pick, u, v);
+					}
+					break;
+				case MATERIAL_METAL:
+					// Mirrors don't pick anything
+					continue_bouncing = scatter_metal(material, rays[i], points[i], u, v, next_ray, attenuation);
+					break;
+				default:
+					sampler.get_2d(samples[i], bounce_dimension(depth[i], BOUNCE_DIM_SCATTER), u, v);
+					continue_bouncing = scatter_ray(material, rays[i], points[i], u, v, next_ray, attenuation);
+					break;
+			}
+
+			if (!continue_bouncing) {
+				radiance[i] += throughput[i] * attenuation;
+				STAT_PATH_END(PATH_EMISSIVE, depth[i]);
+				continue;
+			}
+
+			throughput[i] = throughput[i] * attenuation;
+			rays[i] = next_ray;
+			if (NULL != lights) {
+				bounce_from[i] = points[i].pos;
+				bounce_pdf[i] = (MATERIAL_DIFFUSE == m) ? diffuse_pdf(dot(unit(next_ray.dir), points[i].normal)) : 0.0;
+			}
+
+			// Out of bounces, or lost at roulette: the path goes dark
+			if (++depth[i] > max_depth) {
+				STAT_PATH_END(PATH_DEPTH_CAP, depth[i]);
+				continue;
+			}
+			if (roulette.survival_probability(depth[i], throughput[i]) < 1.0) draw_pick();
+			if (!roulette.survive(depth[i], throughput[i], survival_u)) STAT_PATH_END(PATH_ROULETTE, depth[i]);
+			else active.push_back(i);
+		}
+	}
+}
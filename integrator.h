@@ -0,0 +1,211 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+
+#include "vector.h"
+#include "material.h"
+#include "worldObject.h"
+#include "lights.h"
+#include "sampler.h"
+#include "utils.h"
+
+using std::vector;
+
+// How many paths a Wavefront is meant to keep in flight at once
+#define WAVEFRONT_SIZE 4096
+
+// Smallest t a bounce ray may hit at (keeps rays from re-hitting their origin)
+#define RAY_T_MIN 0.00001
+
+// Default Russian roulette: bounces before paths can be cut short,
+// and the highest chance a path is given to survive a bounce
+#define ROULETTE_MIN_DEPTH 3
+#define ROULETTE_SURVIVAL 0.95
+
+// Returns the sky color for a given ray
+Vector3 get_sky_color (const Ray& r);
+
+// How Russian roulette picks the chance a path survives a bounce
+enum RoulettePolicy {
+	ROULETTE_OFF,        // Never, paths run until max_depth
+	ROULETTE_THROUGHPUT, // Its brightest throughput channel, capped at survival
+	ROULETTE_FIXED       // Always survival
+};
+
+/***************
+ * Roulette
+ *
+ * Russian roulette path termination
+ * Once a path has bounced min_depth times, each further bounce it
+ * survives with some probability p, and has its throughput divided
+ * by p when it does. Paths that can't contribute much any more are
+ * mostly cut short, while the expected color stays exactly the same.
+ ***************/
+class Roulette {
+public:
+	Roulette() : policy(ROULETTE_THROUGHPUT), min_depth(ROULETTE_MIN_DEPTH), survival(ROULETTE_SURVIVAL) {}
+	Roulette(RoulettePolicy policy_in, uint min_depth_in, double survival_in) : policy(policy_in), min_depth(min_depth_in), survival(survival_in) {}
+
+	// Chance that a path which has bounced depth times, carrying throughput, bounces on
+	double survival_probability(uint depth, const Vector3& throughput) const {
+		if (ROULETTE_OFF == policy || depth < min_depth) return 1.0;
+		if (ROULETTE_FIXED == policy) return survival;
+		return std::min(std::max(throughput.x, std::max(throughput.y, throughput.z)), survival);
+	}
+
+	// Plays a round for a path about to bounce, with u uniform in [0,1)
+	// Returns false if the path is terminated, otherwise scales throughput to make up for the paths that were
+	bool survive(uint depth, Vector3& throughput, double u) const {
+		double p = survival_probability(depth, throughput);
+		if (p >= 1.0) return true;
+		if (u >= p) return false;
+		throughput /= p;
+		return true;
+	}
+
+	RoulettePolicy policy;
+	uint min_depth;
+	double survival;
+};
+
+/**************************************
+ * Light sampling
+ *
+ * Diffuse hits find light two ways: by bouncing into a light, and by
+ * sampling one directly (see LightList) and tracing a shadow ray to it.
+ * Either alone would be unbiased; together each is weighted by the power
+ * heuristic on the two densities, so whichever was likelier to find that
+ * light in that direction counts for the most. Big lights nearby are
+ * mostly found by bouncing, small and far ones by sampling them.
+ * Mirror bounces and camera rays can't be matched by a light sample,
+ * so the lights they hit count in full.
+ **************************************/
+
+// Multiple importance sampling weight of a strategy with density pdf_a
+// against one with density pdf_b (the power heuristic, beta = 2)
+inline double power_heuristic(double pdf_a, double pdf_b) {
+	double a = pdf_a * pdf_a, b = pdf_b * pdf_b;
+	return (a + b > 0.0) ? a / (a + b) : 0.0;
+}
+
+/***************
+ * sample_direct_light
+ *
+ * Light arriving at a diffuse hit straight from one light sample,
+ * already weighted against bouncing into the same light
+ * Inputs: world - the root object of the scene (for the shadow ray)
+ *         lights - the scene's lights
+ *         material - the diffuse material at point
+ *         point - the hit being lit
+ *         pick, u, v - sample point to pick the light and direction with (see LightList::sample)
+ * Outputs: the light reflected back along the incoming ray (before the
+ *          path's throughput), 0 if the light sample was blocked
+ ***************/
+Vector3 sample_direct_light(const WorldObject& world, const LightList& lights, const Material& material, const CollisionPoint& point, double pick, double u, double v);
+
+// Weight of a light that a bounce from from, taken with density bounce_pdf, hit at point
+// (bounce_pdf 0 for bounces light sampling can't take, which count in full)
+inline double bounce_light_weight(const LightList *lights, const CollisionPoint& point, const Vector3& from, double bounce_pdf) {
+	if (NULL == lights || 0.0 == bounce_pdf) return 1.0;
+	return power_heuristic(bounce_pdf, lights->pdf(point.object, from));
+}
+
+/***************
+ * Wavefront
+ *
+ * Iterative path tracer that advances a whole batch of paths
+ * one bounce at a time instead of recursing on each ray:
+ *
+ *  1. intersect - find the closest hit of every live path
+ *                 (the first bounce goes out as ray packets)
+ *  2. shade     - paths that missed pick up the sky, the rest
+ *                 are binned by material type and each bin is
+ *                 scattered in one tight loop (diffuse hits also
+ *                 sample a light), then play Russian roulette to
+ *                 see if they go on
+ *
+ * until no paths are left. All path state lives in flat arrays
+ * indexed by path, so every stage streams through memory.
+ ***************/
+class Wavefront {
+public:
+	// world has to have its material table set (Scene does this)
+	// With record_aovs_in, every path also notes what its camera ray hit (see albedo)
+	// With sample_lights, diffuse hits sample world's lights (if it has any)
+	// Every random choice a path makes is drawn from sampler_in
+	Wavefront(const WorldObject& world_in, uint max_depth_in, const Roulette& roulette_in = Roulette(), bool record_aovs_in = false, bool sample_lights = true,
+	          const Sampler& sampler_in = Sampler())
+		: world(world_in), materials(*world_in.materials), max_depth(max_depth_in), roulette(roulette_in), record_aovs(record_aovs_in),
+		  lights((sample_lights && NULL != world_in.lights && !world_in.lights->empty()) ? world_in.lights : NULL), sampler(sampler_in) {}
+
+	// Drops every path
+	void clear();
+
+	// Starts a camera path for sample id; its bounces draw from id's sample dimensions
+	// Returns the index its color will show up at in radiance
+	uint add(const Ray& ray, const SampleId& id);
+
+	// Marks the paths added since the last call as one coherent packet
+	void end_packet();
+
+	// Traces every path until it has terminated
+	void run();
+
+	size_t size() const { return rays.size(); }
+
+	// Color each path brought back, by path index
+	vector<Vector3> radiance;
+
+	// First hit of each path, by path index (empty unless recording AOVs):
+	// the material color (the sky color for misses), the surface normal
+	// and the hit distance along the camera ray (0 for misses)
+	vector<Vector3> albedo;
+	vector<Vector3> normal;
+	vector<double> distance;
+
+private:
+	void intersect();
+	void shade();
+
+	// Fills in the AOVs of a path on its camera ray
+	void record_first_hit(uint32_t i);
+
+	const WorldObject& world;
+	const MaterialTable& materials;
+	uint max_depth;
+	Roulette roulette;
+	bool record_aovs;
+
+	// Lights sampled at diffuse hits (NULL if none are)
+	const LightList *lights;
+
+	Sampler sampler;
+
+	// Per path state
+	vector<Ray> rays;
+	vector<Vector3> throughput;
+	vector<SampleId> samples;
+	vector<uint> depth;
+	vector<CollisionPoint> points;
+	vector<uint8_t> hit;
+
+	// Where the last bounce left from, and its density (0 for camera rays
+	// and mirror bounces), to weigh the light it finds against light sampling
+	vector<Vector3> bounce_from;
+	vector<double> bounce_pdf;
+
+	// Paths still bouncing
+	vector<uint32_t> active;
+
+	// Hits from the current bounce, grouped by material type
+	vector<uint32_t> bins[NUM_MATERIAL_TYPES];
+
+	// One past the last path of each camera packet
+	vector<uint32_t> packet_ends;
+};
+
+#endif
@@ -0,0 +1,95 @@
+#include <algorithm>
+#include <math.h>
+
+#include "lights.h"
+#include "sampler.h"
+
+void LightList::build(const WorldGroup& world) {
+	const SphereSet& spheres = world.sphere_set();
+	const MaterialTable& materials = *world.materials;
+
+	vector<uint32_t> slots;
+
+	lights.clear();
+	for (size_t i = 0; i < spheres.size(); i++) {
+		uint32_t material_id = spheres.material(i);
+		if (MATERIAL_NONE == material_id || MATERIAL_EMISSIVE != materials[material_id].type) continue;
+
+		Light light;
+		light.center = Vector3(spheres.cx[i], spheres.cy[i], spheres.cz[i]);
+		light.radius = spheres.radius[i];
+		light.emission = materials[material_id].color;
+		lights.push_back(light);
+		slots.push_back(i);
+	}
+
+	// Sorted by where they are rather than by slot, so the same scene picks
+	// the same lights whatever order its spheres ended up in (text or
+	// compiled, built or refit)
+	vector<uint32_t> order(lights.size());
+	for (size_t i = 0; i < order.size(); i++) order[i] = i;
+	std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		const Light& la = lights[a];
+		const Light& lb = lights[b];
+		if (la.center.x != lb.center.x) return la.center.x < lb.center.x;
+		if (la.center.y != lb.center.y) return la.center.y < lb.center.y;
+		if (la.center.z != lb.center.z) return la.center.z < lb.center.z;
+		if (la.radius != lb.radius) return la.radius < lb.radius;
+		return slots[a] < slots[b];
+	});
+
+	vector<Light> sorted(lights.size());
+	light_of.assign(spheres.size(), -1);
+	for (size_t i = 0; i < order.size(); i++) {
+		sorted[i] = lights[order[i]];
+		light_of[slots[order[i]]] = i;
+	}
+	lights.swap(sorted);
+}
+
+double LightList::cone_fraction(const Light& light, const Vector3& pos) {
+	double dist_sq = (light.center - pos).length_squared();
+	double sin_sq = light.radius * light.radius / dist_sq;
+
+	if (!(sin_sq < 1.0)) return 0.0;
+
+	// 1 - cos written so it doesn't cancel out for small, far away lights
+	return sin_sq / (1.0 + sqrt(1.0 - sin_sq));
+}
+
+bool LightList::sample(const Vector3& pos, double pick, double u, double v, LightSample& sample) const {
+	if (lights.empty()) return false;
+
+	const Light& light = lights[std::min((size_t)(pick * lights.size()), lights.size() - 1)];
+	double fraction = cone_fraction(light, pos);
+
+	if (0.0 == fraction) return false;
+
+	// Uniform over the cone around the direction to the center
+	Vector3 to_center = light.center - pos;
+	double dist = to_center.length();
+	Vector3 w = to_center / dist;
+	Vector3 b1, b2;
+	orthonormal_basis(w, b1, b2);
+
+	double cos_theta = 1.0 - u * fraction;
+	double sin_theta = sqrt(std::max(0.0, 1.0 - cos_theta * cos_theta));
+	double phi = 2.0 * M_PI * v;
+	sample.dir = b1 * (cos(phi) * sin_theta) + b2 * (sin(phi) * sin_theta) + w * cos_theta;
+
+	// Near side of the sphere along it (rounding can put the edge of the cone just off it)
+	double half_chord_sq = light.radius * light.radius - dist * dist * sin_theta * sin_theta;
+	sample.t = dist * cos_theta - sqrt(std::max(0.0, half_chord_sq));
+
+	sample.pdf = 1.0 / (2.0 * M_PI * fraction * lights.size());
+	sample.emission = light.emission;
+	return true;
+}
+
+double LightList::pdf(uint32_t object, const Vector3& pos) const {
+	if (object >= light_of.size() || light_of[object] < 0) return 0.0;
+
+	double fraction = cone_fraction(lights[light_of[object]], pos);
+	if (0.0 == fraction) return 0.0;
+	return 1.0 / (2.0 * M_PI * fraction * lights.size());
+}
@@ -0,0 +1,84 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <vector>
+
+#include "vector.h"
+#include "material.h"
+#include "worldObject.h"
+
+using std::vector;
+
+/**************************************
+ * Lights
+ *
+ * Every emissive sphere of a scene, for next event estimation: at each
+ * diffuse bounce a path picks one light (uniformly), aims a shadow ray
+ * at it and adds what it gives off if nothing is in the way, instead of
+ * waiting to bounce into a light by chance.
+ *
+ * A sphere is sampled over the cone of directions it covers as seen from
+ * the point being lit, so every direction lands on its visible side and
+ * small or far away lights are found as easily as big ones.
+ **************************************/
+
+// A direction picked towards a light
+typedef struct light_sample_t {
+	// Unit direction from the point being lit, and how far along it the light is
+	Vector3 dir;
+	double t;
+
+	// Solid angle density of picking dir (the choice of light included)
+	double pdf;
+
+	// Light given off towards the point
+	Vector3 emission;
+} LightSample;
+
+class LightList {
+public:
+	// Finds the emissive spheres of world (its material table has to be set)
+	// Call again whenever spheres move
+	void build(const WorldGroup& world);
+
+	void clear() { lights.clear(); light_of.clear(); }
+
+	size_t size() const { return lights.size(); }
+	bool empty() const { return lights.empty(); }
+
+	/***************
+	 * sample
+	 *
+	 * Picks a light, then a direction towards it, as seen from pos
+	 * Inputs: pos - the point being lit
+	 *         pick - picks the light, in [0,1)
+	 *         u, v - picks the direction, in [0,1)
+	 * Outputs: true and the direction in sample, or false if the light
+	 *          picked can't be seen from pos (pos is inside it)
+	 ***************/
+	bool sample(const Vector3& pos, double pick, double u, double v, LightSample& sample) const;
+
+	// Density sample() would have picked a direction from pos onto the
+	// sphere in slot object with (0 if it isn't a light)
+	double pdf(uint32_t object, const Vector3& pos) const;
+
+private:
+	struct Light {
+		Vector3 center;
+		double radius;
+		Vector3 emission;
+	};
+
+	// Solid angle the cone of directions from pos to light spans, divided
+	// by 2 pi (0 if pos is inside it)
+	static double cone_fraction(const Light& light, const Vector3& pos);
+
+	vector<Light> lights;
+
+	// Index into lights of the sphere in each slot of the world's SphereSet, -1 for the rest
+	vector<int32_t> light_of;
+};
+
+#endif
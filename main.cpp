@@ -0,0 +1,815 @@
+#include <iostream>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef RAYTRACE_GTK
+#include <gtk/gtk.h>
+#endif
+
+#include "raytrace.h"
+#include "RenderTarget.h"
+#include "scene.h"
+#include "imageWriter.h"
+#include "coordinator.h"
+#include "checkpoint.h"
+#include "animation.h"
+
+#ifdef RAYTRACE_GTK
+// Application (this needs to be static because of SIGINT)
+static GtkApplication *__app__ = NULL;
+
+// Window, and the image in it (the pixbuf shares render_target's gtkbuf)
+static GtkWidget *__window__ = NULL;
+static GtkWidget *__image__ = NULL;
+static GdkPixbuf *__pixbuf__ = NULL;
+
+// How often the window picks up new samples
+#define REFRESH_MS 100
+#endif
+
+// Image render target
+static RenderTarget *render_target = NULL;
+
+// Render worker threads
+static ThreadPool *render_pool = NULL;
+
+// What to render (filled in from the command line)
+static RenderSettings settings;
+
+// The scene (generated from the seed, or loaded with --scene)
+static Scene *scene = NULL;
+
+// Hands tiles out to worker processes instead of render_pool (--coordinate)
+static Coordinator *coordinator = NULL;
+
+// Saves the samples every so often, and on SIGINT (--checkpoint)
+// With --resume, the render carries on from the last one
+static Checkpoint checkpoint;
+static bool resume = false;
+
+// Render statistics of the last frame, and where to write them (--stats)
+static RenderStats frame_stats;
+static const char *stats_path = NULL;
+
+// Progressive rendering (GTK window):
+// a background thread adds one sample per pixel per pass to render_target
+// (stop_rendering and rendering also stop a headless checkpointed render)
+static std::thread render_thread;
+static std::atomic<bool> stop_rendering(false);
+static std::atomic<bool> rendering(false);
+static std::atomic<uint> passes_done(0);
+
+void sigint_handler(int signum);
+
+/***************
+ * BandWriter
+ *
+ * Collects finished tiles until a whole band of tile rows is
+ * done, then queues that band for a thread of its own to stream
+ * to an ImageWriter and free. Tiles are scheduled in roughly scan
+ * order, so only a band or two is ever held in memory, whatever
+ * the image size, and render threads don't wait on the encoding
+ * unless it falls BAND_QUEUE_MAX bands behind.
+ ***************/
+#define BAND_QUEUE_MAX 4
+
+class BandWriter {
+public:
+	BandWriter(ImageWriter& writer_in, uint w_in, uint h_in) : writer(writer_in), w(w_in), h(h_in), next_band(0), ok(true), finished(false) {
+		tiles_per_band = (w + TILE_SIZE - 1) / TILE_SIZE;
+		encoder = std::thread(&BandWriter::encode, this);
+	}
+
+	~BandWriter() { finish(); }
+
+	// TileSink, may be called from several threads at once
+	void add_tile(uint x0, uint y0, uint x1, uint y1, const Vector3 *pixels) {
+		std::unique_lock<std::mutex> guard(lock);
+		uint band_idx = y0 / TILE_SIZE;
+		Band& band = bands[band_idx];
+
+		if (band.pixels.empty()) band.pixels.resize((size_t)w * band_rows(band_idx));
+		for (uint y = y0; y < y1; y++) {
+			memcpy(&band.pixels[(size_t)(y - y0) * w + x0], &pixels[(y - y0) * (x1 - x0)], (x1 - x0) * sizeof(Vector3));
+		}
+		band.tiles_done++;
+
+		// Queue every band that's ready, in order
+		while (bands.count(next_band) && bands[next_band].tiles_done == tiles_per_band) {
+			ready.push_back(QueuedBand());
+			ready.back().pixels.swap(bands[next_band].pixels);
+			ready.back().rows = band_rows(next_band);
+			bands.erase(next_band);
+			next_band++;
+			changed.notify_all();
+		}
+
+		// Hold this render thread back if the encoder has fallen behind
+		changed.wait(guard, [&]() { return ready.size() <= BAND_QUEUE_MAX; });
+	}
+
+	// Waits for every queued band to be written
+	// Returns true if every write succeeded
+	bool finish() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			finished = true;
+		}
+		changed.notify_all();
+		if (encoder.joinable()) encoder.join();
+		return ok;
+	}
+
+private:
+	struct Band {
+		Band() : tiles_done(0) {}
+		std::vector<Vector3> pixels;
+		uint tiles_done;
+	};
+
+	struct QueuedBand {
+		std::vector<Vector3> pixels;
+		uint rows;
+	};
+
+	// The last band may be short
+	uint band_rows(uint band_idx) const { return std::min((uint)TILE_SIZE, h - band_idx * TILE_SIZE); }
+
+	// Encoder thread: writes bands as they're queued, until finish()
+	void encode() {
+		std::unique_lock<std::mutex> guard(lock);
+		while (true) {
+			changed.wait(guard, [&]() { return !ready.empty() || finished; });
+			if (ready.empty()) return;
+
+			QueuedBand band;
+			band.pixels.swap(ready.front().pixels);
+			band.rows = ready.front().rows;
+			ready.pop_front();
+			changed.notify_all();
+
+			guard.unlock();
+			bool wrote = writer.write_rows(band.pixels.data(), band.rows);
+			guard.lock();
+			if (!wrote) ok = false;
+		}
+	}
+
+	ImageWriter& writer;
+	uint w, h;
+	uint tiles_per_band;
+	std::map<uint, Band> bands;
+	uint next_band;
+
+	// Guards everything above and below
+	std::mutex lock;
+	std::condition_variable changed;
+	std::deque<QueuedBand> ready;
+	bool ok;
+	bool finished;
+	std::thread encoder;
+};
+
+/***************
+ * FrameFile
+ *
+ * An image file on its way to disk: open() picks the format from
+ * the extension, add_tile() takes finished tiles from any thread,
+ * and finish() waits for the last of them to be written. Bands are
+ * encoded on a thread of their own (see BandWriter), so a sequence
+ * can set up and render the next frame while this one is still
+ * being written out.
+ ***************/
+class FrameFile {
+public:
+	FrameFile() : writer(NULL), bands(NULL), tiff(NULL) {}
+	~FrameFile() {
+		delete bands;
+		delete writer;
+		delete tiff;
+	}
+
+	// Can we write this kind of file? (prints why not)
+	static bool known_format(const char *path) {
+		ImageWriter *probe = is_tiff_path(path) ? NULL : new_image_writer(path);
+		if (!is_tiff_path(path) && NULL == probe) {
+			fprintf(stderr, "[Error] Unknown image format for %s (use .png, .ppm, .pfm or .tif)\n", path);
+			return false;
+		}
+		delete probe;
+		return true;
+	}
+
+	// Creates path for a settings.width x settings.height image
+	// Returns true on success, false on failure
+	bool open(const char *path_in) {
+		path = path_in;
+		if (is_tiff_path(path_in)) {
+			// Tiles have their own places in the file, they're written as they come
+			tiff = new TiledTIFFWriter();
+			tiff->resolve = settings.resolve;
+			return tiff->open(path_in, settings.width, settings.height, TILE_SIZE);
+		}
+		if (NULL == (writer = new_image_writer(path_in))) return false;
+
+		// Rows have to go out in order, so tiles are collected into bands
+		writer->resolve = settings.resolve;
+		if (!writer->open(path_in, settings.width, settings.height)) return false;
+		bands = new BandWriter(*writer, settings.width, settings.height);
+		return true;
+	}
+
+	// TileSink, may be called from several threads at once
+	void add_tile(uint x0, uint y0, uint x1, uint y1, const Vector3 *pixels) {
+		if (NULL != tiff) tiff->write_tile(x0, y0, x1, y1, pixels);
+		else if (NULL != bands) bands->add_tile(x0, y0, x1, y1, pixels);
+	}
+
+	// Waits for the file to be written and closes it; rendered says
+	// whether every tile made it here
+	// Returns true on success, false on failure (and prints which)
+	bool finish(bool rendered) {
+		bool ok = rendered;
+		if (NULL != tiff) ok = tiff->close() && ok;
+		else if (NULL == bands) ok = false;
+		else {
+			ok = bands->finish() && ok;
+			ok = writer->close() && ok;
+		}
+
+		if (ok) printf("Wrote %s\n", path.c_str());
+		else fprintf(stderr, "[Error] Failed writing %s\n", path.c_str());
+		return ok;
+	}
+
+private:
+	std::string path;
+	ImageWriter *writer;
+	BandWriter *bands;
+	TiledTIFFWriter *tiff;
+};
+
+// Headless, whole frame: the denoiser needs all of it at once, and
+// checkpoints save it, so it's rendered into a RenderTarget first
+// Returns the frame, or NULL on failure or if stopped before the end
+static RenderTarget *render_whole_frame() {
+	RenderTarget *img = new RenderTarget(settings.width, settings.height, settings.wants_aovs());
+	uint first_sample = 0;
+	bool ok;
+
+	if (NULL == img->dbuf) {
+		fprintf(stderr, "[Error] %ux%u is too big to %s\n", settings.width, settings.height, NULL != checkpoint.path ? "checkpoint" : "denoise");
+		delete img;
+		return NULL;
+	}
+
+	if (NULL == checkpoint.path) ok = render(*img, scene->world, settings, *render_pool, &frame_stats, coordinator);
+	else {
+		ok = !resume || checkpoint.load(*img, settings, &first_sample);
+		if (ok) {
+			rendering = true;
+			ok = render_checkpointed(*img, scene->world, settings, *render_pool, checkpoint, first_sample, stop_rendering, &frame_stats);
+			rendering = false;
+		}
+		if (!ok && stop_rendering) printf("\nStopped early, run again with --resume to finish from %s\n", checkpoint.path);
+
+		// The checkpoint keeps the samples as they are, only the image is denoised
+		if (ok && settings.denoise.passes > 0) ok = img->denoise(*render_pool, settings.denoise);
+	}
+
+	if (!ok) {
+		delete img;
+		return NULL;
+	}
+	return img;
+}
+
+// Hands a whole frame to sink, a tile at a time
+static void send_frame(RenderTarget& img, const TileSink& sink) {
+	std::vector<Vector3> pixels(TILE_SIZE * TILE_SIZE);
+	color_t c;
+
+	for (uint y0 = 0; y0 < img.h; y0 += TILE_SIZE) {
+		for (uint x0 = 0; x0 < img.w; x0 += TILE_SIZE) {
+			uint x1 = std::min(x0 + TILE_SIZE, img.w);
+			uint y1 = std::min(y0 + TILE_SIZE, img.h);
+			for (uint y = y0; y < y1; y++) {
+				for (uint x = x0; x < x1; x++) {
+					img.getpix(x, y, &c);
+					pixels[(y - y0) * (x1 - x0) + (x - x0)] = Vector3(c.r, c.g, c.b);
+				}
+			}
+			sink(x0, y0, x1, y1, pixels.data());
+		}
+	}
+}
+
+// Hands the frame tile by tile to sink: from frame if it was rendered
+// whole (see render_whole_frame), otherwise rendering tiles as it goes
+// Returns true on success, false on failure
+static bool render_tiles(RenderTarget *frame, const TileSink& sink) {
+	if (NULL == frame) return render(scene->world, settings, *render_pool, sink, &frame_stats, coordinator);
+	send_frame(*frame, sink);
+	return true;
+}
+
+// Headless: renders the current frame and starts writing it to path
+// (format picked from the extension); finish() it to wait for the rest
+// Returns the file, or NULL on failure
+static FrameFile *start_render_to_file(const char *path) {
+	RenderTarget *frame = NULL;
+
+	if (!FrameFile::known_format(path)) return NULL;
+
+	// Denoised and checkpointed frames are finished before the file is touched
+	if (settings.denoise.passes > 0 || NULL != checkpoint.path) {
+		if (NULL == (frame = render_whole_frame())) return NULL;
+	}
+
+	FrameFile *file = new FrameFile();
+	bool ok = file->open(path) && render_tiles(frame, [&](uint x0, uint y0, uint x1, uint y1, const Vector3 *pixels) {
+		file->add_tile(x0, y0, x1, y1, pixels);
+	});
+	delete frame;
+
+	if (!ok) {
+		file->finish(false);
+		delete file;
+		return NULL;
+	}
+	return file;
+}
+
+// Headless: render straight to a file (format picked from the extension)
+// Returns true on success, false on failure
+bool render_to_file(const char *path) {
+	FrameFile *file = start_render_to_file(path);
+	if (NULL == file) return false;
+
+	bool ok = file->finish(true);
+	delete file;
+	return ok;
+}
+
+// Headless animation: renders frames [0, num_frames) of animation, each
+// to path_pattern with its frame number filled in. A frame's spheres are
+// moved and its BVH refit while the last one is still being written out
+// Returns true on success, false on failure
+bool render_sequence(const char *path_pattern, Animation& animation, uint num_frames) {
+	typedef std::chrono::steady_clock Clock;
+	FrameFile *writing = NULL;
+	bool ok = animation.start(scene->world);
+
+	for (uint frame = 0; frame < num_frames && ok; frame++) {
+		char path[4096];
+		snprintf(path, sizeof(path), path_pattern, (int)frame);
+
+		Clock::time_point setup_start = Clock::now();
+		bool rebuilt = animation.set_frame(scene->world, frame, num_frames);
+		if (!animation.empty()) scene->find_lights();
+		double setup_ms = std::chrono::duration<double, std::milli>(Clock::now() - setup_start).count();
+		printf("Frame %u/%u: BVH %s in %.2f ms\n", frame + 1, num_frames, rebuilt ? "rebuilt" : "refit", setup_ms);
+
+		FrameFile *file = start_render_to_file(path);
+		if (NULL != writing) {
+			ok = writing->finish(true) && ok;
+			delete writing;
+		}
+		writing = file;
+		if (NULL == file) ok = false;
+	}
+
+	if (NULL != writing) {
+		ok = writing->finish(true) && ok;
+		delete writing;
+	}
+	return ok;
+}
+
+// Is path a file name with exactly one frame number (%d, %04d, ...) in it?
+static bool is_frame_pattern(const char *path) {
+	const char *percent = strchr(path, '%');
+	if (NULL == percent || NULL != strchr(percent + 1, '%')) return false;
+	const char *conv = percent + 1;
+	while (*conv >= '0' && *conv <= '9') conv++;
+	return 'd' == *conv;
+}
+
+// Prints frame_stats, and writes them as JSON unless stats_path is "-"
+// Returns true on success, false on failure
+bool report_stats() {
+	printf("Render statistics:\n");
+	stats_print(frame_stats, stdout);
+	if (0 == strcmp(stats_path, "-")) return true;
+	if (!stats_write_json(frame_stats, stats_path)) return false;
+	printf("Wrote %s\n", stats_path);
+	return true;
+}
+
+#ifdef RAYTRACE_GTK
+// Background thread: keeps adding sample passes (from passes_done on)
+// until every pixel has settings.samples of them, or the window is closed
+void progressive_render() {
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point last_save = Clock::now();
+	uint saved_passes = passes_done;
+
+	printf("Raytracing on %u threads!\n", render_pool->size());
+	stats_reset();
+	for (uint pass = passes_done; pass < settings.samples && !stop_rendering; pass++) {
+		// Converged pixels are skipped, judged on what render_target already has
+		render_samples(scene->world, settings, *render_pool, pass, 1, [](const tile_samples_t& tile) {
+			render_target->accumulate(tile);
+		}, render_target);
+
+		// Checkpoints keep the samples, so they're saved before the denoiser runs
+		bool last = (pass + 1 == settings.samples);
+		bool due = std::chrono::duration<double>(Clock::now() - last_save).count() >= checkpoint.interval;
+		if (NULL != checkpoint.path && (last || due)) {
+			checkpoint.save(*render_target, settings, pass + 1);
+			saved_passes = pass + 1;
+			last_save = Clock::now();
+		}
+
+		// Only the finished image is denoised, before the window shows it
+		if (last && settings.denoise.passes > 0) render_target->denoise(*render_pool, settings.denoise);
+		passes_done = pass + 1;
+		print_progress((passes_done * 100.0) / settings.samples);
+	}
+	if (passes_done == settings.samples) printf("\nDone!\n");
+	else if (NULL != checkpoint.path) {
+		if (saved_passes != passes_done || 0 == passes_done) checkpoint.save(*render_target, settings, passes_done);
+		printf("\nStopped early, run again with --resume to finish from %s\n", checkpoint.path);
+	}
+	rendering = false;
+}
+
+// Timer: shows whatever has been accumulated so far
+// Keeps firing until the last pass has been shown
+gboolean refresh_image(gpointer user_data) {
+	bool finished = !rendering;
+	char title[64];
+
+	// Resolve a copy of the accumulator into the pixbuf's bytes,
+	// then hand the pixbuf back so GTK drops its cached copy
+	render_target->RenderGTK(settings.resolve);
+	gtk_image_set_from_pixbuf(GTK_IMAGE(__image__), __pixbuf__);
+
+	snprintf(title, sizeof(title), "Raytracer Boi (%u/%u samples)", (uint)passes_done, settings.samples);
+	gtk_window_set_title(GTK_WINDOW(__window__), title);
+
+	// Stopped by SIGINT, once the checkpoint is saved
+	if (finished && stop_rendering) g_application_quit(G_APPLICATION(__app__));
+
+	return finished ? G_SOURCE_REMOVE : G_SOURCE_CONTINUE;
+}
+
+// Initial callback upon application creation:
+void myapp_activate(GtkApplication *app, gpointer user_data) {
+	// Initialize a GdkPixbuf with the GBytes buffer:
+	// (it shares gtkbuf, so every RenderGTK shows up in it)
+	render_target->RenderGTK(settings.resolve);
+	__pixbuf__ = gdk_pixbuf_new_from_data(
+							(guchar*)render_target->gtkbuf,
+							GDK_COLORSPACE_RGB,
+							false, // No Alpha
+							8, // 8 bits per sample
+							render_target->w,
+							render_target->h,
+							BYTES_PER_PIXEL * render_target->w, // Row length
+							NULL,
+							0
+						);
+
+	// Initialize a GtkImage
+	__image__ = gtk_image_new_from_pixbuf(__pixbuf__);
+
+	// Create window
+	__window__ = gtk_application_window_new (app);
+	gtk_window_set_title (GTK_WINDOW(__window__), "Raytracer Boi");
+	gtk_window_set_default_size (GTK_WINDOW(__window__), render_target->w, render_target->h);
+
+	// Attach image to window
+	gtk_container_add(GTK_CONTAINER (__window__), __image__);
+
+	// Show window
+	gtk_widget_show_all(__window__);
+
+	// Render in the background, refreshing the window as samples come in
+	rendering = true;
+	render_thread = std::thread(progressive_render);
+	g_timeout_add(REFRESH_MS, refresh_image, NULL);
+}
+#endif
+
+void print_usage(const char *name) {
+	printf("Usage: %s [options]\n", name);
+	printf("  -o, --output FILE    Render without a window, straight to FILE (.png, .ppm, .pfm or tiled .tif)\n");
+	printf("  -W, --width N        Image width in pixels (default %d)\n", DIM_X);
+	printf("  -H, --height N       Image height in pixels (default %d)\n", DIM_Y);
+	printf("  -n, --samples N      Most samples per pixel (default %d)\n", NUM_SAMPLES);
+	printf("  --noise T            Stop sampling a pixel once its relative noise is below T\n");
+	printf("                       (default %g, 0 gives every pixel every sample)\n", NOISE_THRESHOLD);
+	printf("  --min-samples N      Samples every pixel gets before it can stop (default %d)\n", MIN_SAMPLES);
+	printf("  -d, --depth N        Maximum ray bounces (default %d)\n", RAY_BOUNCE_DEPTH);
+	printf("  --rr-policy P        Russian roulette: throughput (default), fixed or off\n");
+	printf("  --rr-depth N         Bounces before roulette starts (default %d)\n", ROULETTE_MIN_DEPTH);
+	printf("  --rr-survival P      Survival chance for fixed, upper bound for throughput (default %g)\n", ROULETTE_SURVIVAL);
+	printf("  --no-light-sampling  Only find lights by bouncing into them (no shadow rays)\n");
+	printf("  --sampler S          Sample points: sobol (default), bluenoise, stratified or random\n");
+	printf("  -s, --seed N         Frame seed (default 1)\n");
+	printf("  --spheres N          Random spheres in the generated scene (default %d)\n", SCENE_SPHERES);
+	printf("  --scene FILE         Render a scene file (text or compiled) instead of the random scene\n");
+	printf("  --compile-scene OUT  Compile the scene to a binary scene file and exit\n");
+	printf("  --no-bvh             Leave the BVH out of the compiled scene (built at load time)\n");
+	printf("  --save-scene OUT     Write the scene out as text and exit\n");
+	printf("  -t, --threads N      Render threads (default: one per core)\n");
+	printf("  --denoise            Denoise the finished image (try -n 8 or -n 16 with it)\n");
+	printf("  --exposure EV        Brighten (or darken, if negative) the image by EV stops\n");
+	printf("  --tonemap T          Bring bright colors into range: none (default, clips), reinhard or aces\n");
+	printf("  --gamma G            Display gamma (default 1, linear; 2.2 for most screens)\n");
+	printf("  --coordinate ADDR    Hand the frame out to --worker processes at ADDR ([host:]port or socket path)\n");
+	printf("  --worker ADDR        Render for the coordinator at ADDR (give it the same scene options)\n");
+	printf("  --frames N           Render N frames of an animation, -o needs a frame number (like frame%%04d.png)\n");
+	printf("  --animate FILE       Move spheres by the keyframes and turntable in FILE (see README)\n");
+	printf("  --checkpoint FILE    Save the samples to FILE every so often, at the end, and on Ctrl-C\n");
+	printf("  --checkpoint-every S Seconds between checkpoints (default %d)\n", CHECKPOINT_SECONDS);
+	printf("  --resume             Carry on from the --checkpoint FILE (give -n more samples to add them)\n");
+	printf("  --stats FILE         Print render statistics and write them as JSON to FILE (- to only print)\n");
+	if (!STATS_ENABLED) printf("                       (needs a build with `make STATS=1`)\n");
+#ifndef RAYTRACE_GTK
+	printf("Built without GTK: --output is required\n");
+#endif
+}
+
+// Is argv[i] the option with this short or long name, with a value after it?
+static bool is_option(int argc, char **argv, int i, const char *short_name, const char *long_name) {
+	return (0 == strcmp(argv[i], short_name) || 0 == strcmp(argv[i], long_name)) && i + 1 < argc;
+}
+
+// Launch GTK App (or render headless)
+int main (int argc, char **argv) {
+	int app_status = 0;
+	uint num_threads = 0;
+	const char *output_path = NULL;
+	const char *coordinate_address = NULL;
+	const char *worker_address = NULL;
+	const char *scene_path = NULL;
+	const char *compile_path = NULL;
+	const char *save_path = NULL;
+	const char *animation_path = NULL;
+	uint num_frames = 1;
+	Animation animation;
+	bool with_bvh = true;
+	size_t num_spheres = SCENE_SPHERES;
+	int gtk_argc = 0;
+
+	// Pull out our own arguments, everything else goes to GTK
+	for (int i = 0; i < argc; i++) {
+		if (is_option(argc, argv, i, "-t", "--threads")) num_threads = atoi(argv[++i]);
+		else if (is_option(argc, argv, i, "-s", "--seed")) settings.seed = strtoull(argv[++i], NULL, 10);
+		else if (is_option(argc, argv, i, "-W", "--width")) settings.width = atoi(argv[++i]);
+		else if (is_option(argc, argv, i, "-H", "--height")) settings.height = atoi(argv[++i]);
+		else if (is_option(argc, argv, i, "-n", "--samples")) settings.samples = atoi(argv[++i]);
+		else if (is_option(argc, argv, i, "-d", "--depth")) settings.max_depth = atoi(argv[++i]);
+		else if (is_option(argc, argv, i, "--noise", "--noise")) settings.noise_threshold = atof(argv[++i]);
+		else if (is_option(argc, argv, i, "--min-samples", "--min-samples")) settings.min_samples = atoi(argv[++i]);
+		else if (is_option(argc, argv, i, "--rr-depth", "--rr-depth")) settings.roulette.min_depth = atoi(argv[++i]);
+		else if (is_option(argc, argv, i, "--rr-survival", "--rr-survival")) settings.roulette.survival = atof(argv[++i]);
+		else if (is_option(argc, argv, i, "--rr-policy", "--rr-policy")) {
+			const char *policy = argv[++i];
+			if (0 == strcmp(policy, "off")) settings.roulette.policy = ROULETTE_OFF;
+			else if (0 == strcmp(policy, "throughput")) settings.roulette.policy = ROULETTE_THROUGHPUT;
+			else if (0 == strcmp(policy, "fixed")) settings.roulette.policy = ROULETTE_FIXED;
+			else {
+				fprintf(stderr, "[Error] Unknown roulette policy %s (use throughput, fixed or off)\n", policy);
+				return 1;
+			}
+		}
+		else if (is_option(argc, argv, i, "--sampler", "--sampler")) {
+			const char *sampler = argv[++i];
+			if (!sampler_type_from_name(sampler, settings.sampler)) {
+				fprintf(stderr, "[Error] Unknown sampler %s (use sobol, bluenoise, stratified or random)\n", sampler);
+				return 1;
+			}
+		}
+		else if (is_option(argc, argv, i, "--exposure", "--exposure")) settings.resolve.exposure = atof(argv[++i]);
+		else if (is_option(argc, argv, i, "--gamma", "--gamma")) settings.resolve.gamma = atof(argv[++i]);
+		else if (is_option(argc, argv, i, "--tonemap", "--tonemap")) {
+			const char *tonemap = argv[++i];
+			if (0 == strcmp(tonemap, "none")) settings.resolve.tonemap = TONEMAP_NONE;
+			else if (0 == strcmp(tonemap, "reinhard")) settings.resolve.tonemap = TONEMAP_REINHARD;
+			else if (0 == strcmp(tonemap, "aces")) settings.resolve.tonemap = TONEMAP_ACES;
+			else {
+				fprintf(stderr, "[Error] Unknown tone mapping %s (use none, reinhard or aces)\n", tonemap);
+				return 1;
+			}
+		}
+		else if (is_option(argc, argv, i, "-o", "--output")) output_path = argv[++i];
+		else if (is_option(argc, argv, i, "--coordinate", "--coordinate")) coordinate_address = argv[++i];
+		else if (is_option(argc, argv, i, "--worker", "--worker")) worker_address = argv[++i];
+		else if (is_option(argc, argv, i, "--spheres", "--spheres")) num_spheres = strtoull(argv[++i], NULL, 10);
+		else if (is_option(argc, argv, i, "--frames", "--frames")) num_frames = atoi(argv[++i]);
+		else if (is_option(argc, argv, i, "--animate", "--animate")) animation_path = argv[++i];
+		else if (is_option(argc, argv, i, "--checkpoint", "--checkpoint")) checkpoint.path = argv[++i];
+		else if (is_option(argc, argv, i, "--checkpoint-every", "--checkpoint-every")) checkpoint.interval = atof(argv[++i]);
+		else if (0 == strcmp(argv[i], "--resume")) resume = true;
+		else if (is_option(argc, argv, i, "--stats", "--stats")) stats_path = argv[++i];
+		else if (is_option(argc, argv, i, "--scene", "--scene")) scene_path = argv[++i];
+		else if (is_option(argc, argv, i, "--compile-scene", "--compile-scene")) compile_path = argv[++i];
+		else if (is_option(argc, argv, i, "--save-scene", "--save-scene")) save_path = argv[++i];
+		else if (0 == strcmp(argv[i], "--no-bvh")) with_bvh = false;
+		else if (0 == strcmp(argv[i], "--denoise")) settings.denoise.passes = DENOISE_PASSES;
+		else if (0 == strcmp(argv[i], "--no-light-sampling")) settings.sample_lights = false;
+		else if (0 == strcmp(argv[i], "-h") || 0 == strcmp(argv[i], "--help")) {
+			print_usage(argv[0]);
+			return 0;
+		}
+		else argv[gtk_argc++] = argv[i];
+	}
+
+	if (0 == settings.width || 0 == settings.height || 0 == settings.samples) {
+		fprintf(stderr, "[Error] Width, height and samples must all be at least 1\n");
+		return 1;
+	}
+	if (!(settings.resolve.gamma > 0.0)) {
+		fprintf(stderr, "[Error] Gamma must be positive\n");
+		return 1;
+	}
+	if (!(settings.roulette.survival > 0.0 && settings.roulette.survival <= 1.0)) {
+		fprintf(stderr, "[Error] Roulette survival must be in (0, 1]\n");
+		return 1;
+	}
+	if (0 == num_frames) {
+		fprintf(stderr, "[Error] There has to be at least one frame\n");
+		return 1;
+	}
+	bool sequence = (num_frames > 1 || NULL != animation_path);
+	if (sequence) {
+		if (NULL == output_path || !is_frame_pattern(output_path)) {
+			fprintf(stderr, "[Error] Animations need --output with a frame number in it, like frame%%04d.png\n");
+			return 1;
+		}
+		if (NULL != checkpoint.path || NULL != coordinate_address) {
+			fprintf(stderr, "[Error] Animations can't be used with --checkpoint or --coordinate\n");
+			return 1;
+		}
+		if (NULL != animation_path && !animation.load(animation_path)) return 1;
+	}
+	if (resume && NULL == checkpoint.path) {
+		fprintf(stderr, "[Error] --resume needs --checkpoint FILE\n");
+		return 1;
+	}
+	if (!(checkpoint.interval >= 0.0)) {
+		fprintf(stderr, "[Error] Checkpoint interval can't be negative\n");
+		return 1;
+	}
+	if (NULL != stats_path && !STATS_ENABLED) {
+		fprintf(stderr, "[Error] Built without render statistics, rebuild with `make clean && make STATS=1`\n");
+		return 1;
+	}
+
+	// Spin up render threads (0 means one per core):
+	render_pool = new ThreadPool(num_threads);
+
+	// Build or load the scene
+	scene = new Scene();
+	if (NULL != scene_path) {
+		if (!scene->load(scene_path)) return 1;
+	}
+	else scene->generate(settings.seed, *render_pool, num_spheres);
+
+	// Scene conversion only, nothing to render
+	if (NULL != compile_path || NULL != save_path) {
+		bool ok = true;
+		if (NULL != compile_path) ok = scene->save_binary(compile_path, with_bvh) && ok;
+		if (NULL != save_path) ok = scene->save_text(save_path) && ok;
+		delete render_pool;
+		delete scene;
+		return ok ? 0 : 1;
+	}
+
+	// Worker: renders whatever the coordinator asks for, then quits
+	if (NULL != worker_address) {
+		bool ok = render_worker(worker_address, scene->world, scene->fingerprint(), *render_pool);
+		delete render_pool;
+		delete scene;
+		return ok ? 0 : 1;
+	}
+
+	if (NULL != coordinate_address) {
+		if (NULL == output_path) {
+			fprintf(stderr, "[Error] --coordinate needs --output\n");
+			return 1;
+		}
+		if (NULL != checkpoint.path) {
+			fprintf(stderr, "[Error] --coordinate can't be used with --checkpoint\n");
+			return 1;
+		}
+		// The rays are traced (and counted) in the workers
+		if (NULL != stats_path) {
+			fprintf(stderr, "[Error] --coordinate can't be used with --stats\n");
+			return 1;
+		}
+		coordinator = new Coordinator();
+		if (!coordinator->listen(coordinate_address, scene->fingerprint())) return 1;
+	}
+
+#ifndef RAYTRACE_GTK
+	if (NULL == output_path || gtk_argc > 1) {
+		print_usage(argv[0]);
+		return 1;
+	}
+#endif
+
+	// SIGINT handler (just in case ;D):
+	// With checkpoints, so is SIGTERM, which is how preempted jobs get told to go
+	signal(SIGINT, sigint_handler);
+	if (NULL != checkpoint.path) {
+		checkpoint.scene_fingerprint = scene->fingerprint();
+		signal(SIGTERM, sigint_handler);
+	}
+
+	if (NULL != output_path) {
+		if (sequence) app_status = render_sequence(output_path, animation, num_frames) ? 0 : 1;
+		else app_status = render_to_file(output_path) ? 0 : 1;
+		if (NULL != stats_path && !report_stats()) app_status = 1;
+		delete coordinator;
+		delete render_pool;
+		delete scene;
+		return app_status;
+	}
+
+#ifdef RAYTRACE_GTK
+	// Create image buffer:
+	render_target = new RenderTarget(settings.width, settings.height, settings.wants_aovs());
+	if (NULL == render_target->dbuf) {
+		fprintf(stderr, "[Error] %ux%u is too big for a window, use --output instead\n", settings.width, settings.height);
+		return 1;
+	}
+	if (resume) {
+		uint first_pass = 0;
+		if (!checkpoint.load(*render_target, settings, &first_pass)) return 1;
+		passes_done = first_pass;
+	}
+
+	// Allocate GTK app:
+	__app__ = gtk_application_new("org.jprx.cpu_raytracer", G_APPLICATION_FLAGS_NONE);
+
+	// Setup activation handler (app 'main' loop):
+	g_signal_connect(__app__, "activate", G_CALLBACK(myapp_activate), NULL);
+
+	// Run app and store return code:
+	app_status = g_application_run(G_APPLICATION (__app__), gtk_argc, argv);
+
+	// Window closed: stop after the current pass
+	stop_rendering = true;
+	if (render_thread.joinable()) render_thread.join();
+
+	if (NULL != stats_path) {
+		frame_stats = stats_collect();
+		frame_stats.pixels = (uint64_t)settings.width * settings.height;
+		if (!report_stats()) app_status = 1;
+	}
+
+	// Cleanup
+	delete render_pool;
+	delete scene;
+	sigint_handler(-1);
+#endif
+	return app_status;
+}
+
+// Cleanup and close down GTK app
+void sigint_handler(int signum) {
+	// Checkpointed render: let it save what it has first
+	// (a second Ctrl-C quits right away)
+	if (-1 != signum && NULL != checkpoint.path && rendering && !stop_rendering) {
+		const char msg[] = "\nStopping after this pass to save a checkpoint (Ctrl-C again to quit now)\n";
+		stop_rendering = true;
+		ssize_t ignored = write(STDOUT_FILENO, msg, sizeof(msg) - 1);
+		(void)ignored;
+		return;
+	}
+
+	printf("\nGoodbye!\n");
+
+	// Render threads may still be writing into render_target on a real
+	// SIGINT, so leave it for exit() to reclaim
+	if (-1 == signum) delete render_target;
+#ifdef RAYTRACE_GTK
+	if (NULL != __pixbuf__) g_object_unref(__pixbuf__);
+	if (NULL != __app__) g_object_unref(__app__);
+#endif
+	exit(0);
+}
@@ -1,24 +1,24 @@
+#include <math.h>
+#include <string.h>
+
 #include "material.h"
+#include "sampler.h"
 #include "utils.h" // For utilities
 
-// Bounce diffusively, moving a random direction from the normal of the collision point
-bool Diffuse::scatter_ray(const Ray& ray_in, CollisionPoint point, Ray& ray_out, Vector3& attenuation_out) {
-	// Generate random bounce direction
-	Vector3 random_dir = Vector3(rand_range(-1.0,1.0), rand_range(-1.0,1.0), rand_range(-1.0,1.0));
-	random_dir /= random_dir.length();
-
-	// Follow normal and then move a random direction from the normal vector tip:
-	ray_out = Ray(point.pos, point.normal + random_dir);
+// Bounce diffusively, cosine distributed about the normal of the collision point
+// (exactly, as light sampling assumes, see diffuse_pdf)
+bool scatter_diffuse(const Material& material, const Ray& ray_in, const CollisionPoint& point, double u, double v, Ray& ray_out, Vector3& attenuation_out) {
+	ray_out = Ray(point.pos, cosine_hemisphere(point.normal, u, v));
 
 	// Diffuse objects attenuate by color:
-	attenuation_out = this->color;
+	attenuation_out = material.color;
 
 	return true;
 }
 
 // We are a light source, no further bouncing needed!
-bool Emissive::scatter_ray(const Ray& ray_in, CollisionPoint point, Ray& ray_out, Vector3& attenuation_out) {
-	attenuation_out = this->color;
+bool scatter_emissive(const Material& material, const Ray& ray_in, const CollisionPoint& point, double u, double v, Ray& ray_out, Vector3& attenuation_out) {
+	attenuation_out = material.color;
 	return false;
 }
 
@@ -28,13 +28,34 @@ Vector3 reflect(const Vector3& v, const Vector3& norm) {
 }
 
 // Bounce reflectively
-bool Metal::scatter_ray(const Ray& ray_in, CollisionPoint point, Ray& ray_out, Vector3& attenuation_out) {
+bool scatter_metal(const Material& material, const Ray& ray_in, const CollisionPoint& point, double u, double v, Ray& ray_out, Vector3& attenuation_out) {
 	// Reflect ray across normal:
 	Vector3 reflected = reflect(unit(ray_in.dir), point.normal);
 	ray_out = Ray(point.pos, reflected);
 
 	// Diffuse objects attenuate by color:
-	attenuation_out = this->color;
+	attenuation_out = material.color;
 
 	return true;
-}
\ No newline at end of file
+}
+
+// Indexed by MaterialType
+static const char *material_type_names[NUM_MATERIAL_TYPES] = {
+#define MATERIAL_NAME(type, scatter, name) name,
+	MATERIAL_TYPES(MATERIAL_NAME)
+#undef MATERIAL_NAME
+};
+
+const char *material_type_name(MaterialType type) {
+	return (type < NUM_MATERIAL_TYPES) ? material_type_names[type] : "unknown";
+}
+
+bool material_type_from_name(const char *name, MaterialType& type) {
+	for (uint t = 0; t < NUM_MATERIAL_TYPES; t++) {
+		if (0 == strcmp(name, material_type_names[t])) {
+			type = (MaterialType)t;
+			return true;
+		}
+	}
+	return false;
+}
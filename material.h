@@ -1,51 +1,100 @@
 #ifndef MATERIAL_H
 #define MATERIAL_H
 
+#include <vector>
+#include <math.h>
+#include <stdint.h>
 #include "vector.h"
 #include "CollisionPoint.h"
 
-// A material just defines how rays get scattered, and
-// how much they are attenuated per bounce
-class Material {
-public:
-	// Returns true if we should continue bouncing, false if we should stop bouncing:
-	// Writes the scattered ray into out_ray
-	// Writes attenuation color into attenuation_out
-	virtual bool scatter_ray(const Ray& ray_in, CollisionPoint point, Ray& ray_out, Vector3& attenuation_out) = 0;
-};
+using std::vector;
 
-class Diffuse : public Material {
-public:
-	Diffuse() : color(Vector3(1,1,1)) {}
-	Diffuse(const Vector3& color_in) : color(color_in) {}
+/**************************************
+ * Materials
+ *
+ * A material is plain data: its type and a color. Every material in a
+ * scene lives in one flat MaterialTable, and hits carry the index of
+ * theirs (CollisionPoint::material_id), so nothing is dereferenced or
+ * copied to find out how a ray scatters.
+ *
+ * Material types are registered here, at compile time, in
+ * MATERIAL_TYPES. Each entry is
+ *   X(ENUM_SUFFIX, scatter function, name in scene files)
+ * and adding a type is one entry plus its scatter function; the enum,
+ * the names and the switch in scatter_ray() all come from this list.
+ * Never reorder it, scene files store types by number.
+ **************************************/
 
-	bool scatter_ray(const Ray& ray_in, CollisionPoint point, Ray& ray_out, Vector3& attenuation_out);
+#define MATERIAL_TYPES(X) \
+	X(DIFFUSE, scatter_diffuse, "diffuse") \
+	X(METAL, scatter_metal, "metal") \
+	X(EMISSIVE, scatter_emissive, "emissive")
 
-	// The 'attenuation' parameter
-	// Each reflected bounce is attenuated by this color paramter
-	Vector3 color;
+// Which kind of material a Material is
+// Lets batched code group hits by material without looking anything up
+enum MaterialType {
+#define MATERIAL_ENUM(type, scatter, name) MATERIAL_##type,
+	MATERIAL_TYPES(MATERIAL_ENUM)
+#undef MATERIAL_ENUM
+	NUM_MATERIAL_TYPES
 };
 
-class Emissive : public Material {
-public:
-	Emissive() : color(Vector3(1,1,1)) {}
-	Emissive(const Vector3& color_in) : color(color_in) {}
+// Material id of things that don't have one (groups, placeholders)
+#define MATERIAL_NONE 0xffffffffu
 
-	bool scatter_ray(const Ray& ray_in, CollisionPoint point, Ray& ray_out, Vector3& attenuation_out);
+// A material just defines how rays get scattered, and
+// how much they are attenuated per bounce
+typedef struct material_t {
+	MaterialType type;
 
 	// The 'attenuation' parameter
 	// Each reflected bounce is attenuated by this color paramter
+	// (for emissive materials it's the light given off)
 	Vector3 color;
-};
+} Material;
 
-class Metal : public Material {
-public:
-	Metal() : color(Vector3(1,1,1)) {}
-	Metal(const Vector3& color_in) : color(color_in) {}
+// Every material of a scene, indexed by material id
+typedef vector<Material> MaterialTable;
 
-	bool scatter_ray(const Ray& ray_in, CollisionPoint point, Ray& ray_out, Vector3& attenuation_out);
+inline Material make_material(MaterialType type, const Vector3& color) {
+	Material material;
+	material.type = type;
+	material.color = color;
+	return material;
+}
 
-	Vector3 color;
-};
+// Scatter functions, one per material type:
+// u, v are the bounce's sample point in [0,1)^2 to pick a direction with (see Sampler)
+// Returns true if we should continue bouncing, false if we should stop bouncing:
+// Writes the scattered ray into ray_out
+// Writes attenuation color into attenuation_out
+#define MATERIAL_SCATTER(type, scatter, name) \
+	bool scatter(const Material& material, const Ray& ray_in, const CollisionPoint& point, double u, double v, Ray& ray_out, Vector3& attenuation_out);
+MATERIAL_TYPES(MATERIAL_SCATTER)
+#undef MATERIAL_SCATTER
+
+// Density (per solid angle) of a scatter_diffuse() bounce going out at
+// cos_theta to the normal, and the diffuse BRDF's value for a color
+// (the bounce is importance sampled, so attenuation is just the color)
+inline double diffuse_pdf(double cos_theta) { return (cos_theta > 0.0) ? cos_theta * M_1_PI : 0.0; }
+inline Vector3 diffuse_brdf(const Vector3& color) { return color * M_1_PI; }
+
+// Scatters off any material, switching on its type
+inline bool scatter_ray(const Material& material, const Ray& ray_in, const CollisionPoint& point, double u, double v, Ray& ray_out, Vector3& attenuation_out) {
+	switch (material.type) {
+#define MATERIAL_CASE(type, scatter, name) \
+		case MATERIAL_##type: return scatter(material, ray_in, point, u, v, ray_out, attenuation_out);
+		MATERIAL_TYPES(MATERIAL_CASE)
+#undef MATERIAL_CASE
+		default: return false;
+	}
+}
+
+// Name of a material type as used in scene files ("diffuse", "metal", "emissive")
+const char *material_type_name(MaterialType type);
+
+// Looks up a material type by name
+// Returns false if there's no such type
+bool material_type_from_name(const char *name, MaterialType& type);
 
 #endif
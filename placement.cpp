@@ -0,0 +1,158 @@
+#include <math.h>
+#include <algorithm>
+
+#include "placement.h"
+#include "utils.h"
+
+SpatialHash::SpatialHash(const Vector3& origin_in, double cell_size_in, size_t expected_points) : origin(origin_in), cell_size(cell_size_in) {
+	// Power of two buckets, about half full
+	size_t num_buckets = 1;
+	while (num_buckets < 2 * expected_points) num_buckets <<= 1;
+	heads.assign(num_buckets, SPATIAL_HASH_END);
+	next.reserve(expected_points);
+}
+
+void SpatialHash::cell_of(const Vector3& p, int64_t& x, int64_t& y, int64_t& z) const {
+	x = (int64_t)floor((p.x - origin.x) / cell_size);
+	y = (int64_t)floor((p.y - origin.y) / cell_size);
+	z = (int64_t)floor((p.z - origin.z) / cell_size);
+}
+
+void SpatialHash::insert(uint32_t idx, const Vector3& p) {
+	int64_t x, y, z;
+	cell_of(p, x, y, z);
+	size_t b = bucket(x, y, z);
+
+	if (next.size() <= idx) next.resize(idx + 1, SPATIAL_HASH_END);
+	next[idx] = heads[b];
+	heads[b] = idx;
+}
+
+// A dart that landed, and the random key the last round gets trimmed by
+typedef struct dart_t {
+	PlacedSphere sphere;
+	uint64_t key;
+} Dart;
+
+// Number of cells in [0, dim) with the given parity
+static inline int64_t parity_cells(int64_t dim, int parity) {
+	return (dim - parity + 1) / 2;
+}
+
+// Uniform in [lo, hi) clipped to the box, for one axis of one cell
+static inline double in_cell(Rng& rng, double box_lo, double box_hi, double cell, int64_t idx) {
+	double lo = box_lo + idx * cell;
+	return rng.range(lo, std::min(box_hi, lo + cell));
+}
+
+vector<PlacedSphere> scatter_spheres(const ScatterSettings& settings, ThreadPool& pool) {
+	vector<PlacedSphere> placed;
+
+	if (0 == settings.count || !(settings.max_radius > 0.0) || settings.min_radius > settings.max_radius) return placed;
+
+	// Any two spheres further apart than this can't touch
+	double cell = 2.0 * settings.max_radius;
+
+	// Box of the centers, spheres on the ground only span one layer of cells
+	Vector3 lo = settings.min;
+	Vector3 hi = settings.max;
+	if (settings.on_ground) {
+		lo.y = settings.ground_y + settings.min_radius;
+		hi.y = settings.ground_y + settings.max_radius;
+	}
+
+	int64_t dims[3];
+	dims[0] = std::max((int64_t)1, (int64_t)ceil((hi.x - lo.x) / cell));
+	dims[1] = std::max((int64_t)1, (int64_t)ceil((hi.y - lo.y) / cell));
+	dims[2] = std::max((int64_t)1, (int64_t)ceil((hi.z - lo.z) / cell));
+
+	SpatialHash grid(lo, cell, settings.count);
+	vector<vector<Dart> > landed;
+	vector<uint64_t> round_keys;
+	double total_cells = (double)dims[0] * dims[1] * dims[2];
+
+	// Share of the last round's darts that landed
+	double landed_share = 1.0;
+
+	placed.reserve(settings.count);
+	for (uint round = 0; round < PLACEMENT_MAX_ROUNDS && placed.size() < settings.count; round++) {
+		size_t round_start = placed.size();
+		uint64_t round_seed = hash_u64(hash_u64(settings.seed) + round);
+		round_keys.clear();
+
+		// Sparse scenes don't need a dart from every cell, just enough to
+		// finish (with a little to spare), so cells throw with this chance
+		double throw_chance = std::min(1.0, 1.25 * (settings.count - round_start) / (total_cells * landed_share));
+
+		for (int phase = 0; phase < 8; phase++) {
+			int px = phase & 1, py = (phase >> 1) & 1, pz = (phase >> 2) & 1;
+			int64_t nx = parity_cells(dims[0], px);
+			int64_t ny = parity_cells(dims[1], py);
+			int64_t nz = parity_cells(dims[2], pz);
+			size_t phase_cells = nx * ny * nz;
+			size_t chunks = (phase_cells + PLACEMENT_CHUNK - 1) / PLACEMENT_CHUNK;
+
+			if (0 == phase_cells) continue;
+			landed.resize(std::max(landed.size(), chunks));
+
+			// Only reads placed and grid, the phase's darts go in afterwards
+			pool.parallel_for(chunks, [&](size_t chunk, uint thread_id) {
+				vector<Dart>& out = landed[chunk];
+				size_t end = std::min(phase_cells, (chunk + 1) * PLACEMENT_CHUNK);
+
+				out.clear();
+				for (size_t k = chunk * PLACEMENT_CHUNK; k < end; k++) {
+					int64_t ix = px + 2 * (int64_t)(k % nx);
+					int64_t iy = py + 2 * (int64_t)((k / nx) % ny);
+					int64_t iz = pz + 2 * (int64_t)(k / (nx * ny));
+					uint64_t cell_id = (iz * dims[1] + iy) * dims[0] + ix;
+					Rng rng(hash_u64(round_seed + cell_id));
+					Dart dart;
+
+					if (throw_chance < 1.0 && rng.next_double() >= throw_chance) continue;
+					double r = rng.range(settings.min_radius, settings.max_radius);
+					dart.sphere.radius = r;
+					dart.sphere.center.x = in_cell(rng, lo.x, hi.x, cell, ix);
+					dart.sphere.center.y = settings.on_ground ? settings.ground_y + r : in_cell(rng, lo.y, hi.y, cell, iy);
+					dart.sphere.center.z = in_cell(rng, lo.z, hi.z, cell, iz);
+					dart.key = ((uint64_t)rng.next_u32() << 32) | rng.next_u32();
+
+					bool clear = true;
+					grid.near(dart.sphere.center, r + settings.max_radius, [&](uint32_t idx) {
+						Vector3 between = Vector3(placed[idx].center) - Vector3(dart.sphere.center);
+						double reach = placed[idx].radius + r;
+						if (dot(between, between) < reach * reach) clear = false;
+					});
+					if (clear) out.push_back(dart);
+				}
+			});
+
+			// In chunk order, so the spheres come out the same on any number of threads
+			for (size_t chunk = 0; chunk < chunks; chunk++) {
+				for (const Dart& dart : landed[chunk]) {
+					grid.insert(placed.size(), dart.sphere.center);
+					placed.push_back(dart.sphere);
+					round_keys.push_back(dart.key);
+				}
+			}
+		}
+
+		landed_share = std::max(0.05, (placed.size() - round_start) / (total_cells * throw_chance));
+
+		// Too many: keep a random subset of this round's, so they don't
+		// all come from the first few phases
+		if (placed.size() > settings.count) {
+			size_t keep = settings.count - round_start;
+			vector<uint32_t> by_key(round_keys.size());
+			for (size_t i = 0; i < by_key.size(); i++) by_key[i] = i;
+			std::nth_element(by_key.begin(), by_key.begin() + keep, by_key.end(), [&](uint32_t a, uint32_t b) {
+				return round_keys[a] < round_keys[b] || (round_keys[a] == round_keys[b] && a < b);
+			});
+			by_key.resize(keep);
+			std::sort(by_key.begin(), by_key.end());
+			for (size_t i = 0; i < keep; i++) placed[round_start + i] = placed[round_start + by_key[i]];
+			placed.resize(settings.count);
+		}
+	}
+	return placed;
+}
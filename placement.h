@@ -0,0 +1,108 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <vector>
+
+#include "vector.h"
+#include "threadpool.h"
+
+using std::vector;
+
+// Cells handed to one thread pool item at a time
+#define PLACEMENT_CHUNK 1024
+
+// Marks the end of a SpatialHash bucket's chain
+#define SPATIAL_HASH_END 0xffffffffU
+
+// Dart rounds before scatter_spheres gives up on reaching its count
+#define PLACEMENT_MAX_ROUNDS 64
+
+typedef struct placed_sphere_t {
+	PackedVector3 center; // Packed, scatters can run to millions of spheres
+	double radius;
+} PlacedSphere;
+
+// Points bucketed by the cell of a uniform grid they fall in, with cells
+// hashed into a fixed number of buckets, so memory only depends on how
+// many points there are and not on how far apart they are
+// Cells that hash to the same bucket just make near() visit a few extra
+// points, so callers always check the real distance
+class SpatialHash {
+public:
+	// expected_points sizes the bucket table (it's fine to go over)
+	SpatialHash(const Vector3& origin_in, double cell_size_in, size_t expected_points);
+
+	// Adds point idx at p, not thread safe
+	void insert(uint32_t idx, const Vector3& p);
+
+	// Calls visit(idx) for every point within reach of p (and maybe some
+	// others), reach being at most cell_size
+	template <typename F>
+	void near(const Vector3& p, double reach, F visit) const {
+		int64_t x0, y0, z0, x1, y1, z1;
+		cell_of(p - Vector3(reach, reach, reach), x0, y0, z0);
+		cell_of(p + Vector3(reach, reach, reach), x1, y1, z1);
+		for (int64_t z = z0; z <= z1; z++) {
+			for (int64_t y = y0; y <= y1; y++) {
+				for (int64_t x = x0; x <= x1; x++) {
+					for (uint32_t idx = heads[bucket(x, y, z)]; SPATIAL_HASH_END != idx; idx = next[idx]) visit(idx);
+				}
+			}
+		}
+	}
+
+	void cell_of(const Vector3& p, int64_t& x, int64_t& y, int64_t& z) const;
+
+private:
+	// Cells next to each other along x get buckets next to each other,
+	// so a query mostly stays within a couple of cache lines per row
+	size_t bucket(int64_t x, int64_t y, int64_t z) const {
+		return ((uint64_t)x + (uint64_t)y * 0x9e3779b1ULL + (uint64_t)z * 0x85ebca77c2b2ae63ULL) & (heads.size() - 1);
+	}
+
+	Vector3 origin;
+	double cell_size;
+
+	// Chain head per bucket, then the next point in the chain per point
+	vector<uint32_t> heads;
+	vector<uint32_t> next;
+};
+
+typedef struct scatter_settings_t {
+	// Box the centers go in
+	Vector3 min, max;
+	double min_radius, max_radius;
+
+	// Sit every sphere on the plane y = ground_y (the box's y is ignored)
+	bool on_ground;
+	double ground_y;
+
+	size_t count;
+	uint64_t seed;
+} ScatterSettings;
+
+/**************************************
+ * scatter_spheres
+ *
+ * Dart throwing: places up to settings.count spheres with random radii
+ * in the box, none of them overlapping another.
+ *
+ * The box is cut into cells two max radii wide, so a sphere can only
+ * overlap spheres from its own cell or the ones around it. Each round
+ * every cell throws one dart, checked against its neighbours in a
+ * SpatialHash. Cells go in 8 phases by the parity of their coordinates:
+ * two cells of one phase are never neighbours, so a phase runs on the
+ * whole pool at once without locking. Every dart is seeded from
+ * (seed, round, cell), so the result only depends on the settings,
+ * never on the thread count. If the last round overshoots, a random
+ * subset of its spheres is kept, so the spheres stay spread evenly.
+ *
+ * Costs about linear time in the number of cells and spheres.
+ *
+ * Returns the spheres placed (fewer than count if the box filled up)
+ **************************************/
+vector<PlacedSphere> scatter_spheres(const ScatterSettings& settings, ThreadPool& pool);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include <sys/types.h>
+
+#include "vector.h"
+#include "CollisionPoint.h"
+
+// Most rays a packet can hold (an 8x8 block of pixels)
+#define MAX_PACKET_SIZE 64
+
+// A bundle of rays that start close together and point roughly the
+// same way (like camera rays through neighboring pixels), traced
+// through the world together
+class RayPacket {
+public:
+	RayPacket() : size(0) {}
+
+	// Adds a ray that may hit anything up to t_max
+	void add(const Ray& ray, double t_max) {
+		rays[size] = ray;
+		t_max_out[size] = t_max;
+		hit[size] = false;
+		size++;
+	}
+
+	uint size;
+	Ray rays[MAX_PACKET_SIZE];
+
+	// Results, per ray:
+	// t_max_out shrinks to the closest hit distance
+	double t_max_out[MAX_PACKET_SIZE];
+	bool hit[MAX_PACKET_SIZE];
+	CollisionPoint points[MAX_PACKET_SIZE];
+};
+
+#endif
@@ -1,106 +1,161 @@
 #include <iostream>
-#include <signal.h>
-#include <gtk/gtk.h>
+#include <atomic>
 
 #include "raytrace.h"
 #include "vector.h"
 #include "sphere.h"
 #include "RenderTarget.h"
 #include "material.h"
+#include "integrator.h"
 #include "utils.h"
-
-// Application (this needs to be static because of SIGINT)
-static GtkApplication *__app__ = NULL;
-
-// Image render target
-static RenderTarget *render_target = NULL;
+#include "stats.h"
+#include "coordinator.h"
 
 // Largest value allowed for a double
 static double Infinity = std::numeric_limits<double>::infinity();
 
 using namespace std;
 
-// Returns the sky color for a given ray
-Vector3 get_sky_color (const Ray& r) {
-	// Interpolate down the Y component of the ray
-	// If the ray is pointing to (0,1,0) then do blue
-	// If the ray is poitning to (0,-1,0) then do whiteish
-	// By using a unit vector, we get a beautiful falloff near the bottom
-	// As the vector magnitude changes for X, so equivalent Y values follow a nice subtle curve
-	Vector3 ray_unit = unit(r.dir);
-	double y_dist_from_bottom = (0.5 * ray_unit.y) + 0.5;
-	return Lerp(Vector3(1.0,1.0,1.0), Vector3(0.25, (166.0/255), (254.0/255)), y_dist_from_bottom);
-}
-
 /***************
  * raytrace
  *
- * Recursively traces a ray through the provided set
- * of WorldObjects. Terminates when the maxmimum
- * recursion depth is exceeded, or when the ray
- * hits the sky.
+ * Traces a single ray through the world, bounce by bounce.
+ * Terminates when the maxmimum bounce depth is exceeded,
+ * when the ray hits a light, when it hits the sky, or when
+ * it loses at Russian roulette.
+ * (render() uses the batched Wavefront tracer instead,
+ * this is the one-ray-at-a-time version of the same thing;
+ * with no pixel to stratify over, it draws every choice
+ * from thread_rng())
  *
  * Inputs: ray - the ray to test
- *         objects - the array of objects to test
- *         curdepth - the current recursion depth
+ *         world - the root object of the scene (usually a WorldGroup)
+ *         curdepth - the bounce depth the ray starts at
+ *         max_depth - the deepest bounce allowed
+ *         roulette - when the path may be cut short
+ *         sample_lights - sample world's lights at diffuse hits
  * Outputs: the color (as Vector3) this ray ended up at
  * Side Effects: None
  ***************/
-Vector3 raytrace (const Ray& ray, const std::vector<WorldObject*> objects, uint curdepth) {
-	CollisionPoint test_point, closest_point;
-	Material *hit_mat = NULL;
+Vector3 raytrace (const Ray& ray, const WorldObject& world, uint curdepth, uint max_depth, const Roulette& roulette, bool sample_lights) {
+	const MaterialTable& materials = *world.materials;
+	const LightList *lights = (sample_lights && NULL != world.lights && !world.lights->empty()) ? world.lights : NULL;
+	CollisionPoint closest_point;
+	Ray cur_ray = ray;
 
-	// Have we hit something in the world?
-	bool hit_something = false;
+	// Product of every attenuation picked up so far
+	Vector3 throughput = Vector3(1,1,1);
 
-	// Test for collision with all objects in list of world objects
-	double closest_hit = Infinity;
+	// Light picked up along the way
+	Vector3 color = Vector3(0,0,0);
 
-	// Recursion depth exceeded, return default diffuse
-	if (curdepth > RAY_BOUNCE_DEPTH) {
-		return Vector3(0,0,0);
-	}
+	// Where the last bounce left from and its density (see Wavefront::bounce_pdf)
+	Vector3 bounce_from = ray.pos;
+	double bounce_pdf = 0.0;
 
-	// Iterate over all objects
-	for (WorldObject *obj : objects) {
-		if (obj->hit(ray, 0.00001, Infinity, test_point)) {
-			hit_something = true;
-			if (test_point.t_collision < closest_hit) {
-				closest_hit = test_point.t_collision;
-				closest_point = test_point;
-				hit_mat = &obj->material;
-			}
+	STAT_ADD(paths, 1);
+	for (; curdepth <= max_depth; curdepth++) {
+		STAT_ADD(rays, 1);
+
+		// No collision, draw sky
+		if (!world.hit(cur_ray, RAY_T_MIN, Infinity, closest_point)) {
+			STAT_PATH_END(PATH_SKY, curdepth);
+			return color + throughput * get_sky_color(cur_ray);
 		}
-	}
 
-	if (hit_something) {
 		// Scatter according to the object's material
+		const Material& material = materials[closest_point.material_id];
 		Ray next_ray;
 		Vector3 attenuation;
 		bool continue_bouncing = false;
-		continue_bouncing = (*hit_mat).scatter_ray(ray, closest_point, next_ray, attenuation);
+		double u = rand_double(), v = rand_double();
+		continue_bouncing = scatter_ray(material, cur_ray, closest_point, u, v, next_ray, attenuation);
+
+		if (!continue_bouncing) {
+			double weight = (MATERIAL_EMISSIVE == material.type) ? bounce_light_weight(lights, closest_point, bounce_from, bounce_pdf) : 1.0;
+			STAT_PATH_END(PATH_EMISSIVE, curdepth);
+			return color + throughput * attenuation * weight;
+		}
+
+		bool diffuse = (MATERIAL_DIFFUSE == material.type);
+		if (NULL != lights && diffuse && curdepth < max_depth) {
+			double pick = rand_double();
+			u = rand_double();
+			v = rand_double();
+			color += throughput * sample_direct_light(world, *lights, material, closest_point, pick, u, v);
+		}
+		if (NULL != lights) {
+			bounce_from = closest_point.pos;
+			bounce_pdf = diffuse ? diffuse_pdf(dot(unit(next_ray.dir), closest_point.normal)) : 0.0;
+		}
 
-		if (continue_bouncing)
-			return attenuation * raytrace(next_ray, objects, curdepth+1);
-		else
-			return attenuation;
+		throughput = throughput * attenuation;
+		cur_ray = next_ray;
+
+		// Paths that carry little light are mostly cut short here
+		if (!roulette.survive(curdepth + 1, throughput, rand_double())) {
+			STAT_PATH_END(PATH_ROULETTE, curdepth + 1);
+			return color;
+		}
 	}
-	else {
-		// No collision, draw sky
-		return get_sky_color(ray);
+
+	// Bounce depth exceeded, return default diffuse
+	STAT_PATH_END(PATH_DEPTH_CAP, curdepth);
+	return color;
+}
+
+// Draws the progress bar for a given percentage (0 to 100)
+void print_progress (double progress) {
+	printf("[");
+	for (uint pbar = 0; pbar < PROGRESS_BAR_WIDTH; pbar++) {
+		if (progress > (pbar*100)/PROGRESS_BAR_WIDTH) printf ("=");
+		else printf(" ");
 	}
+	printf("]");
+	std::cout << " " << progress << "%\r";
+	std::cout.flush();
+}
+
+// Has a pixel with these samples seen enough of them?
+// Only ever true on a multiple of ADAPTIVE_STEP samples, so the answer
+// doesn't depend on how the samples were batched up
+static bool pixel_converged(const Vector3& sum, double lum_sq_sum, uint32_t count, const RenderSettings& settings) {
+	if (count >= settings.samples) return true;
+	if (settings.noise_threshold <= 0 || count < std::max(settings.min_samples, 2u) || 0 != count % ADAPTIVE_STEP) return false;
+
+	// Standard error of the mean luminance
+	double mean = luminance(sum) / count;
+	double variance = std::max(0.0, (lum_sq_sum / count - mean * mean) * count / (count - 1));
+	double std_error = sqrt(variance / count);
+
+	return std_error <= settings.noise_threshold * std::max(mean, NOISE_LUMINANCE_FLOOR);
 }
 
 /***************
- * render
+ * render_samples
  *
- * Renders into a given RenderTarget (img)
- * Inputs: img - the RenderTarget to render to
+ * Traces samples [first_sample, first_sample + num_samples) of every
+ * pixel, tile by tile, handing each finished tile to sink
+ * Pixels that have converged (see RenderSettings) are skipped, judged
+ * on everything prior already holds for them plus the new samples
+ * Inputs: world - the root object of the scene
+ *         settings - frame size, bounce depth, seed and noise threshold
+ *         pool - the worker threads to split tiles across
+ *         first_sample, num_samples - which samples of each pixel to trace
+ *         sink - gets every tile's new samples (from worker threads)
+ *         prior - samples already taken, or NULL for none
+ *         idle - called on this thread every so often while tiles are running
  * Outputs: true if successful, false otherwise
- * Side Effects: Changes RenderTarget's buf parameter
+ * Side Effects: None
  ***************/
-bool render(RenderTarget& img) {
-	uint x, y;
+bool render_samples(const WorldObject& world, const RenderSettings& settings, ThreadPool& pool, uint first_sample, uint num_samples, const SampleSink& sink, RenderTarget *prior, const ThreadPool::Idle& idle) {
+	return render_tile_range(world, settings, pool, 0, frame_tiles(settings), first_sample, num_samples, sink, prior, idle);
+}
+
+// render_samples for tiles [first_tile, first_tile + num_tiles) only
+bool render_tile_range(const WorldObject& world, const RenderSettings& settings, ThreadPool& pool, uint first_tile, uint num_tiles, uint first_sample, uint num_samples, const SampleSink& sink, RenderTarget *prior, const ThreadPool::Idle& idle) {
+	uint img_w = settings.width, img_h = settings.height;
+	uint64_t seed = settings.seed;
 
 	// We are using a left-handed coord system
 	// (RH coord system but with -z pointing away from camera)
@@ -110,129 +165,171 @@ bool render(RenderTarget& img) {
 	// Vector3 right_dir = Vector3(1.0,0.0,0.0);
 	// Vector3 forward_dir = Vector3(0.0,0.0,-1.0);
 
-	// World Objects:
-	std::vector<WorldObject*> objects;
-	Diffuse diffuse_mat = Diffuse(Vector3(0.5,0.5,0.5));
-	Emissive emissive_mat = Emissive(Vector3(1,1,1));
-	Metal metal_mat = Metal(Vector3(0.75,0.75,0.75));
-
-	Diffuse rand_mats[4];
-	rand_mats[0] = Diffuse(Vector3(1,0,1));
-	rand_mats[1] = Diffuse(Vector3(1,1,0));
-	rand_mats[2] = Diffuse(Vector3(0,1,1));
-	rand_mats[3] = Diffuse(Vector3(1,1,1));
-
-	Emissive rand_matse[4];
-	rand_matse[0] = Emissive(Vector3(1,0,1));
-	rand_matse[1] = Emissive(Vector3(1,1,0));
-	rand_matse[2] = Emissive(Vector3(0,1,1));
-	rand_matse[3] = Emissive(Vector3(1,1,1));
-
-	printf ("Generating random non-overlapping spheres...\n");
-
-	// This is hacky, I know, will fix eventually
-	// It does look really good though :)
-	
-	for (uint i = 0; i < 50; i++) {
-		bool correct_params = false;
-		double randsize = 1.0;
-		Vector3 randpos = Vector3(0,0,-1);
-		while (!correct_params) {
-			randsize = rand_range(0.05,0.075);
-			randpos = Vector3(rand_range(-2.35,2.35),-0.5 + randsize,rand_range(-2,0.5));
-			double found_it = true;
-			for (WorldObject* j : objects) {
-				double dist_between_objects = 0.0;
-				dist_between_objects += pow(((Sphere*)j)->center.x - randpos.x, 2);
-				dist_between_objects += pow(((Sphere*)j)->center.y - randpos.y, 2);
-				dist_between_objects += pow(((Sphere*)j)->center.z - randpos.z, 2);
-				dist_between_objects = sqrt(dist_between_objects);
-				if (dist_between_objects < (((Sphere*)j)->radius) + randsize) found_it = false;
-			}
-			if (found_it) correct_params = true;
+	// Split the image into tiles, the pool balances them across threads
+	uint tiles_x = (img_w + TILE_SIZE - 1) / TILE_SIZE;
+	if ((uint64_t)first_tile + num_tiles > frame_tiles(settings)) return false;
+	uint last_sample = first_sample + num_samples;
+
+	// Keep the vertical field of view, widen or narrow with the image
+	double aspect_x = (ASPECT_Y * (double)img_w) / img_h;
+
+	// One batch of paths per worker
+	bool aovs = settings.wants_aovs();
+	Sampler sampler(settings.sampler, seed, settings.samples);
+	std::vector<Wavefront> wavefronts(pool.size(), Wavefront(world, settings.max_depth, settings.roulette, aovs, settings.sample_lights, sampler));
+
+	pool.parallel_for(num_tiles, [&](size_t item, uint thread_id) {
+		size_t tile = first_tile + item;
+		uint x0 = (tile % tiles_x) * TILE_SIZE;
+		uint y0 = (tile / tiles_x) * TILE_SIZE;
+		uint x1 = std::min(x0 + TILE_SIZE, img_w);
+		uint y1 = std::min(y0 + TILE_SIZE, img_h);
+		uint tw = x1 - x0;
+		Wavefront& wf = wavefronts[thread_id];
+		uint tile_pixels = tw * (y1 - y0);
+
+		// New samples for the sink
+		std::vector<Vector3> pixel_color(tile_pixels, Vector3(0,0,0));
+		std::vector<double> lum_sq(tile_pixels, 0.0);
+		std::vector<uint32_t> counts(tile_pixels, 0);
+
+		// First-hit AOVs of the new samples, if asked for
+		std::vector<Vector3> albedo_sums(aovs ? tile_pixels : 0, Vector3(0,0,0));
+		std::vector<Vector3> normal_sums(aovs ? tile_pixels : 0, Vector3(0,0,0));
+		std::vector<double> distance_sums(aovs ? tile_pixels : 0, 0.0);
+
+		// Everything each pixel has, to judge convergence on
+		std::vector<Vector3> total_color(tile_pixels, Vector3(0,0,0));
+		std::vector<double> total_lum_sq(tile_pixels, 0.0);
+		std::vector<uint32_t> total_counts(tile_pixels, 0);
+		if (NULL != prior) prior->get_samples(x0, y0, x1, y1, total_color.data(), total_lum_sq.data(), total_counts.data());
+
+		// Pixels that still want samples
+		std::vector<uint8_t> sampling(tile_pixels);
+		uint pixels_sampling = 0;
+		for (uint i = 0; i < tile_pixels; i++) {
+			sampling[i] = !pixel_converged(total_color[i], total_lum_sq[i], total_counts[i], settings);
+			pixels_sampling += sampling[i];
 		}
-		objects.push_back(new Sphere(randpos, randsize, rand_mats[rand() % 4]));
-	}
 
-	for (uint i = 0; i < 50; i++) {
-		bool correct_params = false;
-		double randsize = 1.0;
-		Vector3 randpos = Vector3(0,0,-1);
-		while (!correct_params) {
-			randsize = rand_range(0.05,0.075);
-			randpos = Vector3(rand_range(-2.35,2.35),-0.5 + randsize,rand_range(-2,0.5));
-			double found_it = true;
-			for (WorldObject* j : objects) {
-				double dist_between_objects = 0.0;
-				dist_between_objects += pow(((Sphere*)j)->center.x - randpos.x, 2);
-				dist_between_objects += pow(((Sphere*)j)->center.y - randpos.y, 2);
-				dist_between_objects += pow(((Sphere*)j)->center.z - randpos.z, 2);
-				dist_between_objects = sqrt(dist_between_objects);
-				if (dist_between_objects < (((Sphere*)j)->radius) + randsize) found_it = false;
+		// As many samples per batch as keep it around WAVEFRONT_SIZE paths
+		uint batch_samples = std::max(1, WAVEFRONT_SIZE / (TILE_SIZE * TILE_SIZE));
+
+		for (uint s0 = first_sample; s0 < last_sample && pixels_sampling > 0; s0 += batch_samples) {
+			uint s1 = std::min(s0 + batch_samples, last_sample);
+			wf.clear();
+
+			// Camera rays go out in packets of PACKET_DIM x PACKET_DIM pixels
+			for (uint py = y0; py < y1; py += PACKET_DIM) {
+				for (uint px = x0; px < x1; px += PACKET_DIM) {
+					uint pw = std::min(px + PACKET_DIM, x1) - px;
+					uint ph = std::min(py + PACKET_DIM, y1) - py;
+
+					for (uint sample = s0; sample < s1; sample++) {
+						// Trace out vectors that form a square from -1 to 1 on both dimensions
+						for (uint k = 0; k < pw * ph; k++) {
+							uint x = px + (k % pw), y = py + (k / pw);
+							if (!sampling[(y - y0) * tw + (x - x0)]) continue;
+
+							// Jittered over the two pixel wide box around the pixel
+							SampleId id = { x, y, sample };
+							double jitter_x, jitter_y;
+							sampler.get_2d(id, SAMPLE_DIM_PIXEL, jitter_x, jitter_y);
+							jitter_x = 2.0 * jitter_x - 1.0;
+							jitter_y = 2.0 * jitter_y - 1.0;
+							Vector3 pointer = Vector3(aspect_x * (2.0 * ((x*1.0+jitter_x)/img_w) - 1.0), ASPECT_Y * (2.0 * ((img_h-y+jitter_y)*1.0/img_h) - 1.0), -1.0);
+
+							// Each path carries on drawing from its own sample's dimensions
+							wf.add(Ray(camera_pos, pointer), id);
+						}
+						wf.end_packet();
+					}
+				}
 			}
-			if (found_it) correct_params = true;
-		}
-		objects.push_back(new Sphere(randpos, randsize, rand_matse[rand() % 4]));
-	}
 
-	for (uint i = 0; i < 75; i++) {
-		bool correct_params = false;
-		double randsize = 1.0;
-		Vector3 randpos = Vector3(0,0,-1);
-		while (!correct_params) {
-			randsize = rand_range(0.05,0.075);
-			randpos = Vector3(rand_range(-2.35,2.35),-0.5 + randsize,rand_range(-2,0.5));
-			double found_it = true;
-			for (WorldObject* j : objects) {
-				double dist_between_objects = 0.0;
-				dist_between_objects += pow(((Sphere*)j)->center.x - randpos.x, 2);
-				dist_between_objects += pow(((Sphere*)j)->center.y - randpos.y, 2);
-				dist_between_objects += pow(((Sphere*)j)->center.z - randpos.z, 2);
-				dist_between_objects = sqrt(dist_between_objects);
-				if (dist_between_objects < (((Sphere*)j)->radius) + randsize) found_it = false;
+			wf.run();
+
+			// Walk the paths in the order they were added, so every pixel sums its samples in order
+			uint path = 0;
+			for (uint py = y0; py < y1; py += PACKET_DIM) {
+				for (uint px = x0; px < x1; px += PACKET_DIM) {
+					uint pw = std::min(px + PACKET_DIM, x1) - px;
+					uint ph = std::min(py + PACKET_DIM, y1) - py;
+					for (uint sample = s0; sample < s1; sample++) {
+						for (uint k = 0; k < pw * ph; k++) {
+							uint i = (py - y0 + k / pw) * tw + (px - x0 + k % pw);
+							if (!sampling[i]) continue;
+
+							if (aovs) {
+								albedo_sums[i] += wf.albedo[path];
+								normal_sums[i] += wf.normal[path];
+								distance_sums[i] += wf.distance[path];
+							}
+
+							const Vector3& c = wf.radiance[path++];
+							double lum = luminance(c);
+							pixel_color[i] += c;
+							lum_sq[i] += lum * lum;
+							counts[i]++;
+							total_color[i] += c;
+							total_lum_sq[i] += lum * lum;
+							total_counts[i]++;
+						}
+					}
+				}
 			}
-			if (found_it) correct_params = true;
-		}
-		objects.push_back(new Sphere(randpos, randsize, metal_mat));
-	}
 
-	// Create some world objects:
-	objects.push_back(new Sphere(Vector3(0,0,-1), 0.657, metal_mat));
-	objects.push_back(new Sphere(Vector3(0,-1000.5, 0), 1000, diffuse_mat));
-	//objects.push_back(new Sphere(Vector3(-1.15,-0.35,-1), 0.15, diffuse_mat));
-	//objects.push_back(new Sphere(Vector3(1.15,-0.35,-1), 0.15, emissive_mat));
-
-	// Iterate over every pixel
-	printf("Raytracing!\n");
-	for (y = 0; y < img.h; y++) {
-		// Print progress bar:
-		if (y % 10 == 0) {
-			double progress = (y*100)/img.h;
-
-			printf("[");
-			for (uint pbar = 0; pbar < PROGRESS_BAR_WIDTH; pbar++) {
-				if (progress > (pbar*100)/PROGRESS_BAR_WIDTH) printf ("=");
-				else printf(" ");
+			// Converged pixels sit out the rest of the batches
+			for (uint i = 0; i < tile_pixels; i++) {
+				if (sampling[i] && pixel_converged(total_color[i], total_lum_sq[i], total_counts[i], settings)) {
+					sampling[i] = 0;
+					pixels_sampling--;
+				}
 			}
-			printf("]");
-			std::cout << " " << progress << "%\r";
-			std::cout.flush();
 		}
 
-		for (x = 0; x < img.w; x++) {
-			Vector3 pixel_color = Vector3(0,0,0);
+		tile_samples_t tile_out = { x0, y0, x1, y1, pixel_color.data(), lum_sq.data(), counts.data(),
+		                            aovs ? albedo_sums.data() : NULL, aovs ? normal_sums.data() : NULL, aovs ? distance_sums.data() : NULL };
+		sink(tile_out);
+	}, idle);
 
-			// Trace out vectors that form a square from -1 to 1 on both dimensions
-			for (uint sample = 0; sample < NUM_SAMPLES; sample++) {
-				Vector3 pointer = Vector3(ASPECT_X * (2.0 * ((x*1.0+rand_range(-1,1))/img.w) - 1.0), ASPECT_Y * (2.0 * ((img.h-y+rand_range(-1,1))*1.0/img.h) - 1.0), -1.0);
-				Ray r = Ray(camera_pos, pointer);
-				
-				pixel_color += raytrace(r, objects, 0);
-			}
+	return true;
+}
 
-			pixel_color /= NUM_SAMPLES;
-			img.setpix(x,y,pixel_color);
-		}
+/***************
+ * render_frame
+ *
+ * Traces every sample of a frame, handing each finished tile's
+ * samples to sink, with a progress bar and the frame's stats
+ * Inputs: world - the root object of the scene
+ *         settings - frame size, sample count, bounce depth and seed
+ *         pool - the worker threads to split tiles across
+ *         sink - gets every tile as it finishes (from worker threads)
+ *         stats - gets the frame's render statistics, if not NULL
+ *         coordinator - hands the tiles to worker processes, if not NULL
+ * Outputs: true if successful, false otherwise
+ * Side Effects: Resets the per-thread stats counters
+ ***************/
+static bool render_frame(const WorldObject& world, const RenderSettings& settings, ThreadPool& pool, const SampleSink& sink, RenderStats *stats, Coordinator *coordinator) {
+	std::atomic<uint64_t> pixels_done(0);
+	uint64_t img_pixels = (uint64_t)settings.width * settings.height;
+
+	stats_reset();
+
+	SampleSink counted_sink = [&](const tile_samples_t& tile) {
+		sink(tile);
+		pixels_done += (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+	};
+	ThreadPool::Idle show_progress = [&]() {
+		// Combined progress of every worker
+		print_progress((uint)((pixels_done * 100) / img_pixels));
+	};
+
+	bool ok;
+	if (NULL != coordinator) ok = coordinator->render(settings, counted_sink, show_progress);
+	else {
+		printf("Raytracing on %u threads!\n", pool.size());
+		ok = render_samples(world, settings, pool, 0, settings.samples, counted_sink, NULL, show_progress);
 	}
 
 	// Display done message!
@@ -244,76 +341,48 @@ bool render(RenderTarget& img) {
 	std::cout << " " << 100 << "%\r\n" << "Done!\n";
 	std::cout.flush();
 
-	// Convert internal framebuffer to GTK-friendly version
-	return img.RenderGTK();
-}
+	// Every worker is idle again, so their counters can be read
+	if (NULL != stats) {
+		*stats = stats_collect();
+		stats->pixels = img_pixels;
+	}
 
-// Initial callback upon application creation:
-void myapp_activate(GtkApplication *app, gpointer user_data) {
-	GtkWidget *window = NULL;
-
-	// Render:
-	render(*render_target);
-
-	// Initialize a GdkPixbuf with the GBytes buffer:
-	GdkPixbuf *imgpixbuf = gdk_pixbuf_new_from_data(
-							(guchar*)render_target->gtkbuf,
-							GDK_COLORSPACE_RGB,
-							false, // No Alpha
-							8, // 8 bits per sample
-							render_target->w,
-							render_target->h,
-							BYTES_PER_PIXEL * render_target->w, // Row length
-							NULL,
-							0
-						);
-
-	// Initialize a GtkImage
-	GtkWidget *image_widget;
-	image_widget = gtk_image_new_from_pixbuf(imgpixbuf);
-
-	// Create window
-	window = gtk_application_window_new (app);
-	gtk_window_set_title (GTK_WINDOW(window), "Raytracer Boi");
-	gtk_window_set_default_size (GTK_WINDOW(window), DIM_X, DIM_Y);
-
-	// Attach image to window
-	gtk_container_add(GTK_CONTAINER (window), image_widget);
-
-	// Show window
-	gtk_widget_show_all(window);
+	return ok;
 }
 
-// Launch GTK App
-int main (int argc, char **argv) {
-	int app_status = 0;
-
-	// SIGINT handler (just in case ;D):
-	signal(SIGINT, sigint_handler);
-
-	srand(time(NULL));
-
-	// Create image buffer:
-	render_target = new RenderTarget(DIM_X, DIM_Y);
+/***************
+ * render
+ *
+ * Renders a frame tile by tile, handing each finished tile to sink
+ * Inputs: world - the root object of the scene
+ *         settings - frame size, sample count, bounce depth and seed
+ *         pool - the worker threads to split tiles across
+ *         sink - gets every tile as it finishes (from worker threads)
+ *         stats - gets the frame's render statistics, if not NULL
+ * Outputs: true if successful, false otherwise
+ * Side Effects: Resets the per-thread stats counters
+ ***************/
+bool render(const WorldObject& world, const RenderSettings& settings, ThreadPool& pool, const TileSink& sink, RenderStats *stats, Coordinator *coordinator) {
+	return render_frame(world, settings, pool, [&](const tile_samples_t& tile) {
+		// Sums to averages
+		uint tile_pixels = (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+		std::vector<Vector3> pixels(tile.sums, tile.sums + tile_pixels);
+		for (uint i = 0; i < tile_pixels; i++) pixels[i] /= tile.counts[i];
+		sink(tile.x0, tile.y0, tile.x1, tile.y1, pixels.data());
+	}, stats, coordinator);
+}
 
-	// Allocate GTK app:
-	__app__ = gtk_application_new("org.jprx.cpu_raytracer", G_APPLICATION_FLAGS_NONE);
+// Render straight into a RenderTarget, denoising it if the settings ask to
+bool render(RenderTarget& img, const WorldObject& world, const RenderSettings& settings, ThreadPool& pool, RenderStats *stats, Coordinator *coordinator) {
+	if (img.w != settings.width || img.h != settings.height) return false;
 
-	// Setup activation handler (app 'main' loop):
-	g_signal_connect(__app__, "activate", G_CALLBACK(myapp_activate), NULL);
+	img.clear();
+	bool ok = render_frame(world, settings, pool, [&](const tile_samples_t& tile) {
+		img.accumulate(tile);
+	}, stats, coordinator);
 
-	// Run app and store return code:
-	app_status = g_application_run(G_APPLICATION (__app__), argc, argv);
+	if (ok && settings.denoise.passes > 0) ok = img.denoise(pool, settings.denoise);
 
-	// Cleanup
-	sigint_handler(-1);
-	return 0;
+	// Convert internal framebuffer to GTK-friendly version
+	return ok && img.RenderGTK(settings.resolve, &pool);
 }
-
-// Cleanup and close down GTK app
-void sigint_handler(int signum) {
-	printf("\nGoodbye!\n");
-	delete render_target;
-	g_object_unref(__app__);
-	exit(0);
-}
\ No newline at end of file
@@ -3,32 +3,119 @@
 
 #include <sys/types.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <limits>
+#include <functional>
 
 #include "vector.h"
 #include "RenderTarget.h"
+#include "threadpool.h"
+#include "worldObject.h"
+#include "integrator.h"
+#include "sampler.h"
+#include "denoise.h"
+#include "resolve.h"
+#include "stats.h"
 
 // Aspect dimensions and number of pixels per "dimension"
 #define ASPECT_X ((3))
 #define ASPECT_Y ((2))
 #define RESOLUTION_SCALER ((200))
 
-// Image pixel dimensions
+// Default image pixel dimensions
 #define DIM_X ((RESOLUTION_SCALER * ASPECT_X))
 #define DIM_Y ((RESOLUTION_SCALER * ASPECT_Y))
 
-// Number of samples per pixel (for anti-aliasing)
+// Default number of samples per pixel (for anti-aliasing)
+// With adaptive sampling on, this is the most any pixel gets
 #define NUM_SAMPLES 100
 
-// How deep can rays bounce? (Number of bounces before terminating)
+// Adaptive sampling: a pixel is checked for convergence every
+// ADAPTIVE_STEP samples, and never before MIN_SAMPLES
+#define ADAPTIVE_STEP 16
+#define MIN_SAMPLES 16
+
+// Default noise threshold (0 turns adaptive sampling off)
+#define NOISE_THRESHOLD 0.02
+
+// Pixels darker than this are judged as if they were this bright,
+// so near-black pixels aren't sampled forever chasing relative noise
+#define NOISE_LUMINANCE_FLOOR 0.1
+
+// Default for how deep rays can bounce (Number of bounces before terminating)
 #define RAY_BOUNCE_DEPTH 35
 
 // How many characters wide is the progress bar?
 #define PROGRESS_BAR_WIDTH 60
 
+// Edge length (in pixels) of the square tiles handed to render threads
+#define TILE_SIZE 16
+
+// Camera rays are traced in PACKET_DIM x PACKET_DIM packets (4 or 8)
+#define PACKET_DIM 4
+
+// Everything about a frame that can be picked at runtime
+// (the macros above are just the defaults)
+class RenderSettings {
+public:
+	RenderSettings() : width(DIM_X), height(DIM_Y), samples(NUM_SAMPLES), min_samples(MIN_SAMPLES), noise_threshold(NOISE_THRESHOLD), max_depth(RAY_BOUNCE_DEPTH), roulette(), sample_lights(true), sampler(SAMPLER_SOBOL), seed(1) {}
+
+	// Image pixel dimensions
+	uint width, height;
+
+	// Samples per pixel (the most any pixel gets with adaptive sampling)
+	uint samples;
+
+	// Adaptive sampling: once a pixel has min_samples, it stops as soon as the
+	// standard error of its mean luminance is below noise_threshold times its
+	// luminance (0 means every pixel gets every sample)
+	uint min_samples;
+	double noise_threshold;
+
+	// Bounces before a path is cut off
+	uint max_depth;
+
+	// When paths may end early (see Roulette)
+	Roulette roulette;
+
+	// Sample the scene's lights at diffuse hits (see sample_direct_light)
+	bool sample_lights;
+
+	// How each pixel's samples are spread over their dimensions (see Sampler)
+	SamplerType sampler;
+
+	// Frame seed, the same seed always renders the same image
+	uint64_t seed;
+
+	// Denoising of the finished frame (off unless denoise.passes > 0)
+	DenoiseSettings denoise;
+
+	// How the frame is turned into display colors
+	ResolveSettings resolve;
+
+	// Do tiles need first-hit AOVs? (only the denoiser uses them)
+	bool wants_aovs() const { return denoise.passes > 0; }
+};
+
+// Tiles a frame is split into, numbered row by row from the top left
+inline uint frame_tiles(const RenderSettings& settings) {
+	return ((settings.width + TILE_SIZE - 1) / TILE_SIZE) * ((settings.height + TILE_SIZE - 1) / TILE_SIZE);
+}
+
+// Hands a frame's tiles out to worker processes (see coordinator.h)
+class Coordinator;
+
+// Receives a finished tile: pixels [x0, x1) x [y0, y1), row-major, (x1 - x0) wide
+// Called from the render threads, possibly several at once
+typedef std::function<void(uint x0, uint y0, uint x1, uint y1, const Vector3 *pixels)> TileSink;
+
+// Receives the samples of a finished tile (see tile_samples_t)
+// Called from the render threads, possibly several at once
+typedef std::function<void(const tile_samples_t& tile)> SampleSink;
+
 // Utility functions:
 // Render a quick testpattern to ensure everything is working
-bool render_testpattern(RenderTarget& img) {
+inline bool render_testpattern(RenderTarget& img) {
 	uint x, y;
 	color_t c;
 
@@ -46,18 +133,75 @@ bool render_testpattern(RenderTarget& img) {
 }
 
 // raytrace.cpp methods:
-void sigint_handler(int signum);
-void myapp_activate(GtkApplication *app, gpointer user_data);
+Vector3 raytrace(const Ray& ray, const WorldObject& world, uint curdepth, uint max_depth, const Roulette& roulette = Roulette(), bool sample_lights = true);
+void print_progress(double progress);
+
+/***************
+ * render_samples
+ *
+ * Traces samples [first_sample, first_sample + num_samples) of every
+ * pixel, tile by tile, handing each finished tile to sink
+ * Pixels that have converged (see RenderSettings) are skipped, judged
+ * on everything prior already holds for them plus the new samples
+ * Progressive renders call this once per pass and accumulate into prior;
+ * since every sample has its own random stream and convergence is only
+ * checked every ADAPTIVE_STEP samples, the passes add up to exactly the
+ * image a single render() call gives
+ * Inputs: world - the root object of the scene
+ *         settings - frame size, bounce depth, seed and noise threshold
+ *         pool - the worker threads to split tiles across
+ *         first_sample, num_samples - which samples of each pixel to trace
+ *         sink - gets every tile's new samples (from worker threads)
+ *         prior - samples already taken, or NULL for none
+ *         idle - called on this thread every so often while tiles are running
+ * Outputs: true if successful, false otherwise
+ * Side Effects: None
+ ***************/
+bool render_samples(const WorldObject& world, const RenderSettings& settings, ThreadPool& pool, uint first_sample, uint num_samples, const SampleSink& sink, RenderTarget *prior = NULL, const ThreadPool::Idle& idle = ThreadPool::Idle());
+
+/***************
+ * render_tile_range
+ *
+ * render_samples, but only for tiles [first_tile, first_tile + num_tiles)
+ * (numbered as in frame_tiles), so a frame can be split across processes
+ * A tile's samples only depend on the settings, never on what else is
+ * rendered, so the pieces add up to exactly the whole frame
+ ***************/
+bool render_tile_range(const WorldObject& world, const RenderSettings& settings, ThreadPool& pool, uint first_tile, uint num_tiles, uint first_sample, uint num_samples, const SampleSink& sink, RenderTarget *prior = NULL, const ThreadPool::Idle& idle = ThreadPool::Idle());
 
 /***************
  * render
  *
- * Renders into a given RenderTarget (img)
- * Inputs: img - the RenderTarget to render to
+ * Renders a frame tile by tile, handing each finished tile to sink
+ * Inputs: world - the root object of the scene
+ *         settings - frame size, sample count, bounce depth and seed
+ *         pool - the worker threads to split tiles across
+ *         sink - gets every tile as it finishes (from worker threads)
+ *         stats - gets the frame's render statistics, if not NULL
+ *                 (all zero unless built with RAYTRACE_STATS)
+ *         coordinator - hands the tiles to worker processes instead of
+ *                       pool, if not NULL (the image comes out the same)
+ * Outputs: true if successful, false otherwise
+ * Side Effects: Resets the per-thread stats counters
+ ***************/
+bool render(const WorldObject& world, const RenderSettings& settings, ThreadPool& pool, const TileSink& sink, RenderStats *stats = NULL, Coordinator *coordinator = NULL);
+
+/***************
+ * render
+ *
+ * Renders into a given RenderTarget (img), then denoises it
+ * if settings.denoise asks for that
+ * Inputs: img - the RenderTarget to render to (same size as the settings,
+ *               with AOV buffers if it is to be denoised)
+ *         world - the root object of the scene
+ *         settings - frame size, sample count, bounce depth and seed
+ *         pool - the worker threads to split tiles across
+ *         stats - gets the frame's render statistics, if not NULL
+ *         coordinator - hands the tiles to worker processes, if not NULL
  * Outputs: true if successful, false otherwise
  * Side Effects: Changes RenderTarget's buf parameter
  ***************/
-bool render(RenderTarget& img);
+bool render(RenderTarget& img, const WorldObject& world, const RenderSettings& settings, ThreadPool& pool, RenderStats *stats = NULL, Coordinator *coordinator = NULL);
 
 /**************************************
  *
@@ -93,6 +237,4 @@ bool render(RenderTarget& img);
  **************************************/
 double sphere_collision (const Vector3& center, double radius, const Ray& ray);
 
-bool render_testpattern(RenderTarget& img);
-
 #endif
\ No newline at end of file
@@ -0,0 +1,11 @@
+#include "resolve.h"
+
+void resolve_pixels(const Vector3 *colors, size_t count, const ResolveSettings& settings, uint8_t *out) {
+	ResolveKernel kernel(settings);
+	for (size_t i = 0; i < count; i++) kernel.to_8bit(colors[i].x, colors[i].y, colors[i].z, 1.0, out + 3 * i);
+}
+
+void resolve_pixels(const Vector3 *colors, size_t count, const ResolveSettings& settings, float *out) {
+	ResolveKernel kernel(settings);
+	for (size_t i = 0; i < count; i++) kernel.to_float(colors[i].x, colors[i].y, colors[i].z, 1.0, out + 3 * i);
+}
@@ -0,0 +1,119 @@
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define RESOLVE_X86 1
+#endif
+
+#include "vector.h"
+
+/**************************************
+ * Resolve
+ *
+ * Turns linear radiance into display values: exposure, then tone
+ * mapping, then gamma, then (for 8-bit output) clamping to [0, 1].
+ * The defaults leave colors as they are, so 8-bit output is the
+ * old straight clamp of linear values.
+ **************************************/
+
+// How colors brighter than 1 are brought into range
+enum Tonemap {
+	TONEMAP_NONE,     // Left alone, 8-bit output clips them
+	TONEMAP_REINHARD, // c / (1 + c)
+	TONEMAP_ACES      // Narkowicz's fit of the ACES filmic curve
+};
+
+class ResolveSettings {
+public:
+	ResolveSettings() : exposure(0.0), tonemap(TONEMAP_NONE), gamma(1.0) {}
+
+	// In stops, every +1 doubles the brightness
+	double exposure;
+
+	Tonemap tonemap;
+
+	// Display gamma, channels are raised to 1 / gamma (1 keeps them linear)
+	double gamma;
+};
+
+// ResolveSettings worked out once per frame, rather than once per pixel
+class ResolveKernel {
+public:
+	ResolveKernel(const ResolveSettings& settings) : scale(exp2(settings.exposure)), tonemap(settings.tonemap),
+		inv_gamma(1.0 / settings.gamma), linear(1.0 == settings.gamma) {}
+
+	// Display value of one channel of linear radiance, scaled by extra
+	// first (pass 1 / samples to resolve a sum of samples)
+	// Negative and NaN values come out 0, bright ones are left above 1
+	double operator()(double c, double extra) const {
+		c *= scale * extra;
+		c = clamp_0(c);
+
+		switch (tonemap) {
+			case TONEMAP_REINHARD:
+				c = c / (1.0 + c);
+				break;
+			case TONEMAP_ACES:
+				c = (c * (2.51 * c + 0.03)) / (c * (2.43 * c + 0.59) + 0.14);
+				break;
+			default:
+				break;
+		}
+
+		return linear ? c : pow(c, inv_gamma);
+	}
+
+	// Resolves one color to 8-bit RGB at out[0..2], clamped to [0, 1] first
+	void to_8bit(double r, double g, double b, double extra, uint8_t *out) const {
+		out[0] = (uint8_t)(255.0 * clamp_1((*this)(r, extra)));
+		out[1] = (uint8_t)(255.0 * clamp_1((*this)(g, extra)));
+		out[2] = (uint8_t)(255.0 * clamp_1((*this)(b, extra)));
+	}
+
+	// Resolves one color to float RGB at out[0..2]
+	void to_float(double r, double g, double b, double extra, float *out) const {
+		out[0] = (*this)(r, extra);
+		out[1] = (*this)(g, extra);
+		out[2] = (*this)(b, extra);
+	}
+
+private:
+	// maxsd/minsd rather than ?:, which GCC leaves as branches (it has
+	// to keep -0.0 and NaN as they are) and noisy pixels mispredict
+	// Elsewhere fmax/fmin, which also turn NaN into the bound
+#ifdef RESOLVE_X86
+	static double clamp_0(double c) {
+		return _mm_cvtsd_f64(_mm_max_sd(_mm_set_sd(c), _mm_setzero_pd()));
+	}
+
+	static double clamp_1(double c) {
+		return _mm_cvtsd_f64(_mm_min_sd(_mm_set_sd(c), _mm_set_sd(1.0)));
+	}
+#else
+	static double clamp_0(double c) {
+		return fmax(c, 0.0);
+	}
+
+	static double clamp_1(double c) {
+		return fmin(c, 1.0);
+	}
+#endif
+
+	double scale;
+	Tonemap tonemap;
+	double inv_gamma;
+	bool linear;
+};
+
+// Resolves count colors into packed 8-bit RGB at out
+void resolve_pixels(const Vector3 *colors, size_t count, const ResolveSettings& settings, uint8_t *out);
+
+// Resolves count colors into packed float RGB at out (not clamped)
+void resolve_pixels(const Vector3 *colors, size_t count, const ResolveSettings& settings, float *out);
+
+#endif
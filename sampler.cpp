@@ -0,0 +1,304 @@
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#include "sampler.h"
+#include "utils.h"
+
+// Indexed by SamplerType
+static const char *sampler_type_names[NUM_SAMPLER_TYPES] = { "random", "stratified", "sobol", "bluenoise" };
+
+const char *sampler_type_name(SamplerType type) {
+	return (type < NUM_SAMPLER_TYPES) ? sampler_type_names[type] : "unknown";
+}
+
+bool sampler_type_from_name(const char *name, SamplerType& type) {
+	for (uint t = 0; t < NUM_SAMPLER_TYPES; t++) {
+		if (0 == strcmp(name, sampler_type_names[t])) {
+			type = (SamplerType)t;
+			return true;
+		}
+	}
+	return false;
+}
+
+// 32 random bits as a double in [0,1)
+static inline double to_unit(uint32_t bits) {
+	return bits * (1.0 / 4294967296.0);
+}
+
+// Seed of one dimension of one pixel
+static inline uint64_t pixel_seed(uint64_t seed, const SampleId& id, uint32_t dim) {
+	return hash_u64(hash_u64(hash_u64(seed) + (((uint64_t)id.y << 32) | id.x)) + dim);
+}
+
+static inline uint32_t reverse_bits(uint32_t x) {
+	x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+	x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+	x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+	x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+	return (x >> 16) | (x << 16);
+}
+
+// Second Sobol dimension of every value of each byte of the index, so
+// a point takes four lookups instead of a loop over its 32 bits
+typedef struct sobol_tables_t {
+	uint32_t bytes[4][256];
+} SobolTables;
+
+static const SobolTables& sobol_tables() {
+	static const SobolTables tables = []() {
+		// Direction numbers from the polynomial x + 1
+		uint32_t direction[32];
+		direction[0] = 0x80000000u;
+		for (int bit = 1; bit < 32; bit++) direction[bit] = direction[bit - 1] ^ (direction[bit - 1] >> 1);
+
+		SobolTables t;
+		for (int b = 0; b < 4; b++) {
+			for (uint32_t value = 0; value < 256; value++) {
+				uint32_t y = 0;
+				for (int bit = 0; bit < 8; bit++) {
+					if (value & (1u << bit)) y ^= direction[b * 8 + bit];
+				}
+				t.bytes[b][value] = y;
+			}
+		}
+		return t;
+	}();
+	return tables;
+}
+
+// First two dimensions of the Sobol sequence, as 32-bit fractions
+// (the first is just the bit-reversed index)
+static inline void sobol_2d(uint32_t index, uint32_t& x, uint32_t& y) {
+	const SobolTables& t = sobol_tables();
+	x = reverse_bits(index);
+	y = t.bytes[0][index & 0xff] ^ t.bytes[1][(index >> 8) & 0xff] ^ t.bytes[2][(index >> 16) & 0xff] ^ t.bytes[3][index >> 24];
+}
+
+// Hash-based Owen scrambling: flips each bit depending on every bit
+// above it (Laine and Karras 2011, constants from Burley 2020)
+static inline uint32_t owen_scramble(uint32_t x, uint32_t seed) {
+	x = reverse_bits(x);
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return reverse_bits(x);
+}
+
+// Shuffled and scrambled Sobol point index of the sequence for seed
+static inline void scrambled_sobol_2d(uint32_t index, uint64_t seed, uint32_t& x, uint32_t& y) {
+	sobol_2d(owen_scramble(index, (uint32_t)seed), x, y);
+	x = owen_scramble(x, (uint32_t)(seed >> 32));
+	y = owen_scramble(y, (uint32_t)hash_u64(seed));
+}
+
+// Element index of a random permutation of [0, length), picked by seed,
+// without storing the permutation (Kensler 2013)
+static uint32_t permute(uint32_t index, uint32_t length, uint32_t seed) {
+	uint32_t mask = length - 1;
+	mask |= mask >> 1;
+	mask |= mask >> 2;
+	mask |= mask >> 4;
+	mask |= mask >> 8;
+	mask |= mask >> 16;
+
+	do {
+		index ^= seed;
+		index *= 0xe170893du;
+		index ^= seed >> 16;
+		index ^= (index & mask) >> 4;
+		index ^= seed >> 8;
+		index *= 0x0929eb3fu;
+		index ^= seed >> 23;
+		index ^= (index & mask) >> 1;
+		index *= 1 | seed >> 27;
+		index *= 0x6935fa69u;
+		index ^= (index & mask) >> 11;
+		index *= 0x74dcb303u;
+		index ^= (index & mask) >> 2;
+		index *= 0x9e501cc3u;
+		index ^= (index & mask) >> 2;
+		index *= 0xc860a3dfu;
+		index &= mask;
+		index ^= index >> 5;
+	} while (index >= length);
+	return (index + seed) % length;
+}
+
+/***************
+ * blue_noise_mask
+ *
+ * A BLUE_NOISE_SIZE square tile of values in [0,1), each one used once,
+ * laid out so that every threshold of it is an even spread of points
+ * with no clumps (void and cluster, Ulichney 1993), and tiling without
+ * seams. Made the first time it's asked for, always the same.
+ ***************/
+static const std::vector<double>& blue_noise_mask() {
+	static const std::vector<double> mask = []() {
+		const int size = BLUE_NOISE_SIZE, n = size * size;
+		const double sigma = 1.5;
+
+		// Gaussian falloff by wrapped offset, so the tile has no edges
+		std::vector<double> falloff(n);
+		for (int dy = 0; dy < size; dy++) {
+			for (int dx = 0; dx < size; dx++) {
+				int wx = std::min(dx, size - dx), wy = std::min(dy, size - dy);
+				falloff[dy * size + dx] = exp(-(wx * wx + wy * wy) / (2.0 * sigma * sigma));
+			}
+		}
+
+		// How crowded each pixel's neighborhood is by the points in on
+		std::vector<uint8_t> on(n, 0);
+		std::vector<double> energy(n, 0.0);
+		auto splat = [&](int p, double sign) {
+			int px = p % size, py = p / size;
+			for (int y = 0; y < size; y++) {
+				for (int x = 0; x < size; x++) {
+					energy[y * size + x] += sign * falloff[((y - py) & (size - 1)) * size + ((x - px) & (size - 1))];
+				}
+			}
+		};
+		// Most crowded point, or emptiest spot that isn't a point
+		auto tightest = [&]() {
+			int best = -1;
+			for (int p = 0; p < n; p++) if (on[p] && (best < 0 || energy[p] > energy[best])) best = p;
+			return best;
+		};
+		auto emptiest = [&]() {
+			int best = -1;
+			for (int p = 0; p < n; p++) if (!on[p] && (best < 0 || energy[p] < energy[best])) best = p;
+			return best;
+		};
+
+		// A tenth of the pixels at random, then moved from the tightest
+		// clusters into the biggest voids until that's where they are
+		Rng rng(BLUE_NOISE_SIZE);
+		int initial = n / 10;
+		for (int placed = 0; placed < initial; ) {
+			int p = rng.below(n);
+			if (on[p]) continue;
+			on[p] = 1;
+			splat(p, 1.0);
+			placed++;
+		}
+		for (int step = 0; step < n; step++) {
+			int cluster = tightest();
+			on[cluster] = 0;
+			splat(cluster, -1.0);
+			int empty = emptiest();
+			on[empty] = 1;
+			splat(empty, 1.0);
+			if (empty == cluster) break;
+		}
+
+		// Ranks: the initial points are taken away tightest first, then
+		// the rest are filled in emptiest first
+		std::vector<uint8_t> start_on = on;
+		std::vector<double> start_energy = energy;
+		std::vector<int> rank(n, 0);
+		for (int r = initial - 1; r >= 0; r--) {
+			int p = tightest();
+			on[p] = 0;
+			splat(p, -1.0);
+			rank[p] = r;
+		}
+		on = start_on;
+		energy = start_energy;
+		for (int r = initial; r < n; r++) {
+			int p = emptiest();
+			on[p] = 1;
+			splat(p, 1.0);
+			rank[p] = r;
+		}
+
+		std::vector<double> values(n);
+		for (int p = 0; p < n; p++) values[p] = (rank[p] + 0.5) / n;
+		return values;
+	}();
+	return mask;
+}
+
+void Sampler::get_2d(const SampleId& id, uint32_t dim, double& u, double& v) const {
+	switch (type) {
+		case SAMPLER_STRATIFIED: {
+			uint64_t pixel = pixel_seed(seed, id, dim);
+			uint32_t nx = (uint32_t)ceil(sqrt((double)samples));
+			uint32_t ny = (samples + nx - 1) / nx;
+			uint32_t cells = nx * ny;
+
+			// Every pass over the grid visits the cells in its own order
+			uint32_t pass = id.index / cells;
+			uint32_t seed_32 = (uint32_t)hash_u64(pixel + pass);
+			uint32_t cell = permute(id.index % cells, cells, seed_32);
+			Rng jitter(pixel, ((uint64_t)pass << 32) | cell);
+			u = ((cell % nx) + jitter.next_double()) / nx;
+			v = ((cell / nx) + jitter.next_double()) / ny;
+			break;
+		}
+		case SAMPLER_SOBOL: {
+			uint32_t x, y;
+			scrambled_sobol_2d(id.index, pixel_seed(seed, id, dim), x, y);
+			u = to_unit(x);
+			v = to_unit(y);
+			break;
+		}
+		case SAMPLER_BLUE_NOISE: {
+			// The same points in every pixel...
+			uint32_t x, y;
+			uint64_t dim_seed = hash_u64(hash_u64(seed) + dim);
+			scrambled_sobol_2d(id.index, dim_seed, x, y);
+
+			// ...shifted by the mask, looked up somewhere else for each dimension
+			const std::vector<double>& mask = blue_noise_mask();
+			const uint32_t wrap = BLUE_NOISE_SIZE - 1;
+			uint32_t offset = (uint32_t)(dim_seed >> 32);
+			double shift_u = mask[((id.y + (offset >> 8)) & wrap) * BLUE_NOISE_SIZE + ((id.x + offset) & wrap)];
+			double shift_v = mask[((id.y + (offset >> 24)) & wrap) * BLUE_NOISE_SIZE + ((id.x + (offset >> 16)) & wrap)];
+			u = to_unit(x) + shift_u;
+			v = to_unit(y) + shift_v;
+			if (u >= 1.0) u -= 1.0;
+			if (v >= 1.0) v -= 1.0;
+			break;
+		}
+		default: {
+			Rng rng(pixel_seed(seed, id, dim), id.index);
+			u = rng.next_double();
+			v = rng.next_double();
+			break;
+		}
+	}
+}
+
+void concentric_disk(double u, double v, double& x, double& y) {
+	double a = 2.0 * u - 1.0, b = 2.0 * v - 1.0;
+	double r, phi;
+
+	if (0.0 == a && 0.0 == b) {
+		x = y = 0.0;
+		return;
+	}
+	if (fabs(a) > fabs(b)) {
+		r = a;
+		phi = (M_PI / 4.0) * (b / a);
+	}
+	else {
+		r = b;
+		phi = (M_PI / 2.0) - (M_PI / 4.0) * (a / b);
+	}
+	x = r * cos(phi);
+	y = r * sin(phi);
+}
+
+Vector3 cosine_hemisphere(const Vector3& n, double u, double v) {
+	double x, y;
+	Vector3 b1, b2;
+
+	concentric_disk(u, v, x, y);
+	orthonormal_basis(n, b1, b2);
+	double z = sqrt(std::max(0.0, 1.0 - x * x - y * y));
+	return b1 * x + b2 * y + n * z;
+}
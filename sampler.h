@@ -0,0 +1,122 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "vector.h"
+
+/**************************************
+ * Samplers
+ *
+ * Every random decision a camera path makes draws from its own sample
+ * dimension: the pixel jitter first, then three per bounce (the
+ * bounce direction, the light sample's direction, and the pick of a
+ * light along with Russian roulette). A dimension is a 2D point in
+ * [0,1)^2, and only depends on the frame seed, the pixel, the sample
+ * index and the dimension, so samples can be taken in any order, on
+ * any thread or machine, and still come out the same.
+ *
+ * How the points of one pixel and dimension spread over the square as
+ * the sample index grows is up to the sampler:
+ *   random     - independent points, the old way
+ *   stratified - one jittered point per cell of a grid sized for the
+ *                sample count, cells visited in a shuffled order
+ *   sobol      - the Sobol sequence, Owen scrambled and shuffled with
+ *                a hash of the pixel and dimension (Burley 2020), so
+ *                every power of two prefix is well spread
+ *   bluenoise  - one Sobol sequence shared by every pixel, each pixel
+ *                shifting it (mod 1) by a blue noise mask, so what error
+ *                is left is spread out as fine grain between pixels
+ *                rather than as blotches
+ **************************************/
+
+// Dimension of the pixel jitter
+#define SAMPLE_DIM_PIXEL 0
+
+// Dimensions each bounce draws from
+enum BounceDimension {
+	BOUNCE_DIM_SCATTER,   // The direction a diffuse bounce goes out in
+	BOUNCE_DIM_LIGHT,     // The direction towards a sampled light
+	BOUNCE_DIM_PICK,      // Which light to sample (u), and Russian roulette after the bounce (v)
+	BOUNCE_DIMS
+};
+
+// Dimension bounce number depth draws what from
+inline uint32_t bounce_dimension(uint depth, BounceDimension what) {
+	return 1 + depth * BOUNCE_DIMS + what;
+}
+
+// Edge length of the blue noise mask (a power of two)
+#define BLUE_NOISE_SIZE 64
+
+enum SamplerType {
+	SAMPLER_RANDOM,
+	SAMPLER_STRATIFIED,
+	SAMPLER_SOBOL,
+	SAMPLER_BLUE_NOISE,
+	NUM_SAMPLER_TYPES
+};
+
+// Name of a sampler as given on the command line ("random", "stratified", "sobol", "bluenoise")
+const char *sampler_type_name(SamplerType type);
+
+// Looks up a sampler by name
+// Returns false if there's no such sampler
+bool sampler_type_from_name(const char *name, SamplerType& type);
+
+// Which sample of which pixel a path is
+typedef struct sample_id_t {
+	uint32_t x, y;
+	uint32_t index;
+} SampleId;
+
+class Sampler {
+public:
+	Sampler() : type(SAMPLER_SOBOL), seed(0), samples(1) {}
+	Sampler(SamplerType type_in, uint64_t seed_in, uint samples_in) : type(type_in), seed(seed_in), samples(samples_in ? samples_in : 1) {}
+
+	/***************
+	 * get_2d
+	 *
+	 * The point a sample draws from one of its dimensions
+	 * Inputs: id - the pixel and sample index
+	 *         dim - which dimension (see SAMPLE_DIM_PIXEL, bounce_dimension)
+	 * Outputs: u, v - the point, both in [0,1)
+	 ***************/
+	void get_2d(const SampleId& id, uint32_t dim, double& u, double& v) const;
+
+	SamplerType type;
+
+	// Frame seed, the same seed always gives the same points
+	uint64_t seed;
+
+	// Samples per pixel the stratified grid is sized for
+	// (indices past it start another shuffled pass over the grid)
+	uint samples;
+};
+
+/**************************************
+ * Warps from the unit square
+ **************************************/
+
+// Two unit vectors that make a right-handed basis with unit vector n
+// (Duff et al. 2017, no branches or divides by near-zero)
+inline void orthonormal_basis(const Vector3& n, Vector3& b1, Vector3& b2) {
+	double sign = copysign(1.0, n.z);
+	double a = -1.0 / (sign + n.z);
+	double b = n.x * n.y * a;
+	b1 = Vector3(1.0 + sign * n.x * n.x * a, sign * b, -sign * n.x);
+	b2 = Vector3(b, sign + n.y * n.y * a, -n.y);
+}
+
+// Maps (u, v) to the unit disk, keeping areas and mostly keeping
+// shapes, so stratified points stay stratified (Shirley and Chiu 1997)
+void concentric_disk(double u, double v, double& x, double& y);
+
+// Unit direction in the hemisphere around unit vector n, cosine distributed
+// (density cos / pi, see diffuse_pdf) by lifting a concentric disk point onto it
+Vector3 cosine_hemisphere(const Vector3& n, double u, double v);
+
+#endif
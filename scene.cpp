@@ -0,0 +1,484 @@
+#include <iostream>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <fcntl.h>
+#include <math.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "scene.h"
+#include "sceneFile.h"
+#include "placement.h"
+#include "utils.h"
+
+Scene::~Scene() {
+	reset();
+}
+
+void Scene::reset() {
+	world.clear();
+	file_spheres.clear();
+
+	materials.clear();
+	lights.clear();
+
+	if (NULL != mapped) munmap(mapped, mapped_size);
+	mapped = NULL;
+	mapped_size = 0;
+}
+
+uint32_t Scene::add_material(MaterialType type, const Vector3& color) {
+	materials.push_back(make_material(type, color));
+	return materials.size() - 1;
+}
+
+void Scene::generate(uint64_t seed, ThreadPool& pool, size_t num_spheres) {
+	// Start over if this scene was loaded or generated before
+	reset();
+
+	// Materials, by id:
+	uint32_t diffuse_mat = add_material(MATERIAL_DIFFUSE, Vector3(0.5,0.5,0.5));
+	add_material(MATERIAL_EMISSIVE, Vector3(1,1,1));
+	uint32_t metal_mat = add_material(MATERIAL_METAL, Vector3(0.75,0.75,0.75));
+
+	uint32_t rand_mats[4];
+	rand_mats[0] = add_material(MATERIAL_DIFFUSE, Vector3(1,0,1));
+	rand_mats[1] = add_material(MATERIAL_DIFFUSE, Vector3(1,1,0));
+	rand_mats[2] = add_material(MATERIAL_DIFFUSE, Vector3(0,1,1));
+	rand_mats[3] = add_material(MATERIAL_DIFFUSE, Vector3(1,1,1));
+
+	uint32_t rand_matse[4];
+	rand_matse[0] = add_material(MATERIAL_EMISSIVE, Vector3(1,0,1));
+	rand_matse[1] = add_material(MATERIAL_EMISSIVE, Vector3(1,1,0));
+	rand_matse[2] = add_material(MATERIAL_EMISSIVE, Vector3(0,1,1));
+	rand_matse[3] = add_material(MATERIAL_EMISSIVE, Vector3(1,1,1));
+
+	printf ("Generating %zu random non-overlapping spheres...\n", num_spheres);
+
+	// The scene gets its own stream so it only depends on the seed
+	Rng scene_rng(seed, 1);
+
+	// The default spheres cover 4.7 x 2.5 of floor in front of the camera,
+	// more of them spread further out at the same density
+	double spread = sqrt(num_spheres / (double)SCENE_SPHERES);
+	ScatterSettings scatter;
+	scatter.min = Vector3(-2.35 * spread, 0, 0.5 - 2.5 * spread);
+	scatter.max = Vector3(2.35 * spread, 0, 0.5);
+	scatter.min_radius = 0.05;
+	scatter.max_radius = 0.075;
+	scatter.on_ground = true;
+	scatter.ground_y = -0.5;
+	scatter.count = num_spheres;
+	scatter.seed = seed;
+
+	vector<PlacedSphere> placed = scatter_spheres(scatter, pool);
+	if (placed.size() < num_spheres) {
+		fprintf(stderr, "[Warning] Only found room for %zu of %zu spheres\n", placed.size(), num_spheres);
+	}
+
+	// 2 in 7 random diffuse, 2 in 7 random emissive, the rest metal,
+	// shuffled so which is which has nothing to do with where they are
+	vector<uint8_t> kinds(placed.size(), 2);
+	std::fill(kinds.begin(), kinds.begin() + placed.size() * 2 / 7, 0);
+	std::fill(kinds.begin() + placed.size() * 2 / 7, kinds.begin() + placed.size() * 4 / 7, 1);
+	for (size_t i = kinds.size(); i > 1; i--) std::swap(kinds[i - 1], kinds[scene_rng.below(i)]);
+
+	SphereSet spheres;
+	for (size_t i = 0; i < placed.size(); i++) {
+		uint32_t mat = metal_mat;
+		if (0 == kinds[i]) mat = rand_mats[scene_rng.below(4)];
+		else if (1 == kinds[i]) mat = rand_matse[scene_rng.below(4)];
+		spheres.add(placed[i].center, placed[i].radius, mat);
+	}
+	placed = vector<PlacedSphere>();
+
+	// Create some world objects:
+	spheres.add(Vector3(0,0,-1), 0.657, metal_mat);
+	spheres.add(Vector3(0,-1000.5, 0), 1000, diffuse_mat);
+
+	// Put a BVH over everything so rays only test nearby objects
+	world.build(spheres);
+	find_lights();
+}
+
+bool Scene::load(const char *path) {
+	char magic[sizeof(((SceneFileHeader*)0)->magic)] = {0};
+	FILE *file = fopen(path, "rb");
+
+	if (NULL == file) {
+		fprintf(stderr, "[Error] Couldn't open scene %s\n", path);
+		return false;
+	}
+	size_t got = fread(magic, 1, sizeof(magic), file);
+	fclose(file);
+
+	reset();
+	bool ok = (got == sizeof(magic) && 0 == memcmp(magic, SCENE_FILE_MAGIC, sizeof(SCENE_FILE_MAGIC))) ? load_binary(path) : load_text(path);
+	if (ok) find_lights();
+	else reset();
+	return ok;
+}
+
+bool Scene::load_text(const char *path) {
+	FILE *file = fopen(path, "r");
+	std::map<std::string, uint32_t> by_name;
+	char line[1024];
+	uint line_num = 0;
+
+	if (NULL == file) {
+		fprintf(stderr, "[Error] Couldn't open scene %s\n", path);
+		return false;
+	}
+
+	// Spheres are gathered up, then copied into world in BVH order
+	SphereSet spheres;
+	while (NULL != fgets(line, sizeof(line), file)) {
+		char keyword[32], name[256], type_name[32];
+		double x, y, z, r;
+		int used = 0;
+		line_num++;
+
+		// Comments and blank lines
+		char *hash = strchr(line, '#');
+		if (NULL != hash) *hash = '\0';
+		if (1 != sscanf(line, "%31s", keyword)) continue;
+
+		if (0 == strcmp(keyword, "material")) {
+			MaterialType type;
+			if (5 != sscanf(line, "%*s %255s %31s %lf %lf %lf %n", name, type_name, &x, &y, &z, &used) || '\0' != line[used]) {
+				fprintf(stderr, "[Error] %s:%u: expected material <name> <type> <r> <g> <b>\n", path, line_num);
+				goto FAIL;
+			}
+			if (!material_type_from_name(type_name, type)) {
+				fprintf(stderr, "[Error] %s:%u: unknown material type %s\n", path, line_num, type_name);
+				goto FAIL;
+			}
+			if (by_name.count(name)) {
+				fprintf(stderr, "[Error] %s:%u: material %s is already defined\n", path, line_num, name);
+				goto FAIL;
+			}
+			by_name[name] = add_material(type, Vector3(x, y, z));
+		}
+		else if (0 == strcmp(keyword, "sphere")) {
+			if (5 != sscanf(line, "%*s %lf %lf %lf %lf %255s %n", &x, &y, &z, &r, name, &used) || '\0' != line[used]) {
+				fprintf(stderr, "[Error] %s:%u: expected sphere <x> <y> <z> <radius> <material>\n", path, line_num);
+				goto FAIL;
+			}
+			if (!by_name.count(name)) {
+				fprintf(stderr, "[Error] %s:%u: unknown material %s\n", path, line_num, name);
+				goto FAIL;
+			}
+			if (!(r > 0)) {
+				fprintf(stderr, "[Error] %s:%u: sphere radius must be positive\n", path, line_num);
+				goto FAIL;
+			}
+			spheres.add(Vector3(x, y, z), r, by_name[name]);
+		}
+		else {
+			fprintf(stderr, "[Error] %s:%u: unknown keyword %s\n", path, line_num, keyword);
+			goto FAIL;
+		}
+	}
+	fclose(file);
+
+	world.build(spheres);
+	return true;
+
+FAIL:
+	fclose(file);
+	return false;
+}
+
+// Is [offset, offset + count * size) inside a file of file_size bytes, and aligned?
+static bool array_in_file(uint64_t offset, uint64_t count, uint64_t size, uint64_t file_size) {
+	return 0 == offset % SCENE_FILE_ALIGN && offset <= file_size && count <= (file_size - offset) / size;
+}
+
+bool Scene::load_binary(const char *path) {
+	struct stat info;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) {
+		fprintf(stderr, "[Error] Couldn't open scene %s\n", path);
+		return false;
+	}
+	if (0 != fstat(fd, &info) || (size_t)info.st_size < sizeof(SceneFileHeader)) {
+		fprintf(stderr, "[Error] %s is too short to be a scene file\n", path);
+		close(fd);
+		return false;
+	}
+
+	// Shared and read-only: every process rendering this scene uses the same pages
+	mapped_size = info.st_size;
+	mapped = mmap(NULL, mapped_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (MAP_FAILED == mapped) {
+		mapped = NULL;
+		fprintf(stderr, "[Error] Couldn't map scene %s\n", path);
+		return false;
+	}
+
+	const uint8_t *base = (const uint8_t*)mapped;
+	const SceneFileHeader *header = (const SceneFileHeader*)base;
+	if (SCENE_FILE_VERSION != header->version) {
+		fprintf(stderr, "[Error] %s is scene file version %u, expected %u\n", path, header->version, SCENE_FILE_VERSION);
+		return false;
+	}
+
+	uint64_t n = header->num_spheres;
+	if (!array_in_file(header->materials_offset, header->num_materials, sizeof(SceneFileMaterial), mapped_size) ||
+		!array_in_file(header->cx_offset, n, sizeof(double), mapped_size) ||
+		!array_in_file(header->cy_offset, n, sizeof(double), mapped_size) ||
+		!array_in_file(header->cz_offset, n, sizeof(double), mapped_size) ||
+		!array_in_file(header->radius_offset, n, sizeof(double), mapped_size) ||
+		!array_in_file(header->material_id_offset, n, sizeof(uint32_t), mapped_size) ||
+		!array_in_file(header->nodes_offset, header->num_nodes, sizeof(WorldGroup::BVHNode), mapped_size) ||
+		(0 != header->num_nodes && !array_in_file(header->slot_offset, n, sizeof(uint32_t), mapped_size)) ||
+		header->num_nodes > UINT32_MAX) {
+		fprintf(stderr, "[Error] %s is truncated or corrupt\n", path);
+		return false;
+	}
+
+	// The material table is the only thing that gets built
+	const SceneFileMaterial *file_materials = (const SceneFileMaterial*)(base + header->materials_offset);
+	for (uint32_t m = 0; m < header->num_materials; m++) {
+		const SceneFileMaterial& fm = file_materials[m];
+		if (fm.type >= NUM_MATERIAL_TYPES) {
+			fprintf(stderr, "[Error] %s: material %u has unknown type %u\n", path, m, fm.type);
+			return false;
+		}
+		add_material((MaterialType)fm.type, Vector3(fm.color[0], fm.color[1], fm.color[2]));
+	}
+
+	const uint32_t *material_id = (const uint32_t*)(base + header->material_id_offset);
+	for (uint64_t i = 0; i < n; i++) {
+		if (material_id[i] >= header->num_materials) {
+			fprintf(stderr, "[Error] %s: sphere %lu has no material\n", path, (unsigned long)i);
+			return false;
+		}
+	}
+
+	file_spheres.borrow(n,
+		(const double*)(base + header->cx_offset),
+		(const double*)(base + header->cy_offset),
+		(const double*)(base + header->cz_offset),
+		(const double*)(base + header->radius_offset),
+		material_id);
+
+	// No hierarchy in the file: build one (this copies the spheres)
+	if (0 == header->num_nodes) {
+		world.build(file_spheres);
+		return true;
+	}
+
+	// Check the hierarchy can be walked safely before using it as is:
+	// children come after their parent, leaves stay inside the sphere
+	// arrays, and it's no deeper than the traversal stack
+	const WorldGroup::BVHNode *nodes = (const WorldGroup::BVHNode*)(base + header->nodes_offset);
+	uint32_t num_nodes = header->num_nodes;
+	vector<uint8_t> depth(num_nodes, 0);
+	for (uint32_t i = 0; i < num_nodes; i++) {
+		const WorldGroup::BVHNode& node = nodes[i];
+		bool ok;
+		if (node.count > 0) {
+			ok = node.packed && node.offset <= n && node.count <= n - node.offset;
+		}
+		else {
+			ok = node.axis < 3 && i + 1 < num_nodes && node.offset > i + 1 && node.offset < num_nodes && depth[i] < BVH_MAX_DEPTH;
+			// A child can be shared by more than one parent: it's as deep as the deepest
+			// (every parent comes before it, so depth[i] is final by now)
+			if (ok) {
+				depth[i + 1] = std::max<uint8_t>(depth[i + 1], depth[i] + 1);
+				depth[node.offset] = std::max<uint8_t>(depth[node.offset], depth[i] + 1);
+			}
+		}
+		if (!ok) {
+			fprintf(stderr, "[Error] %s: BVH node %u is corrupt\n", path, i);
+			return false;
+		}
+	}
+
+	// Every leaf slot has exactly one source sphere
+	const uint32_t *slot_of = (const uint32_t*)(base + header->slot_offset);
+	vector<uint8_t> taken(n, 0);
+	for (uint64_t i = 0; i < n; i++) {
+		if (slot_of[i] >= n || taken[slot_of[i]]) {
+			fprintf(stderr, "[Error] %s: sphere %lu has a bad slot\n", path, (unsigned long)i);
+			return false;
+		}
+		taken[slot_of[i]] = 1;
+	}
+
+	world.attach(nodes, num_nodes, file_spheres, slot_of);
+	return true;
+}
+
+uint64_t Scene::fingerprint() const {
+	const SphereSet& spheres = world.sphere_set();
+	uint64_t count = spheres.size();
+	uint64_t hash = hash_bytes(&count, sizeof(count));
+
+	hash = hash_bytes(spheres.cx, count * sizeof(double), hash);
+	hash = hash_bytes(spheres.cy, count * sizeof(double), hash);
+	hash = hash_bytes(spheres.cz, count * sizeof(double), hash);
+	hash = hash_bytes(spheres.radius, count * sizeof(double), hash);
+	hash = hash_bytes(spheres.material_id, count * sizeof(uint32_t), hash);
+	for (const Material& material : materials) {
+		double color[3] = { material.color.x, material.color.y, material.color.z };
+		hash = hash_bytes(&material.type, sizeof(material.type), hash);
+		hash = hash_bytes(color, sizeof(color), hash);
+	}
+	return hash;
+}
+
+bool Scene::save_text(const char *path) const {
+	const SphereSet& spheres = world.sphere_set();
+	std::unordered_map<uint32_t, uint> names;
+	FILE *file = fopen(path, "w");
+	bool ok = true;
+
+	if (NULL == file) {
+		fprintf(stderr, "[Error] Couldn't open %s for writing\n", path);
+		return false;
+	}
+
+	// In the order the scene was first given, not leaf order
+	fprintf(file, "# %zu spheres\n", spheres.size());
+	for (size_t idx = 0; idx < spheres.size() && ok; idx++) {
+		size_t i = world.sphere_slot(idx);
+		uint32_t mat = spheres.material(i);
+		if (MATERIAL_NONE == mat) {
+			fprintf(stderr, "[Error] Only scenes made of spheres can be saved\n");
+			ok = false;
+			break;
+		}
+
+		// Materials are written the first time a sphere uses them
+		if (!names.count(mat)) {
+			uint name = names.size();
+			const Material& material = materials[mat];
+			names[mat] = name;
+			fprintf(file, "material m%u %s %.17g %.17g %.17g\n", name, material_type_name(material.type),
+			        material.color.x, material.color.y, material.color.z);
+		}
+		fprintf(file, "sphere %.17g %.17g %.17g %.17g m%u\n", spheres.cx[i], spheres.cy[i], spheres.cz[i], spheres.radius[i], names[mat]);
+	}
+
+	if (0 != fclose(file)) ok = false;
+	if (!ok) fprintf(stderr, "[Error] Failed writing %s\n", path);
+	return ok;
+}
+
+// Writes count elements at offset, zero padding up to it first
+static bool write_array(FILE *file, uint64_t offset, const void *data, size_t size, size_t count) {
+	static const uint8_t zeros[SCENE_FILE_ALIGN] = {0};
+	long pos = ftell(file);
+
+	if (pos < 0 || (uint64_t)pos > offset || offset - pos > sizeof(zeros)) return false;
+	if (fwrite(zeros, 1, offset - pos, file) != offset - pos) return false;
+	return 0 == count || fwrite(data, size, count, file) == count;
+}
+
+bool Scene::save_binary(const char *path, bool with_bvh) const {
+	const SphereSet& spheres = world.sphere_set();
+	size_t n = spheres.size();
+	SceneFileHeader header;
+	vector<SceneFileMaterial> file_materials;
+	vector<uint32_t> material_id(n);
+	vector<uint32_t> slot_of(n);
+	vector<double> cx, cy, cz, radius;
+	std::unordered_map<uint32_t, uint32_t> ids;
+
+	// Only spheres can be saved (every leaf has to be packed)
+	for (uint32_t i = 0; i < world.node_count(); i++) {
+		const WorldGroup::BVHNode& node = world.node_array()[i];
+		if (node.count > 0 && !node.packed) {
+			fprintf(stderr, "[Error] Only scenes made of spheres can be saved\n");
+			return false;
+		}
+	}
+
+	// Material table, in order of first use
+	for (size_t i = 0; i < n; i++) {
+		uint32_t mat = spheres.material(i);
+		auto found = ids.find(mat);
+		if (ids.end() == found) {
+			const Material& material = materials[mat];
+			SceneFileMaterial fm;
+			memset(&fm, 0, sizeof(fm));
+			fm.type = material.type;
+			fm.color[0] = material.color.x;
+			fm.color[1] = material.color.y;
+			fm.color[2] = material.color.z;
+			found = ids.emplace(mat, file_materials.size()).first;
+			file_materials.push_back(fm);
+		}
+		material_id[i] = found->second;
+	}
+
+	// With the BVH, spheres go in its leaf order along with where each one
+	// came from; without it, back in their own order
+	for (size_t idx = 0; idx < n; idx++) slot_of[idx] = world.sphere_slot(idx);
+	const double *out_cx = spheres.cx, *out_cy = spheres.cy, *out_cz = spheres.cz, *out_radius = spheres.radius;
+	if (!with_bvh) {
+		vector<uint32_t> leaf_material_id;
+		leaf_material_id.swap(material_id);
+		material_id.resize(n);
+		cx.resize(n);
+		cy.resize(n);
+		cz.resize(n);
+		radius.resize(n);
+		for (size_t idx = 0; idx < n; idx++) {
+			uint32_t slot = slot_of[idx];
+			cx[idx] = spheres.cx[slot];
+			cy[idx] = spheres.cy[slot];
+			cz[idx] = spheres.cz[slot];
+			radius[idx] = spheres.radius[slot];
+			material_id[idx] = leaf_material_id[slot];
+		}
+		out_cx = cx.data();
+		out_cy = cy.data();
+		out_cz = cz.data();
+		out_radius = radius.data();
+	}
+
+	// Lay the arrays out one after another
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SCENE_FILE_MAGIC, sizeof(SCENE_FILE_MAGIC));
+	header.version = SCENE_FILE_VERSION;
+	header.num_materials = file_materials.size();
+	header.num_spheres = n;
+	header.num_nodes = with_bvh ? world.node_count() : 0;
+	header.materials_offset = scene_file_align(sizeof(header));
+	header.cx_offset = scene_file_align(header.materials_offset + header.num_materials * sizeof(SceneFileMaterial));
+	header.cy_offset = scene_file_align(header.cx_offset + n * sizeof(double));
+	header.cz_offset = scene_file_align(header.cy_offset + n * sizeof(double));
+	header.radius_offset = scene_file_align(header.cz_offset + n * sizeof(double));
+	header.material_id_offset = scene_file_align(header.radius_offset + n * sizeof(double));
+	header.nodes_offset = scene_file_align(header.material_id_offset + n * sizeof(uint32_t));
+	header.slot_offset = with_bvh ? scene_file_align(header.nodes_offset + header.num_nodes * sizeof(WorldGroup::BVHNode)) : 0;
+
+	FILE *file = fopen(path, "wb");
+	if (NULL == file) {
+		fprintf(stderr, "[Error] Couldn't open %s for writing\n", path);
+		return false;
+	}
+
+	bool ok = write_array(file, 0, &header, sizeof(header), 1) &&
+			  write_array(file, header.materials_offset, file_materials.data(), sizeof(SceneFileMaterial), file_materials.size()) &&
+			  write_array(file, header.cx_offset, out_cx, sizeof(double), n) &&
+			  write_array(file, header.cy_offset, out_cy, sizeof(double), n) &&
+			  write_array(file, header.cz_offset, out_cz, sizeof(double), n) &&
+			  write_array(file, header.radius_offset, out_radius, sizeof(double), n) &&
+			  write_array(file, header.material_id_offset, material_id.data(), sizeof(uint32_t), n) &&
+			  write_array(file, header.nodes_offset, world.node_array(), sizeof(WorldGroup::BVHNode), header.num_nodes) &&
+			  (!with_bvh || write_array(file, header.slot_offset, slot_of.data(), sizeof(uint32_t), n));
+
+	if (0 != fclose(file)) ok = false;
+	if (!ok) fprintf(stderr, "[Error] Failed writing %s\n", path);
+	return ok;
+}
@@ -0,0 +1,91 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "worldObject.h"
+#include "sphereSet.h"
+#include "material.h"
+#include "lights.h"
+#include "threadpool.h"
+
+using std::vector;
+
+// Random spheres in the generated scene
+#define SCENE_SPHERES 175
+
+// Everything a frame is rendered from: the spheres, the table of
+// materials their ids index into, and the BVH over them
+// world points at the table, so it has to outlive every render using world
+class Scene {
+public:
+	Scene() : mapped(NULL), mapped_size(0) { world.materials = &materials; world.lights = &lights; }
+	~Scene();
+
+	// Builds the default random scene for a frame seed, with num_spheres
+	// small spheres scattered over the floor (see scatter_spheres)
+	// The same seed and count always give the same scene
+	void generate(uint64_t seed, ThreadPool& pool, size_t num_spheres = SCENE_SPHERES);
+
+	/**************************************
+	 * load
+	 *
+	 * Loads a scene file: either a compiled one (see sceneFile.h),
+	 * which is mapped and traced in place, or a text description:
+	 *
+	 *   # comment
+	 *   material <name> <diffuse|metal|emissive> <r> <g> <b>
+	 *   sphere <x> <y> <z> <radius> <material name>
+	 *
+	 * Returns true on success, false on failure (and prints why)
+	 **************************************/
+	bool load(const char *path);
+
+	// Writes the scene as a text description
+	// Returns true on success, false on failure
+	bool save_text(const char *path) const;
+
+	// Compiles the scene to a binary scene file, with its BVH unless with_bvh is false
+	// Returns true on success, false on failure
+	bool save_binary(const char *path, bool with_bvh) const;
+
+	// Hash of the spheres and materials, the same for the same scene
+	// however it was built or loaded (lets processes check they agree)
+	uint64_t fingerprint() const;
+
+	// Finds the lights again, after spheres have moved (generate() and
+	// load() find them on their own)
+	void find_lights() { lights.build(world); }
+
+	// Root of the scene, ready to trace once generate() or load() returns
+	WorldGroup world;
+
+private:
+	// world points into these, so no copies
+	Scene(const Scene&);
+	Scene& operator=(const Scene&);
+
+	// Drops everything, back to an empty scene
+	void reset();
+
+	bool load_text(const char *path);
+	bool load_binary(const char *path);
+
+	// Appends a material to the table, returns its id
+	uint32_t add_material(MaterialType type, const Vector3& color);
+
+	// Every material in the scene, by id
+	MaterialTable materials;
+
+	// Its emissive spheres (world points at these too)
+	LightList lights;
+
+	// A compiled scene file mapped into memory (NULL if there is none)
+	// file_spheres borrows its arrays, and world may borrow its hierarchy
+	void *mapped;
+	size_t mapped_size;
+	SphereSet file_spheres;
+};
+
+#endif
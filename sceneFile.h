@@ -0,0 +1,68 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "worldObject.h"
+
+/**************************************
+ * Compiled scene files
+ *
+ * A scene description compiled down to the exact arrays the tracer
+ * uses, so loading one is just mapping it into memory:
+ *
+ *   SceneFileHeader
+ *   SceneFileMaterial[num_materials]
+ *   double cx[num_spheres], cy[...], cz[...], radius[...]
+ *   uint32_t material_id[num_spheres]
+ *   WorldGroup::BVHNode[num_nodes]   (optional, spheres are in its leaf order)
+ *   uint32_t slot[num_spheres]       (with the BVH: where each sphere of the
+ *                                     source scene, in its order, ended up)
+ *
+ * Without a BVH the spheres are in the order the source scene lists
+ * them, so either way sphere N is the same sphere as in the source
+ * (see WorldGroup::sphere_slot, which animations number spheres by).
+ *
+ * Every array starts on a SCENE_FILE_ALIGN boundary, at the offset
+ * the header gives for it. Files are native-endian, and meant to be
+ * read on the same kind of machine that compiled them.
+ **************************************/
+
+#define SCENE_FILE_MAGIC "RTSCENE"
+#define SCENE_FILE_VERSION 2
+#define SCENE_FILE_ALIGN 64
+
+typedef struct scene_file_header_t {
+	// SCENE_FILE_MAGIC, NUL padded
+	char magic[8];
+	uint32_t version;
+
+	uint32_t num_materials;
+	uint64_t num_spheres;
+
+	// 0 if no hierarchy was saved (it gets built at load time)
+	uint64_t num_nodes;
+
+	// Byte offset of each array from the start of the file
+	uint64_t materials_offset;
+	uint64_t cx_offset, cy_offset, cz_offset;
+	uint64_t radius_offset;
+	uint64_t material_id_offset;
+	uint64_t nodes_offset;
+	uint64_t slot_offset;
+} SceneFileHeader;
+
+typedef struct scene_file_material_t {
+	// MaterialType
+	uint32_t type;
+	uint32_t reserved;
+	double color[3];
+} SceneFileMaterial;
+
+// Rounds a file offset up to the next array boundary
+inline uint64_t scene_file_align(uint64_t offset) {
+	return (offset + SCENE_FILE_ALIGN - 1) & ~(uint64_t)(SCENE_FILE_ALIGN - 1);
+}
+
+#endif
@@ -32,7 +32,9 @@ bool Sphere::hit(const Ray& ray, double t_min, double t_max, CollisionPoint& poi
 		// closest_t is a good t value now
 		point.pos = ray.at(closest_t);
 		point.normal = (point.pos - center) / radius; // Normalized normal vector
-		point.t_collision = closest_t;		
+		point.t_collision = closest_t;
+		point.material_id = material_id;
+		point.object = OBJECT_NONE;
 		return true;
 	}
 
@@ -43,3 +45,9 @@ BAD_COLLISION:
 	point.t_collision = -1;
 	return false;
 }
+
+// Sphere bounding box is just the cube around it
+AABB Sphere::bounding_box() const {
+	Vector3 extent = Vector3(radius, radius, radius);
+	return AABB(center - extent, center + extent);
+}
@@ -6,10 +6,11 @@
 
 class Sphere : public WorldObject {
 public:
-	Sphere(const Vector3 center_in, double radius_in, Material& material_in) : WorldObject(material_in), center(center_in), radius(radius_in) {}
+	Sphere(const Vector3 center_in, double radius_in, uint32_t material_id_in) : WorldObject(material_id_in), center(center_in), radius(radius_in) {}
 
 	// Extend WorldObject hit method:
 	virtual bool hit(const Ray& ray, double t_min, double t_max, CollisionPoint& point) const;
+	virtual AABB bounding_box() const;
 
 	Vector3 center;
 	double radius;
@@ -0,0 +1,323 @@
+#include <string.h>
+#include <limits>
+
+#include "sphereSet.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SPHERE_SET_X86 1
+#endif
+
+void SphereSet::clear() {
+	count = 0;
+	own_cx.clear();
+	own_cy.clear();
+	own_cz.clear();
+	own_radius.clear();
+	own_material_id.clear();
+	use_own();
+}
+
+void SphereSet::add(const Vector3& center, double radius_in, uint32_t material_id_in) {
+	own_cx.push_back(center.x);
+	own_cy.push_back(center.y);
+	own_cz.push_back(center.z);
+	own_radius.push_back(radius_in);
+	own_material_id.push_back(material_id_in);
+	count++;
+	use_own();
+}
+
+void SphereSet::borrow(size_t count_in, const double *cx_in, const double *cy_in, const double *cz_in, const double *radius_in,
+                       const uint32_t *material_id_in) {
+	clear();
+	count = count_in;
+	cx = cx_in;
+	cy = cy_in;
+	cz = cz_in;
+	radius = radius_in;
+	material_id = material_id_in;
+}
+
+void SphereSet::borrow(const SphereSet& other) {
+	borrow(other.count, other.cx, other.cy, other.cz, other.radius, other.material_id);
+}
+
+void SphereSet::own() {
+	if (own_cx.size() == count) return;
+	own_cx.assign(cx, cx + count);
+	own_cy.assign(cy, cy + count);
+	own_cz.assign(cz, cz + count);
+	own_radius.assign(radius, radius + count);
+	own_material_id.assign(material_id, material_id + count);
+	use_own();
+}
+
+void SphereSet::move(size_t idx, const Vector3& center, double radius_in) {
+	own_cx[idx] = center.x;
+	own_cy[idx] = center.y;
+	own_cz[idx] = center.z;
+	own_radius[idx] = radius_in;
+}
+
+void SphereSet::use_own() {
+	cx = own_cx.data();
+	cy = own_cy.data();
+	cz = own_cz.data();
+	radius = own_radius.data();
+	material_id = own_material_id.data();
+}
+
+// Same math as Sphere::hit, so both agree on what (and where) was hit
+void SphereSet::fill_point(size_t idx, const Ray& ray, double t, CollisionPoint& point) const {
+	Vector3 center = Vector3(cx[idx], cy[idx], cz[idx]);
+	point.pos = ray.at(t);
+	point.normal = (point.pos - center) / radius[idx];
+	point.t_collision = t;
+	point.material_id = material_id[idx];
+	point.object = idx;
+}
+
+/**************************************
+ * Kernels
+ *
+ * Every kernel evaluates the quadratic from Sphere::hit with the
+ * operations in exactly the same order, so the scalar and SIMD
+ * paths round identically and always report the same hit.
+ * (This is also why the build turns off FMA contraction.)
+ *
+ * Lanes are checked in order and a lane wins ties, just like the
+ * scalar loop where a later sphere at the same distance replaces
+ * an earlier one.
+ **************************************/
+typedef long (*sphere_kernel_t)(const SphereSet& set, const Ray& ray, size_t first, size_t count, double t_min, double& t_max);
+
+static long hit_scalar(const SphereSet& set, const Ray& ray, size_t first, size_t count, double t_min, double& t_max) {
+	long best = -1;
+	double a = dot(ray.dir, ray.dir);
+	double four_a = 4 * a;
+	double twice_a = 2.0 * a;
+
+	for (size_t i = first; i < first + count; i++) {
+		Vector3 oc = Vector3(ray.pos.x - set.cx[i], ray.pos.y - set.cy[i], ray.pos.z - set.cz[i]);
+		double b = 2.0 * dot(ray.dir, oc);
+		double c = dot(oc, oc) - (set.radius[i] * set.radius[i]);
+		double inside_sqrt = b * b - four_a * c;
+		if (inside_sqrt > 0) {
+			double root = sqrt(inside_sqrt);
+			double t = ((-1.0 * b) - root) / twice_a;
+			if (t < t_min || t > t_max) {
+				t = ((-1.0 * b) + root) / twice_a;
+				if (t < t_min || t > t_max) continue;
+			}
+			t_max = t;
+			best = i;
+		}
+	}
+	return best;
+}
+
+#ifdef SPHERE_SET_X86
+
+// Picks the winner out of one register's worth of lanes
+// valid has one bit per lane that hit inside the interval
+static inline long pick_lane(const double *lane_t, unsigned valid, size_t base, long best, double& t_max) {
+	for (uint lane = 0; valid; lane++, valid >>= 1) {
+		if ((valid & 1) && lane_t[lane] <= t_max) {
+			t_max = lane_t[lane];
+			best = base + lane;
+		}
+	}
+	return best;
+}
+
+__attribute__((target("sse2")))
+static long hit_sse2(const SphereSet& set, const Ray& ray, size_t first, size_t count, double t_min, double& t_max) {
+	long best = -1;
+	size_t i = first, end = first + count;
+	double a = dot(ray.dir, ray.dir);
+
+	__m128d ox = _mm_set1_pd(ray.pos.x), oy = _mm_set1_pd(ray.pos.y), oz = _mm_set1_pd(ray.pos.z);
+	__m128d dx = _mm_set1_pd(ray.dir.x), dy = _mm_set1_pd(ray.dir.y), dz = _mm_set1_pd(ray.dir.z);
+	__m128d four_a = _mm_set1_pd(4 * a), twice_a = _mm_set1_pd(2.0 * a);
+	__m128d two = _mm_set1_pd(2.0), neg_one = _mm_set1_pd(-1.0), zero = _mm_setzero_pd();
+	__m128d tmin = _mm_set1_pd(t_min);
+	alignas(16) double lane_t[2];
+
+	for (; i + 2 <= end; i += 2) {
+		__m128d tmax = _mm_set1_pd(t_max);
+		__m128d ocx = _mm_sub_pd(ox, _mm_loadu_pd(&set.cx[i]));
+		__m128d ocy = _mm_sub_pd(oy, _mm_loadu_pd(&set.cy[i]));
+		__m128d ocz = _mm_sub_pd(oz, _mm_loadu_pd(&set.cz[i]));
+		__m128d r = _mm_loadu_pd(&set.radius[i]);
+
+		__m128d b = _mm_mul_pd(two, _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, ocx), _mm_mul_pd(dy, ocy)), _mm_mul_pd(dz, ocz)));
+		__m128d c = _mm_sub_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, ocx), _mm_mul_pd(ocy, ocy)), _mm_mul_pd(ocz, ocz)), _mm_mul_pd(r, r));
+		__m128d disc = _mm_sub_pd(_mm_mul_pd(b, b), _mm_mul_pd(four_a, c));
+
+		__m128d root = _mm_sqrt_pd(disc);
+		__m128d neg_b = _mm_mul_pd(neg_one, b);
+		__m128d t0 = _mm_div_pd(_mm_sub_pd(neg_b, root), twice_a);
+		__m128d t1 = _mm_div_pd(_mm_add_pd(neg_b, root), twice_a);
+
+		__m128d ok0 = _mm_and_pd(_mm_cmpge_pd(t0, tmin), _mm_cmple_pd(t0, tmax));
+		__m128d ok1 = _mm_and_pd(_mm_cmpge_pd(t1, tmin), _mm_cmple_pd(t1, tmax));
+		__m128d t = _mm_or_pd(_mm_and_pd(ok0, t0), _mm_andnot_pd(ok0, t1));
+		__m128d valid = _mm_and_pd(_mm_cmpgt_pd(disc, zero), _mm_or_pd(ok0, ok1));
+
+		unsigned mask = _mm_movemask_pd(valid);
+		if (mask) {
+			_mm_store_pd(lane_t, t);
+			best = pick_lane(lane_t, mask, i, best, t_max);
+		}
+	}
+
+	long tail = hit_scalar(set, ray, i, end - i, t_min, t_max);
+	return (tail >= 0) ? tail : best;
+}
+
+__attribute__((target("avx2")))
+static long hit_avx2(const SphereSet& set, const Ray& ray, size_t first, size_t count, double t_min, double& t_max) {
+	long best = -1;
+	size_t i = first, end = first + count;
+	double a = dot(ray.dir, ray.dir);
+
+	__m256d ox = _mm256_set1_pd(ray.pos.x), oy = _mm256_set1_pd(ray.pos.y), oz = _mm256_set1_pd(ray.pos.z);
+	__m256d dx = _mm256_set1_pd(ray.dir.x), dy = _mm256_set1_pd(ray.dir.y), dz = _mm256_set1_pd(ray.dir.z);
+	__m256d four_a = _mm256_set1_pd(4 * a), twice_a = _mm256_set1_pd(2.0 * a);
+	__m256d two = _mm256_set1_pd(2.0), neg_one = _mm256_set1_pd(-1.0), zero = _mm256_setzero_pd();
+	__m256d tmin = _mm256_set1_pd(t_min);
+	alignas(32) double lane_t[4];
+
+	for (; i + 4 <= end; i += 4) {
+		__m256d tmax = _mm256_set1_pd(t_max);
+		__m256d ocx = _mm256_sub_pd(ox, _mm256_loadu_pd(&set.cx[i]));
+		__m256d ocy = _mm256_sub_pd(oy, _mm256_loadu_pd(&set.cy[i]));
+		__m256d ocz = _mm256_sub_pd(oz, _mm256_loadu_pd(&set.cz[i]));
+		__m256d r = _mm256_loadu_pd(&set.radius[i]);
+
+		__m256d b = _mm256_mul_pd(two, _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, ocx), _mm256_mul_pd(dy, ocy)), _mm256_mul_pd(dz, ocz)));
+		__m256d c = _mm256_sub_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)), _mm256_mul_pd(ocz, ocz)), _mm256_mul_pd(r, r));
+		__m256d disc = _mm256_sub_pd(_mm256_mul_pd(b, b), _mm256_mul_pd(four_a, c));
+
+		__m256d root = _mm256_sqrt_pd(disc);
+		__m256d neg_b = _mm256_mul_pd(neg_one, b);
+		__m256d t0 = _mm256_div_pd(_mm256_sub_pd(neg_b, root), twice_a);
+		__m256d t1 = _mm256_div_pd(_mm256_add_pd(neg_b, root), twice_a);
+
+		__m256d ok0 = _mm256_and_pd(_mm256_cmp_pd(t0, tmin, _CMP_GE_OQ), _mm256_cmp_pd(t0, tmax, _CMP_LE_OQ));
+		__m256d ok1 = _mm256_and_pd(_mm256_cmp_pd(t1, tmin, _CMP_GE_OQ), _mm256_cmp_pd(t1, tmax, _CMP_LE_OQ));
+		__m256d t = _mm256_blendv_pd(t1, t0, ok0);
+		__m256d valid = _mm256_and_pd(_mm256_cmp_pd(disc, zero, _CMP_GT_OQ), _mm256_or_pd(ok0, ok1));
+
+		unsigned mask = _mm256_movemask_pd(valid);
+		if (mask) {
+			_mm256_store_pd(lane_t, t);
+			best = pick_lane(lane_t, mask, i, best, t_max);
+		}
+	}
+
+	long tail = hit_scalar(set, ray, i, end - i, t_min, t_max);
+	return (tail >= 0) ? tail : best;
+}
+
+__attribute__((target("avx512f")))
+static long hit_avx512(const SphereSet& set, const Ray& ray, size_t first, size_t count, double t_min, double& t_max) {
+	long best = -1;
+	size_t i = first, end = first + count;
+	double a = dot(ray.dir, ray.dir);
+
+	__m512d ox = _mm512_set1_pd(ray.pos.x), oy = _mm512_set1_pd(ray.pos.y), oz = _mm512_set1_pd(ray.pos.z);
+	__m512d dx = _mm512_set1_pd(ray.dir.x), dy = _mm512_set1_pd(ray.dir.y), dz = _mm512_set1_pd(ray.dir.z);
+	__m512d four_a = _mm512_set1_pd(4 * a), twice_a = _mm512_set1_pd(2.0 * a);
+	__m512d two = _mm512_set1_pd(2.0), neg_one = _mm512_set1_pd(-1.0), zero = _mm512_setzero_pd();
+	__m512d tmin = _mm512_set1_pd(t_min);
+	alignas(64) double lane_t[8];
+
+	for (; i + 8 <= end; i += 8) {
+		__m512d tmax = _mm512_set1_pd(t_max);
+		__m512d ocx = _mm512_sub_pd(ox, _mm512_loadu_pd(&set.cx[i]));
+		__m512d ocy = _mm512_sub_pd(oy, _mm512_loadu_pd(&set.cy[i]));
+		__m512d ocz = _mm512_sub_pd(oz, _mm512_loadu_pd(&set.cz[i]));
+		__m512d r = _mm512_loadu_pd(&set.radius[i]);
+
+		__m512d b = _mm512_mul_pd(two, _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx, ocx), _mm512_mul_pd(dy, ocy)), _mm512_mul_pd(dz, ocz)));
+		__m512d c = _mm512_sub_pd(_mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, ocx), _mm512_mul_pd(ocy, ocy)), _mm512_mul_pd(ocz, ocz)), _mm512_mul_pd(r, r));
+		__m512d disc = _mm512_sub_pd(_mm512_mul_pd(b, b), _mm512_mul_pd(four_a, c));
+
+		__m512d root = _mm512_sqrt_pd(disc);
+		__m512d neg_b = _mm512_mul_pd(neg_one, b);
+		__m512d t0 = _mm512_div_pd(_mm512_sub_pd(neg_b, root), twice_a);
+		__m512d t1 = _mm512_div_pd(_mm512_add_pd(neg_b, root), twice_a);
+
+		__mmask8 ok0 = _mm512_cmp_pd_mask(t0, tmin, _CMP_GE_OQ) & _mm512_cmp_pd_mask(t0, tmax, _CMP_LE_OQ);
+		__mmask8 ok1 = _mm512_cmp_pd_mask(t1, tmin, _CMP_GE_OQ) & _mm512_cmp_pd_mask(t1, tmax, _CMP_LE_OQ);
+		__m512d t = _mm512_mask_blend_pd(ok0, t1, t0);
+		unsigned mask = _mm512_cmp_pd_mask(disc, zero, _CMP_GT_OQ) & (ok0 | ok1);
+
+		if (mask) {
+			_mm512_store_pd(lane_t, t);
+			best = pick_lane(lane_t, mask, i, best, t_max);
+		}
+	}
+
+	long tail = hit_scalar(set, ray, i, end - i, t_min, t_max);
+	return (tail >= 0) ? tail : best;
+}
+
+#endif
+
+// Every kernel, widest first
+static const struct {
+	const char *name;
+	const char *cpu_feature; // NULL if every CPU can run it
+	sphere_kernel_t fn;
+} sphere_kernels[] = {
+#ifdef SPHERE_SET_X86
+	{ "avx512", "avx512f", hit_avx512 },
+	{ "avx2", "avx2", hit_avx2 },
+	{ "sse2", "sse2", hit_sse2 },
+#endif
+	{ "scalar", NULL, hit_scalar },
+};
+
+#define NUM_SPHERE_KERNELS ((sizeof(sphere_kernels) / sizeof(sphere_kernels[0])))
+
+static bool cpu_supports(const char *feature) {
+	if (NULL == feature) return true;
+#ifdef SPHERE_SET_X86
+	__builtin_cpu_init();
+	if (0 == strcmp(feature, "avx512f")) return __builtin_cpu_supports("avx512f");
+	if (0 == strcmp(feature, "avx2")) return __builtin_cpu_supports("avx2");
+	if (0 == strcmp(feature, "sse2")) return __builtin_cpu_supports("sse2");
+#endif
+	return false;
+}
+
+// Index into sphere_kernels of the kernel in use
+static size_t &active_kernel() {
+	static size_t active = [] {
+		size_t k = 0;
+		while (!cpu_supports(sphere_kernels[k].cpu_feature)) k++;
+		return k;
+	}();
+	return active;
+}
+
+long SphereSet::hit(const Ray& ray, size_t first, size_t count, double t_min, double& t_max) const {
+	return sphere_kernels[active_kernel()].fn(*this, ray, first, count, t_min, t_max);
+}
+
+const char *sphere_kernel_name() {
+	return sphere_kernels[active_kernel()].name;
+}
+
+bool set_sphere_kernel(const char *name) {
+	for (size_t k = 0; k < NUM_SPHERE_KERNELS; k++) {
+		if (0 == strcmp(name, sphere_kernels[k].name) && cpu_supports(sphere_kernels[k].cpu_feature)) {
+			active_kernel() = k;
+			return true;
+		}
+	}
+	return false;
+}
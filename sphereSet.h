@@ -0,0 +1,91 @@
+#ifndef SPHERE_SET_H
+#define SPHERE_SET_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <vector>
+
+#include "vector.h"
+#include "material.h"
+#include "CollisionPoint.h"
+
+using std::vector;
+
+// Spheres packed as structure-of-arrays, so one ray can be tested
+// against a whole SIMD register's worth of spheres at a time
+// The widest kernel the CPU supports (AVX-512, AVX2, SSE2 or plain
+// scalar code) is picked the first time hit() runs
+class SphereSet {
+public:
+	SphereSet() { clear(); }
+
+	void clear();
+	void add(const Vector3& center, double radius, uint32_t material_id);
+
+	// Uses arrays that live somewhere else (like a mapped scene file)
+	// in place of its own copies; they have to outlive this set
+	// Call clear() before adding to a borrowed set
+	void borrow(size_t count_in, const double *cx_in, const double *cy_in, const double *cz_in, const double *radius_in,
+	            const uint32_t *material_id_in);
+
+	// Borrows whatever other is using (its own arrays or borrowed ones)
+	void borrow(const SphereSet& other);
+
+	// Copies borrowed arrays into its own storage, so spheres can be moved
+	void own();
+
+	// Moves (and resizes) sphere idx
+	// The set has to be using its own arrays (see own())
+	void move(size_t idx, const Vector3& center, double radius_in);
+
+	size_t size() const { return count; }
+
+	// Material id of sphere idx
+	uint32_t material(size_t idx) const { return material_id[idx]; }
+
+	/**************************************
+	 * hit
+	 *
+	 * Tests a ray against spheres [first, first+count) and finds the
+	 * closest hit inside [t_min, t_max], exactly like calling
+	 * Sphere::hit on each of them in turn would.
+	 *
+	 * Returns the index of the sphere hit (and shrinks t_max to the
+	 * hit distance), or -1 if nothing was hit
+	 **************************************/
+	long hit(const Ray& ray, size_t first, size_t count, double t_min, double& t_max) const;
+
+	// Fills in the collision point for sphere idx hit at distance t
+	void fill_point(size_t idx, const Ray& ray, double t, CollisionPoint& point) const;
+
+	// Centers and radii, one array per component (its own or borrowed)
+	const double *cx, *cy, *cz;
+	const double *radius;
+
+	// Each sphere's material, as an index into the scene's MaterialTable
+	const uint32_t *material_id;
+
+private:
+	// The arrays point into each other's storage, so no copies
+	SphereSet(const SphereSet&);
+	SphereSet& operator=(const SphereSet&);
+
+	// Points the arrays back at our own storage
+	void use_own();
+
+	size_t count;
+
+	// Storage for spheres added with add()
+	vector<double> own_cx, own_cy, own_cz;
+	vector<double> own_radius;
+	vector<uint32_t> own_material_id;
+};
+
+// Name of the kernel hit() is using ("avx512", "avx2", "sse2" or "scalar")
+const char *sphere_kernel_name();
+
+// Forces a particular kernel (by name), mostly for testing and benchmarks
+// Returns false if the name is unknown or the CPU can't run it
+bool set_sphere_kernel(const char *name);
+
+#endif
@@ -0,0 +1,132 @@
+#include <string.h>
+#include <mutex>
+#include <vector>
+
+#include "stats.h"
+
+static const char *path_end_names[NUM_PATH_ENDS] = { "sky", "emissive", "depth_cap", "roulette" };
+
+void stats_add(RenderStats& into, const RenderStats& from) {
+	into.paths += from.paths;
+	into.rays += from.rays;
+	into.shadow_rays += from.shadow_rays;
+	into.nodes_visited += from.nodes_visited;
+	into.object_tests += from.object_tests;
+	for (int i = 0; i < NUM_PATH_ENDS; i++) into.path_ends[i] += from.path_ends[i];
+	for (int i = 0; i < STATS_DEPTH_BINS; i++) into.depth[i] += from.depth[i];
+}
+
+#ifdef RAYTRACE_STATS
+
+// Every live thread's counters, plus whatever threads that have exited counted
+static std::mutex registry_lock;
+static std::vector<ThreadStats*> registry;
+static RenderStats retired;
+
+ThreadStats::ThreadStats() {
+	memset(&stats, 0, sizeof(stats));
+	std::lock_guard<std::mutex> guard(registry_lock);
+	registry.push_back(this);
+}
+
+ThreadStats::~ThreadStats() {
+	std::lock_guard<std::mutex> guard(registry_lock);
+	stats_add(retired, stats);
+	for (size_t i = 0; i < registry.size(); i++) {
+		if (registry[i] == this) {
+			registry[i] = registry.back();
+			registry.pop_back();
+			break;
+		}
+	}
+}
+
+void stats_reset() {
+	std::lock_guard<std::mutex> guard(registry_lock);
+	memset(&retired, 0, sizeof(retired));
+	for (ThreadStats *local : registry) memset(&local->stats, 0, sizeof(local->stats));
+}
+
+RenderStats stats_collect() {
+	RenderStats total;
+	memset(&total, 0, sizeof(total));
+
+	std::lock_guard<std::mutex> guard(registry_lock);
+	stats_add(total, retired);
+	for (ThreadStats *local : registry) stats_add(total, local->stats);
+	return total;
+}
+
+#else
+
+void stats_reset() {}
+
+RenderStats stats_collect() {
+	RenderStats total;
+	memset(&total, 0, sizeof(total));
+	return total;
+}
+
+#endif
+
+// a / b, or 0 if there's nothing to divide by
+static double ratio(uint64_t a, uint64_t b) {
+	return (0 == b) ? 0.0 : (double)a / b;
+}
+
+// Deepest depth bin with anything in it
+static int last_depth(const RenderStats& stats) {
+	int last = 0;
+	for (int i = 0; i < STATS_DEPTH_BINS; i++) {
+		if (stats.depth[i] > 0) last = i;
+	}
+	return last;
+}
+
+void stats_print(const RenderStats& stats, FILE *file) {
+	fprintf(file, "Paths: %llu (%.2f per pixel)\n", (unsigned long long)stats.paths, ratio(stats.paths, stats.pixels));
+	fprintf(file, "Rays: %llu (%.2f per pixel, %.2f per path)\n", (unsigned long long)stats.rays,
+	        ratio(stats.rays, stats.pixels), ratio(stats.rays, stats.paths));
+	fprintf(file, "Shadow rays: %llu (%.2f per pixel)\n", (unsigned long long)stats.shadow_rays, ratio(stats.shadow_rays, stats.pixels));
+	fprintf(file, "BVH nodes visited: %.2f per ray\n", ratio(stats.nodes_visited, stats.rays + stats.shadow_rays));
+	fprintf(file, "Object tests: %.2f per ray\n", ratio(stats.object_tests, stats.rays + stats.shadow_rays));
+
+	fprintf(file, "Paths ended:");
+	for (int i = 0; i < NUM_PATH_ENDS; i++) {
+		fprintf(file, " %s %.1f%%", path_end_names[i], 100.0 * ratio(stats.path_ends[i], stats.paths));
+	}
+	fprintf(file, "\nBounces per path:\n");
+	for (int i = 0; i <= last_depth(stats); i++) {
+		fprintf(file, "  %2d%s %6.2f%%\n", i, (STATS_DEPTH_BINS - 1 == i) ? "+" : " ", 100.0 * ratio(stats.depth[i], stats.paths));
+	}
+}
+
+bool stats_write_json(const RenderStats& stats, const char *path) {
+	FILE *file = fopen(path, "w");
+
+	if (NULL == file) {
+		fprintf(stderr, "[Error] Couldn't open %s for writing\n", path);
+		return false;
+	}
+
+	fprintf(file, "{\n");
+	fprintf(file, "  \"pixels\": %llu,\n", (unsigned long long)stats.pixels);
+	fprintf(file, "  \"paths\": %llu,\n", (unsigned long long)stats.paths);
+	fprintf(file, "  \"rays\": %llu,\n", (unsigned long long)stats.rays);
+	fprintf(file, "  \"rays_per_pixel\": %.4f,\n", ratio(stats.rays, stats.pixels));
+	fprintf(file, "  \"shadow_rays\": %llu,\n", (unsigned long long)stats.shadow_rays);
+	fprintf(file, "  \"nodes_visited\": %llu,\n", (unsigned long long)stats.nodes_visited);
+	fprintf(file, "  \"object_tests\": %llu,\n", (unsigned long long)stats.object_tests);
+	fprintf(file, "  \"object_tests_per_ray\": %.4f,\n", ratio(stats.object_tests, stats.rays + stats.shadow_rays));
+	fprintf(file, "  \"path_ends\": {");
+	for (int i = 0; i < NUM_PATH_ENDS; i++) {
+		fprintf(file, "%s\"%s\": %llu", (i > 0) ? ", " : "", path_end_names[i], (unsigned long long)stats.path_ends[i]);
+	}
+	fprintf(file, "},\n  \"bounce_histogram\": [");
+	for (int i = 0; i <= last_depth(stats); i++) {
+		fprintf(file, "%s%llu", (i > 0) ? ", " : "", (unsigned long long)stats.depth[i]);
+	}
+	fprintf(file, "]\n}\n");
+
+	return 0 == fclose(file);
+}
@@ -0,0 +1,105 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**************************************
+ * Render statistics
+ *
+ * Counters for where render time goes: rays traced, BVH nodes and
+ * objects tested per ray, how deep paths get and how they end.
+ * Each thread counts into its own RenderStats, so the hot paths never
+ * share a cache line; stats_collect() adds them all up afterwards.
+ *
+ * Only built with RAYTRACE_STATS (`make STATS=1`). Without it every
+ * STAT_ macro is empty and nothing is ever counted.
+ **************************************/
+
+// Paths are binned by bounces taken, anything deeper lands in the last bin
+#define STATS_DEPTH_BINS 64
+
+// How a path ended
+enum PathEnd {
+	PATH_SKY,       // Missed everything
+	PATH_EMISSIVE,  // Hit a light (or anything else that stops scattering)
+	PATH_DEPTH_CAP, // Ran out of bounces
+	PATH_ROULETTE,  // Lost at Russian roulette
+	NUM_PATH_ENDS
+};
+
+typedef struct render_stats_t {
+	// Camera paths started
+	uint64_t paths;
+
+	// Rays traced through the world, camera rays and bounces
+	uint64_t rays;
+
+	// Shadow rays traced towards sampled lights
+	uint64_t shadow_rays;
+
+	// BVH nodes visited and objects tested for intersection, shadow rays included
+	// (a ray packet visiting a node counts as one visit)
+	uint64_t nodes_visited;
+	uint64_t object_tests;
+
+	// Paths by how they ended, and by how many bounces they took
+	uint64_t path_ends[NUM_PATH_ENDS];
+	uint64_t depth[STATS_DEPTH_BINS];
+
+	// Pixels in the frame (filled in by render, not counted)
+	uint64_t pixels;
+} RenderStats;
+
+// Adds the counters of from to into
+void stats_add(RenderStats& into, const RenderStats& from);
+
+// Zeroes every thread's counters
+void stats_reset();
+
+// Sum of every thread's counters since the last stats_reset()
+// Only call while no render is running
+RenderStats stats_collect();
+
+// Prints a summary to file
+void stats_print(const RenderStats& stats, FILE *file);
+
+// Writes the stats out as JSON
+// Returns true on success, false on failure
+bool stats_write_json(const RenderStats& stats, const char *path);
+
+#ifdef RAYTRACE_STATS
+
+// One thread's counters, registered so stats_collect() can find them
+class ThreadStats {
+public:
+	ThreadStats();
+	~ThreadStats();
+
+	RenderStats stats;
+};
+
+// The counters of the calling thread
+inline RenderStats& thread_stats() {
+	static thread_local ThreadStats local;
+	return local.stats;
+}
+
+#define STATS_ENABLED 1
+#define STAT_ADD(counter, n) (thread_stats().counter += (n))
+#define STAT_PATH_END(how, bounces) do { \
+		RenderStats& stat_local_ = thread_stats(); \
+		stat_local_.path_ends[how]++; \
+		stat_local_.depth[(bounces) < STATS_DEPTH_BINS ? (bounces) : STATS_DEPTH_BINS - 1]++; \
+	} while (0)
+
+#else
+
+#define STATS_ENABLED 0
+#define STAT_ADD(counter, n) ((void)0)
+#define STAT_PATH_END(how, bounces) ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,103 @@
+#include "threadpool.h"
+
+#include <chrono>
+
+ThreadPool::ThreadPool(uint num_threads) : job(NULL), generation(0), active(0), stopping(false), remaining(0) {
+	if (0 == num_threads) num_threads = std::thread::hardware_concurrency();
+	if (0 == num_threads) num_threads = 1;
+
+	queues = std::vector<WorkQueue>(num_threads);
+	for (uint i = 0; i < num_threads; i++) {
+		workers.push_back(std::thread(&ThreadPool::worker_main, this, i));
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& t : workers) t.join();
+}
+
+// Deal the items out to the workers, then wait for all of them to finish
+void ThreadPool::parallel_for(size_t count, const Job& job_in, const Idle& idle, uint idle_ms) {
+	uint n = size();
+
+	if (0 == count) return;
+
+	// Dealing round-robin keeps the workers sweeping through the items
+	// together, so items finish roughly in order (tiles in scan order)
+	for (uint i = 0; i < n; i++) {
+		std::lock_guard<std::mutex> guard(queues[i].lock);
+		for (size_t item = i; item < count; item += n) {
+			queues[i].items.push_back(item);
+		}
+	}
+
+	std::unique_lock<std::mutex> guard(lock);
+	remaining = count;
+	job = &job_in;
+	generation++;
+	wake.notify_all();
+
+	// Wait for stragglers too, so nobody is still holding job when we return
+	while (remaining > 0 || active > 0) {
+		done.wait_for(guard, std::chrono::milliseconds(idle_ms));
+		if (remaining > 0 && idle) {
+			guard.unlock();
+			idle();
+			guard.lock();
+		}
+	}
+	job = NULL;
+}
+
+void ThreadPool::worker_main(uint id) {
+	uint seen_generation = 0;
+
+	while (true) {
+		const Job *cur_job;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard, [&]{ return stopping || (generation != seen_generation && NULL != job); });
+			if (stopping) return;
+			seen_generation = generation;
+			cur_job = job;
+			active++;
+		}
+
+		size_t item;
+		while (next_item(id, item)) {
+			(*cur_job)(item, id);
+			remaining--;
+		}
+
+		// Last one out wakes up the caller
+		std::lock_guard<std::mutex> guard(lock);
+		if (0 == --active) done.notify_all();
+	}
+}
+
+// Our own queue is drained front to back, victims are robbed from the back
+bool ThreadPool::next_item(uint id, size_t& item) {
+	uint n = size();
+
+	for (uint i = 0; i < n; i++) {
+		WorkQueue& q = queues[(id + i) % n];
+		std::lock_guard<std::mutex> guard(q.lock);
+		if (!q.items.empty()) {
+			if (0 == i) {
+				item = q.items.front();
+				q.items.pop_front();
+			}
+			else {
+				item = q.items.back();
+				q.items.pop_back();
+			}
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,67 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <sys/types.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads that run parallel_for jobs
+// Each worker owns a queue of item indices; once its own queue runs dry
+// it steals from the far end of the other workers' queues, so a few
+// expensive items can't leave the rest of the machine idle
+// Items are dealt out round-robin, so they finish in roughly index order
+class ThreadPool {
+public:
+	// Called once per item, with the index of the worker running it
+	typedef std::function<void(size_t item, uint thread_id)> Job;
+
+	// Called on the calling thread every idle_ms while a job is running
+	typedef std::function<void(void)> Idle;
+
+	// num_threads of 0 means one worker per hardware thread
+	ThreadPool(uint num_threads = 0);
+	~ThreadPool();
+
+	// Runs job over items [0, count), blocks until every item is done
+	void parallel_for(size_t count, const Job& job, const Idle& idle = Idle(), uint idle_ms = 100);
+
+	// Number of worker threads
+	uint size() const { return workers.size(); }
+
+private:
+	struct WorkQueue {
+		std::mutex lock;
+		std::deque<size_t> items;
+	};
+
+	void worker_main(uint id);
+
+	// Pops from our own queue, or steals from someone else's
+	// Returns false once there is no work left anywhere
+	bool next_item(uint id, size_t& item);
+
+	std::vector<std::thread> workers;
+	std::vector<WorkQueue> queues;
+
+	// Protects job, generation, active and stopping
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable done;
+
+	const Job *job;
+	uint generation;
+
+	// Workers currently inside a job
+	uint active;
+	bool stopping;
+
+	// Items not yet finished in the current job
+	std::atomic<size_t> remaining;
+};
+
+#endif
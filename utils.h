@@ -2,6 +2,7 @@
 #define UTILS_H
 
 #include <cstdlib>
+#include <stdint.h>
 
 // Utility functions:
 // Lerp- Linear interpolate
@@ -12,14 +13,79 @@ inline T Lerp (T a, T b, double t) {
 	return ((1.0 - t) * a) + (t * b);
 }
 
+// Scrambles the bits of a 64-bit value (SplitMix64 finalizer)
+// Good for turning (seed, pixel, sample) into independent engine seeds
+inline uint64_t hash_u64 (uint64_t x) {
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+// FNV-1a over len bytes at data
+// Pass the last result back in as hash to keep hashing more data
+inline uint64_t hash_bytes (const void *data, size_t len, uint64_t hash = 0xcbf29ce484222325ULL) {
+	const uint8_t *bytes = (const uint8_t*)data;
+	for (size_t i = 0; i < len; i++) hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+	return hash;
+}
+
+// PCG32 random engine (see pcg-random.org)
+// 16 bytes of state, so it's cheap to make one per thread or per pixel
+class Rng {
+public:
+	Rng() { seed(0); }
+	Rng(uint64_t seed_in, uint64_t stream = 0) { seed(seed_in, stream); }
+
+	void seed(uint64_t seed_in, uint64_t stream = 0) {
+		state = 0;
+		inc = (stream << 1) | 1;
+		next_u32();
+		state += seed_in;
+		next_u32();
+	}
+
+	uint32_t next_u32() {
+		uint64_t old = state;
+		state = old * 6364136223846793005ULL + inc;
+		uint32_t xorshifted = ((old >> 18) ^ old) >> 27;
+		uint32_t rot = old >> 59;
+		return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+	}
+
+	// Returns a random double [0.0,1.0)
+	double next_double() { return next_u32() * (1.0 / 4294967296.0); }
+
+	// Returns a random double [min,max)
+	double range(double min, double max) { return Lerp(min, max, next_double()); }
+
+	// Returns a random integer [0,n)
+	uint32_t below(uint32_t n) { return ((uint64_t)next_u32() * n) >> 32; }
+
+	uint64_t state;
+	uint64_t inc;
+};
+
+// The engine used by rand_double() and friends on this thread
+inline Rng& thread_rng() {
+	static thread_local Rng rng;
+	return rng;
+}
+
+// Restart this thread's engine for one sample of one pixel
+// The result only depends on the arguments, never on which thread
+// (or in what order) the sample runs, so renders are reproducible
+inline void seed_sample_rng (uint64_t frame_seed, uint64_t pixel, uint64_t sample) {
+	thread_rng().seed(hash_u64(hash_u64(hash_u64(frame_seed) + pixel) + sample));
+}
+
 // Returns a random double [0.0,1.0)
 inline double rand_double() {
-	// Adding the 1.0 prevents this from ever returning RAND_MAX
-	return rand() / (RAND_MAX + 1.0);
+	return thread_rng().next_double();
 }
 
 inline double rand_range(double min, double max) {
 	return Lerp(min, max, rand_double());
 }
 
-#endif
\ No newline at end of file
+#endif
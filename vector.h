@@ -1,42 +1,50 @@
 #ifndef VECTOR_H
 #define VECTOR_H
 
+#include <string.h>
 #include <tgmath.h> // Type generic math
 
-class Vector3 {
+// Four doubles, held in SIMD registers (GCC vector extensions):
+// a Vector3 takes two SSE2 registers, or one with AVX (`make ARCH=native`)
+typedef double Vector3Lanes __attribute__((vector_size(4 * sizeof(double))));
+
+// Stored as four aligned lanes, the last one padding, so the arithmetic
+// operators load whole registers and do one SIMD instruction per register
+// Aligned to its full size even where registers are narrower, so code
+// built for AVX and code built without it agree on the layout
+class alignas(4 * sizeof(double)) Vector3 {
 public:
-	Vector3() : x(0), y(0), z(0) {}
-	Vector3(double x_in, double y_in, double z_in) : x(x_in), y(y_in), z(z_in) {}
+	typedef Vector3Lanes Lanes;
+
+	Vector3() : x(0), y(0), z(0), padding(0) {}
+	Vector3(double x_in, double y_in, double z_in) : x(x_in), y(y_in), z(z_in), padding(0) {}
+	explicit Vector3(const Lanes& lanes_in) { memcpy(&x, &lanes_in, sizeof(lanes_in)); }
 
 	double getx () const { return x; }
 	double gety () const { return y; }
 	double getz () const { return z; }
 
 	// Negation operator
-	Vector3 operator- () { return Vector3(-x, -y, -z); }
-
-	// Indexing (because why not?)
-	double& operator[](int idx) {
-		switch (idx) {
-			case 0: return this->x;
-			case 1: return this->y;
-			case 2: return this->z;
-		}
-	}
+	Vector3 operator- () const { return Vector3(-x, -y, -z); }
+
+	// Indexing (because why not?), 0 to 2
+	double& operator[](int idx) { return (&x)[idx]; }
+	double operator[](int idx) const { return (&x)[idx]; }
 
 	// Addition
 	Vector3& operator+=(const Vector3& other) {
-		this->x += other.x;
-		this->y += other.y;
-		this->z += other.z;
+		Lanes u, v;
+		load(u);
+		other.load(v);
+		*this = Vector3(u + v);
 		return *this;
 	}
 
 	// Multiplication
 	Vector3& operator*=(double t) {
-		this->x *= t;
-		this->y *= t;
-		this->z *= t;
+		Lanes u;
+		load(u);
+		*this = Vector3(u * t);
 		return *this;
 	}
 
@@ -45,11 +53,31 @@ public:
 		return *this *= 1/t;
 	}
 
+	// Copies all four lanes into registers
+	void load(Lanes& out) const { memcpy(&out, &x, sizeof(out)); }
+
 	// Length
 	double length() const { return sqrt(length_squared()); }
-	double length_squared() const { return (x*x) + (y*y) + (z*z); }
+	double length_squared() const {
+		return x * x + y * y + z * z;
+	}
+
+	double x;
+	double y;
+	double z;
+	double padding;
+};
+
+// Three doubles with no padding lane, for storage with a fixed layout
+// (BVH nodes, which are mapped straight out of scene files)
+// Converts to and from Vector3, do the math on that
+class PackedVector3 {
+public:
+	PackedVector3() : x(0), y(0), z(0) {}
+	PackedVector3(const Vector3& v) : x(v.x), y(v.y), z(v.z) {}
+
+	operator Vector3() const { return Vector3(x, y, z); }
 
-	// The internal Cartesian dimensions
 	double x;
 	double y;
 	double z;
@@ -57,40 +85,93 @@ public:
 
 // Misc. other non-member operator overload utilities:
 // Mark operands as const in case temporaries are created
-// Example: vectorA + (time * vectorB) 
+// Example: vectorA + (time * vectorB)
 // Will create a temporary that is added to vectorA
 inline Vector3 operator+ (const Vector3& u, const Vector3& v) {
-	return Vector3(u.x + v.x, u.y + v.y, u.z + v.z);
+	Vector3::Lanes a, b;
+	u.load(a);
+	v.load(b);
+	return Vector3(a + b);
 }
 
 inline Vector3 operator- (const Vector3& u, const Vector3& v) {
-	return Vector3(u.x - v.x, u.y - v.y, u.z - v.z);
+	Vector3::Lanes a, b;
+	u.load(a);
+	v.load(b);
+	return Vector3(a - b);
 }
 
 inline Vector3 operator* (const Vector3& u, const Vector3& v) {
-	return Vector3(u.x * v.x, u.y * v.y, u.z * v.z);
+	Vector3::Lanes a, b;
+	u.load(a);
+	v.load(b);
+	return Vector3(a * b);
 }
 
 inline Vector3 operator* (double t, const Vector3& u) {
-	return Vector3(t * u.x, t * u.y, t * u.z);
+	Vector3::Lanes a;
+	u.load(a);
+	return Vector3(t * a);
 }
 
 inline Vector3 operator* (const Vector3& u, double t) {
-	return Vector3(t * u.x, t * u.y, t * u.z);
+	Vector3::Lanes a;
+	u.load(a);
+	return Vector3(t * a);
 }
 
 inline Vector3 operator/ (const Vector3& u, double t) {
-	return Vector3 (u.x/t, u.y/t, u.z/t);
+	Vector3::Lanes a;
+	u.load(a);
+	return Vector3(a / t);
+}
+
+// 1 / sqrt(x)
+// x86 only has an approximate reciprocal square root for float (and
+// for double from AVX-512 on), and refining it to full double precision
+// takes longer than the square root and one divide it would replace
+inline double rsqrt (double x) {
+	return 1 / sqrt(x);
 }
 
+// One reciprocal square root and a multiply, rather than three divides
 inline Vector3 unit (const Vector3& u) {
-	return u / u.length();
+	return u * rsqrt(u.length_squared());
 }
 
 inline double dot (const Vector3& u, const Vector3& v) {
-	return u.x * v.x +
-		   u.y * v.y +
-		   u.z * v.z;
+	return u.x * v.x + u.y * v.y + u.z * v.z;
+}
+
+// u * t + v, rounded once where the CPU has FMA (`make ARCH=native`)
+// Elsewhere it's a multiply and an add, exactly like writing it out
+inline Vector3 fmadd (const Vector3& u, double t, const Vector3& v) {
+#ifdef __FMA__
+	return Vector3(fma(u.x, t, v.x), fma(u.y, t, v.y), fma(u.z, t, v.z));
+#else
+	Vector3::Lanes a, b;
+	u.load(a);
+	v.load(b);
+	return Vector3(a * t + b);
+#endif
+}
+
+// u * w + v, per component
+inline Vector3 fmadd (const Vector3& u, const Vector3& w, const Vector3& v) {
+#ifdef __FMA__
+	return Vector3(fma(u.x, w.x, v.x), fma(u.y, w.y, v.y), fma(u.z, w.z, v.z));
+#else
+	Vector3::Lanes a, b, c;
+	u.load(a);
+	w.load(b);
+	v.load(c);
+	return Vector3(a * b + c);
+#endif
+}
+
+// Brightness of a linear RGB color (Rec. 709 weights)
+inline double luminance (const Vector3& c) {
+	return 0.2126 * c.x + 0.7152 * c.y + 0.0722 * c.z;
 }
 
 class Ray {
@@ -99,7 +180,7 @@ public:
 	Ray(const Vector3& pos_in, const Vector3& dir_in) : pos(pos_in), dir(dir_in) {}
 
 	Vector3 at (double t) const {
-		return pos + (t*dir);
+		return fmadd(dir, t, pos);
 	}
 
 	Ray& operator=(const Ray& other) {
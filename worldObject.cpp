@@ -0,0 +1,554 @@
+#include <algorithm>
+#include <assert.h>
+
+#include "worldObject.h"
+#include "sphere.h"
+#include "stats.h"
+
+// Default packet tracing: one ray at a time
+void WorldObject::hit_packet(RayPacket& packet, double t_min) const {
+	for (uint k = 0; k < packet.size; k++) {
+		if (hit(packet.rays[k], t_min, packet.t_max_out[k], packet.points[k])) {
+			packet.hit[k] = true;
+			packet.t_max_out[k] = packet.points[k].t_collision;
+		}
+	}
+}
+
+bool WorldObject::occluded(const Ray& ray, double t_min, double t_max) const {
+	CollisionPoint point;
+	return hit(ray, t_min, t_max, point);
+}
+
+// Picks one component of a vector by axis index (0 = x, 1 = y, 2 = z)
+static inline double axis_of(const Vector3& v, int axis) {
+	return (0 == axis) ? v.x : ((1 == axis) ? v.y : v.z);
+}
+
+// Depth of the traversal stack, build_node never makes a deeper tree than this
+#define BVH_STACK_SIZE ((BVH_MAX_DEPTH + 1))
+
+void WorldGroup::build() {
+	vector<AABB> boxes;
+	vector<uint32_t> order;
+
+	drop_hierarchy();
+	if (objects.empty()) return;
+
+	// Bounds are queried once up front, build_node keeps them in step with order
+	boxes.reserve(objects.size());
+	for (WorldObject *obj : objects) boxes.push_back(obj->bounding_box());
+	build_nodes(boxes, order);
+
+	vector<WorldObject*> unordered;
+	unordered.swap(objects);
+	for (uint32_t idx : order) objects.push_back(unordered[idx]);
+
+	// Pack spheres in leaf order so each leaf is one contiguous SIMD run
+	for (WorldObject *obj : objects) {
+		const Sphere *sphere = dynamic_cast<const Sphere*>(obj);
+		if (NULL != sphere) spheres.add(sphere->center, sphere->radius, sphere->material_id);
+		else spheres.add(Vector3(0,0,0), 0.0, MATERIAL_NONE);
+	}
+
+	for (BVHNode& node : own_nodes) {
+		node.packed = (node.count > 0);
+		for (uint32_t i = node.offset; node.packed && i < node.offset + node.count; i++) {
+			if (NULL == dynamic_cast<const Sphere*>(objects[i])) node.packed = false;
+		}
+	}
+}
+
+void WorldGroup::build(const SphereSet& spheres_in) {
+	vector<AABB> boxes;
+	vector<uint32_t> order;
+
+	objects.clear();
+	drop_hierarchy();
+	if (0 == spheres_in.size()) return;
+
+	// Same boxes Sphere::bounding_box gives
+	boxes.reserve(spheres_in.size());
+	for (size_t i = 0; i < spheres_in.size(); i++) {
+		Vector3 center = Vector3(spheres_in.cx[i], spheres_in.cy[i], spheres_in.cz[i]);
+		Vector3 extent = Vector3(spheres_in.radius[i], spheres_in.radius[i], spheres_in.radius[i]);
+		boxes.push_back(AABB(center - extent, center + extent));
+	}
+	build_nodes(boxes, order);
+
+	slot_of.resize(order.size());
+	for (uint32_t slot = 0; slot < order.size(); slot++) {
+		uint32_t idx = order[slot];
+		spheres.add(Vector3(spheres_in.cx[idx], spheres_in.cy[idx], spheres_in.cz[idx]), spheres_in.radius[idx], spheres_in.material(idx));
+		slot_of[idx] = slot;
+	}
+	for (BVHNode& node : own_nodes) node.packed = (node.count > 0);
+}
+
+void WorldGroup::attach(const BVHNode *nodes_in, uint32_t num_nodes_in, const SphereSet& spheres_in, const uint32_t *slot_of_in) {
+	objects.clear();
+	drop_hierarchy();
+	nodes = nodes_in;
+	num_nodes = num_nodes_in;
+	spheres.borrow(spheres_in);
+	if (NULL != slot_of_in) slot_of.assign(slot_of_in, slot_of_in + spheres.size());
+}
+
+void WorldGroup::move_sphere(size_t idx, const Vector3& center, double radius) {
+	// Borrowed (say, from a mapped scene file), take copies we can change
+	if (nodes != own_nodes.data()) {
+		own_nodes.assign(nodes, nodes + num_nodes);
+		nodes = own_nodes.data();
+	}
+	spheres.own();
+	spheres.move(sphere_slot(idx), center, radius);
+}
+
+double WorldGroup::refit() {
+	double cost = 0.0;
+
+	if (nodes != own_nodes.data()) return sah_cost();
+
+	// Children always come after their parent, so sweeping backwards
+	// refits both children of a node before the node itself
+	for (uint32_t i = num_nodes; i-- > 0;) {
+		BVHNode& node = own_nodes[i];
+		AABB box;
+		if (node.count > 0) {
+			for (uint32_t j = node.offset; j < node.offset + node.count; j++) {
+				Vector3 center = Vector3(spheres.cx[j], spheres.cy[j], spheres.cz[j]);
+				Vector3 extent = Vector3(spheres.radius[j], spheres.radius[j], spheres.radius[j]);
+				box.grow(AABB(center - extent, center + extent));
+			}
+		}
+		else {
+			box = own_nodes[i + 1].box;
+			box.grow(own_nodes[node.offset].box);
+		}
+		node.box = box;
+		cost += box.area() * std::max((uint32_t)node.count, 1u);
+	}
+
+	double root_area = (num_nodes > 0) ? own_nodes[0].box.area() : 0.0;
+	return (root_area > 0.0) ? cost / root_area : 0.0;
+}
+
+// Same costs as build_node: one per node visited, one per object tested
+double WorldGroup::sah_cost() const {
+	if (0 == num_nodes || 0.0 == nodes[0].box.area()) return 0.0;
+
+	double cost = 0.0;
+	for (uint32_t i = 0; i < num_nodes; i++) {
+		cost += nodes[i].box.area() * std::max((uint32_t)nodes[i].count, 1u);
+	}
+	return cost / nodes[0].box.area();
+}
+
+void WorldGroup::rebuild() {
+	SphereSet current;
+	vector<uint32_t> old_slot_of;
+
+	// Build from where the spheres are now, in leaf order
+	for (size_t i = 0; i < spheres.size(); i++) {
+		current.add(Vector3(spheres.cx[i], spheres.cy[i], spheres.cz[i]), spheres.radius[i], spheres.material(i));
+	}
+	old_slot_of.swap(slot_of);
+	build(current);
+
+	// Spheres keep the numbers they were first given
+	if (!old_slot_of.empty()) {
+		for (uint32_t& slot : old_slot_of) slot = slot_of[slot];
+		slot_of.swap(old_slot_of);
+	}
+}
+
+void WorldGroup::build_nodes(vector<AABB>& boxes, vector<uint32_t>& order) {
+	order.resize(boxes.size());
+	for (uint32_t i = 0; i < order.size(); i++) order[i] = i;
+
+	own_nodes.reserve(2 * boxes.size());
+	build_node(boxes, order, 0, boxes.size(), 0);
+	nodes = own_nodes.data();
+	num_nodes = own_nodes.size();
+}
+
+// Can a run of count objects at depth only just still be halved down to
+// leaves of BVH_MAX_LEAF before BVH_MAX_DEPTH? (then it has to be)
+static inline bool must_halve(uint32_t count, uint depth) {
+	uint levels_left = BVH_MAX_DEPTH - depth;
+	return levels_left > 0 && levels_left <= 32 && (uint64_t)count > ((uint64_t)BVH_MAX_LEAF << (levels_left - 1));
+}
+
+/***************
+ * build_node
+ *
+ * Splits a run of objects with the surface area heuristic:
+ * centroids are binned along the widest axis, and we cut at the
+ * bin boundary that minimizes (area * count) of the two halves.
+ * If no cut beats testing every object directly, we make a leaf.
+ * Runs that can't be cut that way, or that would otherwise run out of
+ * depth, are split at the middle object so no leaf holds more than
+ * BVH_MAX_LEAF.
+ ***************/
+uint32_t WorldGroup::build_node(vector<AABB>& boxes, vector<uint32_t>& order, uint32_t first, uint32_t count, uint depth) {
+	uint32_t node_idx = own_nodes.size();
+	own_nodes.push_back(BVHNode());
+
+	AABB bounds, centroid_bounds;
+	for (uint32_t i = first; i < first + count; i++) {
+		bounds.grow(boxes[i]);
+		centroid_bounds.grow(boxes[i].centroid());
+	}
+	own_nodes[node_idx].box = bounds;
+
+	// Widest centroid axis
+	Vector3 extent = Vector3(centroid_bounds.max) - Vector3(centroid_bounds.min);
+	int axis = 0;
+	if (extent.y > extent.x) axis = 1;
+	if (extent.z > axis_of(extent, axis)) axis = 2;
+	double axis_min = axis_of(centroid_bounds.min, axis);
+	double axis_len = axis_of(extent, axis);
+
+	// Nothing to split (or we're as deep as traversal can go)
+	if (count <= BVH_MAX_LEAF && (count <= 1 || axis_len <= 0.0 || depth >= BVH_MAX_DEPTH)) goto MAKE_LEAF;
+
+	// Coincident centroids, or only just enough levels left to get every
+	// leaf down to BVH_MAX_LEAF by halving: split at the middle object
+	// (leaves count objects in a uint16_t, and traversal stacks are only
+	// BVH_MAX_DEPTH deep)
+	if (axis_len <= 0.0 || must_halve(count, depth)) goto MEDIAN_SPLIT;
+
+	{
+		// Bin the centroids
+		AABB bin_bounds[BVH_BINS];
+		uint32_t bin_count[BVH_BINS] = {0};
+		double scale = BVH_BINS / axis_len;
+		for (uint32_t i = first; i < first + count; i++) {
+			int b = std::min(BVH_BINS - 1, (int)((axis_of(boxes[i].centroid(), axis) - axis_min) * scale));
+			bin_count[b]++;
+			bin_bounds[b].grow(boxes[i]);
+		}
+
+		// Sweep from the right to get the cost of everything past each cut
+		double right_cost[BVH_BINS];
+		AABB acc;
+		uint32_t acc_count = 0;
+		for (int b = BVH_BINS - 1; b > 0; b--) {
+			acc.grow(bin_bounds[b]);
+			acc_count += bin_count[b];
+			right_cost[b] = acc.area() * acc_count;
+		}
+
+		// Then sweep from the left to find the cheapest cut
+		int best_split = -1;
+		double best_cost = std::numeric_limits<double>::infinity();
+		acc = AABB();
+		acc_count = 0;
+		for (int b = 0; b < BVH_BINS - 1; b++) {
+			acc.grow(bin_bounds[b]);
+			acc_count += bin_count[b];
+			double cost = acc.area() * acc_count + right_cost[b+1];
+			if (acc_count > 0 && acc_count < count && cost < best_cost) {
+				best_cost = cost;
+				best_split = b;
+			}
+		}
+
+		// Cost of a leaf vs cost of splitting (one traversal step ~ one object test)
+		double leaf_cost = bounds.area() * count;
+		double split_cost = bounds.area() + best_cost;
+		if (count <= BVH_MAX_LEAF && (best_split < 0 || leaf_cost <= split_cost)) goto MAKE_LEAF;
+		if (best_split < 0) goto MEDIAN_SPLIT;
+
+		// Partition boxes (and which object each one is) around the cut
+		uint32_t mid = first;
+		for (uint32_t i = first; i < first + count; i++) {
+			int b = std::min(BVH_BINS - 1, (int)((axis_of(boxes[i].centroid(), axis) - axis_min) * scale));
+			if (b <= best_split) {
+				std::swap(boxes[i], boxes[mid]);
+				std::swap(order[i], order[mid]);
+				mid++;
+			}
+		}
+
+		build_node(boxes, order, first, mid - first, depth + 1);
+		uint32_t second = build_node(boxes, order, mid, first + count - mid, depth + 1);
+
+		own_nodes[node_idx].offset = second;
+		own_nodes[node_idx].count = 0;
+		own_nodes[node_idx].axis = axis;
+		return node_idx;
+	}
+
+MEDIAN_SPLIT:
+	{
+		uint32_t half = count / 2;
+		build_node(boxes, order, first, half, depth + 1);
+		uint32_t second = build_node(boxes, order, first + half, count - half, depth + 1);
+
+		own_nodes[node_idx].offset = second;
+		own_nodes[node_idx].count = 0;
+		own_nodes[node_idx].axis = axis;
+		return node_idx;
+	}
+
+MAKE_LEAF:
+	assert(count <= BVH_MAX_LEAF);
+	own_nodes[node_idx].offset = first;
+	own_nodes[node_idx].count = count;
+	own_nodes[node_idx].axis = 0;
+	return node_idx;
+}
+
+// Walk the hierarchy nearest child first, shrinking t_max every time we
+// hit something so boxes behind the closest hit are skipped entirely
+bool WorldGroup::hit (const Ray& ray, double t_min, double t_max, CollisionPoint& point) const {
+	bool hit_something = false;
+
+	if (0 == num_nodes) return false;
+
+	Vector3 inv_dir = Vector3(1.0 / ray.dir.x, 1.0 / ray.dir.y, 1.0 / ray.dir.z);
+	bool dir_neg[3] = { inv_dir.x < 0, inv_dir.y < 0, inv_dir.z < 0 };
+
+	// Nodes still to visit, along with where the ray enters them
+	uint32_t stack[BVH_STACK_SIZE];
+	double stack_t[BVH_STACK_SIZE];
+	int top = 0;
+
+	// Counted here and handed to the stats once, they compile out without them
+	uint64_t visited = 0, tests = 0;
+
+	double t_enter;
+	if (!nodes[0].box.hit(ray.pos, inv_dir, t_min, t_max, t_enter)) return false;
+	stack[top] = 0;
+	stack_t[top++] = t_enter;
+
+	while (top > 0) {
+		top--;
+
+		// Early exit: something closer was already found
+		if (stack_t[top] > t_max) continue;
+
+		const BVHNode& node = nodes[stack[top]];
+		visited++;
+		if (node.count > 0) {
+			tests += node.count;
+			if (hit_leaf(node, ray, t_min, t_max, point)) hit_something = true;
+			continue;
+		}
+
+		// Visit the child on the ray's side of the split first
+		uint32_t near_idx = stack[top] + 1, far_idx = node.offset;
+		if (dir_neg[node.axis]) std::swap(near_idx, far_idx);
+
+		double t_near, t_far;
+		bool hit_near = nodes[near_idx].box.hit(ray.pos, inv_dir, t_min, t_max, t_near);
+		bool hit_far = nodes[far_idx].box.hit(ray.pos, inv_dir, t_min, t_max, t_far);
+
+		if (hit_far) {
+			stack[top] = far_idx;
+			stack_t[top++] = t_far;
+		}
+		if (hit_near) {
+			stack[top] = near_idx;
+			stack_t[top++] = t_near;
+		}
+	}
+
+	STAT_ADD(nodes_visited, visited);
+	STAT_ADD(object_tests, tests);
+	return hit_something;
+}
+
+// Like hit(), but done at the first hit found, in whatever order
+// (no closest hit to find, so no nodes are skipped by distance either)
+bool WorldGroup::occluded(const Ray& ray, double t_min, double t_max) const {
+	bool blocked = false;
+
+	if (0 == num_nodes) return false;
+
+	Vector3 inv_dir = Vector3(1.0 / ray.dir.x, 1.0 / ray.dir.y, 1.0 / ray.dir.z);
+	bool dir_neg[3] = { inv_dir.x < 0, inv_dir.y < 0, inv_dir.z < 0 };
+
+	uint32_t stack[BVH_STACK_SIZE];
+	int top = 0;
+
+	uint64_t visited = 0, tests = 0;
+
+	double t_enter;
+	if (!nodes[0].box.hit(ray.pos, inv_dir, t_min, t_max, t_enter)) return false;
+	stack[top++] = 0;
+
+	while (top > 0 && !blocked) {
+		const BVHNode& node = nodes[stack[--top]];
+		visited++;
+		if (node.count > 0) {
+			tests += node.count;
+			if (node.packed) {
+				double t_hit = t_max;
+				blocked = (spheres.hit(ray, node.offset, node.count, t_min, t_hit) >= 0);
+			}
+			else {
+				for (uint32_t i = node.offset; i < node.offset + node.count && !blocked; i++) {
+					blocked = objects[i]->occluded(ray, t_min, t_max);
+				}
+			}
+			continue;
+		}
+
+		// Nearer child first still finds blockers sooner on average
+		uint32_t near_idx = stack[top] + 1, far_idx = node.offset;
+		if (dir_neg[node.axis]) std::swap(near_idx, far_idx);
+
+		double t_near, t_far;
+		if (nodes[far_idx].box.hit(ray.pos, inv_dir, t_min, t_max, t_far)) stack[top++] = far_idx;
+		if (nodes[near_idx].box.hit(ray.pos, inv_dir, t_min, t_max, t_near)) stack[top++] = near_idx;
+	}
+
+	STAT_ADD(nodes_visited, visited);
+	STAT_ADD(object_tests, tests);
+	return blocked;
+}
+
+// Leaves of spheres go through the packed kernel, anything else is tested one by one
+bool WorldGroup::hit_leaf(const BVHNode& node, const Ray& ray, double t_min, double& t_max, CollisionPoint& point) const {
+	bool hit_something = false;
+
+	if (node.packed) {
+		long idx = spheres.hit(ray, node.offset, node.count, t_min, t_max);
+		if (idx >= 0) {
+			spheres.fill_point(idx, ray, t_max, point);
+			hit_something = true;
+		}
+		return hit_something;
+	}
+
+	CollisionPoint test_point;
+	for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+		if (objects[i]->hit(ray, t_min, t_max, test_point)) {
+			hit_something = true;
+			t_max = test_point.t_collision;
+			point = test_point;
+			// Same slot as its packed copy
+			point.object = i;
+		}
+	}
+	return hit_something;
+}
+
+// Bounds on a product of two intervals
+static inline void interval_mul(double a_lo, double a_hi, double b_lo, double b_hi, double& lo, double& hi) {
+	double p0 = a_lo * b_lo, p1 = a_lo * b_hi, p2 = a_hi * b_lo, p3 = a_hi * b_hi;
+	lo = std::min(std::min(p0, p1), std::min(p2, p3));
+	hi = std::max(std::max(p0, p1), std::max(p2, p3));
+}
+
+/***************
+ * hit_packet
+ *
+ * Traces a packet through the hierarchy as one unit:
+ *  - A node is culled if interval bounds on the packet's origins and
+ *    inverse directions prove no ray in it can touch the node's box
+ *  - Otherwise rays are tested in order until one hits the box; rays
+ *    before that one skip the whole subtree ("first active ray")
+ *  - Children are visited in the same order for the whole packet,
+ *    picked from the shared direction signs
+ *
+ * Packets whose rays don't agree on direction signs can't share
+ * ordering or interval bounds, so they are traced ray by ray
+ ***************/
+void WorldGroup::hit_packet(RayPacket& packet, double t_min) const {
+	uint n = packet.size;
+
+	if (0 == num_nodes || 0 == n) return;
+
+	Vector3 inv_dir[MAX_PACKET_SIZE];
+	Vector3 o_lo = packet.rays[0].pos, o_hi = packet.rays[0].pos;
+	Vector3 i_lo, i_hi;
+	double packet_t_max = 0.0;
+
+	for (uint k = 0; k < n; k++) {
+		const Ray& r = packet.rays[k];
+		inv_dir[k] = Vector3(1.0 / r.dir.x, 1.0 / r.dir.y, 1.0 / r.dir.z);
+		if (0 == k) { i_lo = inv_dir[k]; i_hi = inv_dir[k]; }
+
+		// Every ray has to head the same way as the first one on every axis
+		if ((inv_dir[k].x < 0) != (inv_dir[0].x < 0) ||
+			(inv_dir[k].y < 0) != (inv_dir[0].y < 0) ||
+			(inv_dir[k].z < 0) != (inv_dir[0].z < 0)) {
+			WorldObject::hit_packet(packet, t_min);
+			return;
+		}
+
+		o_lo = Vector3(std::min(o_lo.x, r.pos.x), std::min(o_lo.y, r.pos.y), std::min(o_lo.z, r.pos.z));
+		o_hi = Vector3(std::max(o_hi.x, r.pos.x), std::max(o_hi.y, r.pos.y), std::max(o_hi.z, r.pos.z));
+		i_lo = Vector3(std::min(i_lo.x, inv_dir[k].x), std::min(i_lo.y, inv_dir[k].y), std::min(i_lo.z, inv_dir[k].z));
+		i_hi = Vector3(std::max(i_hi.x, inv_dir[k].x), std::max(i_hi.y, inv_dir[k].y), std::max(i_hi.z, inv_dir[k].z));
+		packet_t_max = std::max(packet_t_max, packet.t_max_out[k]);
+	}
+	bool dir_neg[3] = { inv_dir[0].x < 0, inv_dir[0].y < 0, inv_dir[0].z < 0 };
+
+	// Nodes still to visit, along with the first ray that might hit them
+	uint32_t stack[BVH_STACK_SIZE];
+	uint stack_first[BVH_STACK_SIZE];
+	int top = 0;
+
+	stack[top] = 0;
+	stack_first[top++] = 0;
+
+	uint64_t visited = 0, tests = 0;
+	while (top > 0) {
+		top--;
+		const BVHNode& node = nodes[stack[top]];
+		uint first = stack_first[top];
+		double t_enter;
+		visited++;
+
+		// Interval culling: bound where the packet enters and leaves each slab
+		// A negative direction swaps which plane is entered first
+		double enter_lo = t_min, exit_hi = packet_t_max;
+		for (int axis = 0; axis < 3; axis++) {
+			double near_plane = axis_of(dir_neg[axis] ? node.box.max : node.box.min, axis);
+			double far_plane = axis_of(dir_neg[axis] ? node.box.min : node.box.max, axis);
+			double lo, hi, unused;
+			interval_mul(near_plane - axis_of(o_hi, axis), near_plane - axis_of(o_lo, axis), axis_of(i_lo, axis), axis_of(i_hi, axis), lo, unused);
+			enter_lo = std::max(enter_lo, lo);
+			interval_mul(far_plane - axis_of(o_hi, axis), far_plane - axis_of(o_lo, axis), axis_of(i_lo, axis), axis_of(i_hi, axis), unused, hi);
+			exit_hi = std::min(exit_hi, hi);
+		}
+		if (enter_lo > exit_hi) continue;
+
+		// First active ray: skip rays that miss this box
+		while (first < n && !node.box.hit(packet.rays[first].pos, inv_dir[first], t_min, packet.t_max_out[first], t_enter)) first++;
+		if (first == n) continue;
+
+		if (node.count > 0) {
+			for (uint k = first; k < n; k++) {
+				if (k != first && !node.box.hit(packet.rays[k].pos, inv_dir[k], t_min, packet.t_max_out[k], t_enter)) continue;
+				tests += node.count;
+				if (hit_leaf(node, packet.rays[k], t_min, packet.t_max_out[k], packet.points[k])) packet.hit[k] = true;
+			}
+			continue;
+		}
+
+		// Same near/far order for the whole packet
+		uint32_t near_idx = stack[top] + 1, far_idx = node.offset;
+		if (dir_neg[node.axis]) std::swap(near_idx, far_idx);
+
+		stack[top] = far_idx;
+		stack_first[top++] = first;
+		stack[top] = near_idx;
+		stack_first[top++] = first;
+	}
+
+	STAT_ADD(nodes_visited, visited);
+	STAT_ADD(object_tests, tests);
+}
+
+AABB WorldGroup::bounding_box() const {
+	if (num_nodes > 0) return nodes[0].box;
+
+	AABB box;
+	for (WorldObject *obj : objects) box.grow(obj->bounding_box());
+	return box;
+}
@@ -2,50 +2,190 @@
 #define WORLD_OBJECT_H
 
 #include <vector>
+#include <stdint.h>
 #include "vector.h"
+#include "aabb.h"
 #include "material.h"
 #include "CollisionPoint.h"
+#include "rayPacket.h"
+#include "sphereSet.h"
 
 using std::vector;
 
+// Emissive spheres of a scene (see lights.h)
+class LightList;
+
 // A WorldObject is just something that a ray can hit!
 class WorldObject {
 public:
-	WorldObject(Material& material_in) : material(material_in) {}
+	WorldObject() : material_id(MATERIAL_NONE), materials(NULL), lights(NULL) {}
+	WorldObject(uint32_t material_id_in) : material_id(material_id_in), materials(NULL), lights(NULL) {}
+	virtual ~WorldObject() {}
 
 	// Any classes extending WorldObject are visible to Ray collisions
+	// On a hit, point.material_id is the material of whatever was hit
 	virtual bool hit(const Ray& ray, double t_min, double t_max, CollisionPoint& point) const = 0;
 
+	// Finds the closest hit for every ray in a packet
+	// By default this just calls hit() once per ray
+	virtual void hit_packet(RayPacket& packet, double t_min) const;
+
+	// Is anything hit inside [t_min, t_max]? (shadow rays)
+	// Any hit will do, so this can stop at the first one found
+	// By default this just calls hit()
+	virtual bool occluded(const Ray& ray, double t_min, double t_max) const;
+
+	// A box that fully contains this object
+	virtual AABB bounding_box() const = 0;
+
 public:
-	Material& material;
+	// Index into the scene's MaterialTable
+	// MATERIAL_NONE for groups, their members carry their own materials
+	uint32_t material_id;
+
+	// The table material ids index into, only needed on the object
+	// renders start from (a Scene points its world at its own table)
+	const MaterialTable *materials;
+
+	// Lights to sample at each bounce, likewise only on the root object
+	// (NULL: paths only find lights by bouncing into them)
+	const LightList *lights;
 };
 
-/*
+// Largest number of objects in a BVH leaf (one AVX-512 register of spheres)
+#define BVH_MAX_LEAF 8
+
+// Number of buckets used to estimate the SAH cost of a split
+#define BVH_BINS 16
+
+// Deepest a BVH is allowed to get
+#define BVH_MAX_DEPTH 63
+
 // A group of WorldObjects that can be hit
+// build() puts a bounding volume hierarchy over the objects
+// so each ray only tests the handful of objects along its path
+// Leaves made entirely of spheres are tested with the packed SIMD kernel
+// A group can also be nothing but spheres, with no WorldObjects at all
+// (see build(const SphereSet&) and attach())
 class WorldGroup : public WorldObject {
 public:
-	WorldGroup () {}
-	WorldGroup (WorldObject *obj) { add(obj); }
+	// Flattened hierarchy node, one cache line each
+	// Nodes are stored depth first, so the first child of an interior
+	// node is always the very next node in the array
+	// (plain data, so a hierarchy can be saved and mapped back in as is)
+	struct alignas(64) BVHNode {
+		AABB box;
+
+		// Leaf: index of first object, interior: index of second child
+		uint32_t offset;
+
+		// Number of objects in a leaf, 0 for interior nodes
+		uint16_t count;
+
+		// Split axis of an interior node (used to visit the nearer child first)
+		uint8_t axis;
+
+		// Leaf of nothing but spheres, so the packed copies in spheres can be used
+		uint8_t packed;
+	};
+
+	WorldGroup () : nodes(NULL), num_nodes(0) {}
+	WorldGroup (WorldObject *obj) : nodes(NULL), num_nodes(0) { add(obj); }
+
+	void clear() { objects.clear(); drop_hierarchy(); }
+	void add(WorldObject *obj) { objects.push_back(obj); drop_hierarchy(); }
+
+	// Builds the hierarchy; call after the last add()
+	// Reorders objects so every leaf is a contiguous run of them
+	void build();
 
-	void clear() { objects.clear(); }
-	void add(WorldObject *obj) { objects.push_back(obj); }
+	// Builds a hierarchy over bare spheres instead of objects
+	// The spheres are copied in, in leaf order
+	void build(const SphereSet& spheres_in);
+
+	/**************************************
+	 * attach
+	 *
+	 * Uses a hierarchy built earlier (e.g. read from a scene file) in
+	 * place, along with the spheres it was built over, already in leaf
+	 * order. Nothing is copied, both have to outlive this group.
+	 * Every leaf has to be packed (spheres only).
+	 * slot_of_in gives the leaf-order index of each sphere as the scene
+	 * numbered them before it was built (see sphere_slot), or is NULL
+	 * to number them in leaf order. It's copied.
+	 **************************************/
+	void attach(const BVHNode *nodes_in, uint32_t num_nodes_in, const SphereSet& spheres_in, const uint32_t *slot_of_in = NULL);
+
+	/**************************************
+	 * Animation (groups of bare spheres only)
+	 *
+	 * move_sphere() moves a sphere in place, then refit() grows or
+	 * shrinks every box to fit the spheres again, bottom up, keeping
+	 * the tree as it is. That's a small fraction of the cost of a
+	 * build, but the tree gets looser the further spheres move from
+	 * where it was built; sah_cost() tells how much, and rebuild()
+	 * starts over from where the spheres are now.
+	 * Attached hierarchies and spheres are copied the first time
+	 * anything moves.
+	 **************************************/
+
+	// Where sphere idx (as given to build(), or as numbered by the
+	// slot_of_in given to attach()) is in sphere_set()
+	size_t sphere_slot(size_t idx) const { return slot_of.empty() ? idx : slot_of[idx]; }
+
+	// Moves sphere idx (numbered as for sphere_slot) to center, with radius
+	// Boxes are stale until refit()
+	void move_sphere(size_t idx, const Vector3& center, double radius);
+
+	// Returns sah_cost() of the refit tree (it comes for free on the way)
+	double refit();
+
+	// Cost of tracing a ray through the tree, by the surface area
+	// heuristic build() uses, in units of a ray through the root box
+	double sah_cost() const;
+
+	void rebuild();
 
 	virtual bool hit (const Ray& ray, double t_min, double t_max, CollisionPoint& point) const;
+	virtual void hit_packet(RayPacket& packet, double t_min) const;
+	virtual bool occluded(const Ray& ray, double t_min, double t_max) const;
+	virtual AABB bounding_box() const;
+
+	// The hierarchy and the packed spheres, in leaf order (for saving)
+	const BVHNode *node_array() const { return nodes; }
+	uint32_t node_count() const { return num_nodes; }
+	const SphereSet& sphere_set() const { return spheres; }
 
 	vector<WorldObject*> objects;
-};
 
-// Iterate over all objects in the world group and return the closest one hit by the given ray
-// This is how render main loop operates on its objects array
-bool WorldGroup::hit (const Ray& ray, double t_min, double t_max, CollisionPoint& point) const {
-	CollisionPoint closest_point;
-	bool hit_something = false;
+private:
+	// Forgets the hierarchy (objects have changed)
+	void drop_hierarchy() { own_nodes.clear(); nodes = NULL; num_nodes = 0; spheres.clear(); slot_of.clear(); }
+
+	// Tests one ray against the objects in a leaf, shrinking t_max on a hit
+	bool hit_leaf(const BVHNode& node, const Ray& ray, double t_min, double& t_max, CollisionPoint& point) const;
+
+	// Builds own_nodes over boxes, reordering order (the object index of each box) to match
+	void build_nodes(vector<AABB>& boxes, vector<uint32_t>& order);
+
+	// Recursively builds nodes for boxes [first, first+count)
+	// Returns the index of the node it made
+	uint32_t build_node(vector<AABB>& boxes, vector<uint32_t>& order, uint32_t first, uint32_t count, uint depth);
 
-	// @TODO: Add the rest of this if necessary
-	// See how main loop operates on the WorldObjects *objects[] array
+	// The hierarchy: own_nodes, or borrowed through attach()
+	vector<BVHNode> own_nodes;
+	const BVHNode *nodes;
+	uint32_t num_nodes;
+
+	// Packed copy of every sphere, same indices as objects
+	// (non-sphere slots hold an empty placeholder)
+	SphereSet spheres;
+
+	// Leaf-order index of each sphere given to build(const SphereSet&)
+	// or numbered by attach() (empty when they're already in leaf order)
+	vector<uint32_t> slot_of;
+};
 
-	return true;
-}
-*/
+static_assert(sizeof(WorldGroup::BVHNode) == 64, "BVH nodes should be one cache line");
 
 #endif